@@ -0,0 +1,126 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * AutoExposure.h
+ *
+ * Exposure control for pinholes. The OV2640's own automatic exposure is tuned for the stock
+ * lens, around f/2. Behind a pinhole at f/40 or more it runs out of exposure time at one frame
+ * and makes up the rest with gain, which makes for noisy pictures. A pinhole camera is on a
+ * tripod anyway, so this controller takes the exposure over and spends it the other way
+ * around: rows of exposure time (aec_value) up to a whole frame first, then a slower sensor
+ * clock (the CLKRC divider), which makes each row and so each frame longer, and only then
+ * gain. Going the other way, gain goes first.
+ *
+ * It meters with the sensor's own average of each frame (the OV2640's YAVG), so metering
+ * needs no frame to be decoded or even looked at; it's only waited for. Each step sets the
+ * exposure the last reading says is needed (at most AE_MAX_CHANGE times more or less, since a
+ * clipped reading says little), waits for a frame exposed that way and reads the meter. It
+ * stops when the level is within AE_TOLERANCE of the target, when the exposure is as far as
+ * it'll go, or after AE_MAX_STEPS steps, so it never waits for more than two new frames (see
+ * HalCamera::get()) for each of AE_MAX_STEPS steps. If the exposure is already right,
+ * converge() only reads the meter.
+ *
+ * Exposure is counted in row times at the full frame rate with no gain: lines times clockDiv
+ * times the gain's halGainOf(). A row takes as long in each of the sensor's readout modes, but the faster
+ * ones have fewer rows, so an exposure is at most as many lines as the mode has rows (see
+ * setFrameSize()).
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include "Hal.h"
+
+#define AE_TARGET         (96)                      // The level to aim for, 0 - 255
+#define AE_LEVEL_STEP     (16)                      // How far each step of a profile's ae_level moves the target
+#define AE_TOLERANCE      (8)                       // Within this of the target is close enough
+#define AE_MAX_STEPS      (6)                       // Most exposure changes converge() makes
+#define AE_MAX_CHANGE     (8)                       // Most one step changes the exposure by, either way
+#define AE_MAX_LINES      (1200)                    // Longest aec_value
+#define AE_SVGA_LINES     (600)                     // Rows in the SVGA readout mode (SVGA and VGA)
+#define AE_CIF_LINES      (296)                     // Rows in the CIF readout mode (CIF and QVGA)
+#define AE_MAX_GAIN       (HAL_MAX_GAIN)            // Highest agc_gain (31x)
+#define AE_MAX_CLOCK_DIV  (8)                       // Most the sensor clock is slowed down
+#define AE_CLIPPED        (250)                     // A level this high says only "too bright"
+
+// How a converge() went
+struct aeResult_t {
+  bool converged;                                 // Whether the level ended up close enough to the target
+  uint8_t steps;                                  // Times the exposure was changed
+  uint8_t level;                                  // The last reading
+  uint32_t micros;                                // How long it all took
+  int64_t changedUs;                              // HalClock::micros() of the last change; 0 if none
+  halExposure_t exposure;                         // What the exposure is now
+};
+
+class AutoExposure {
+  public:
+    /**
+     * @brief Exposure control for the given camera and its sensor
+     */
+    AutoExposure(HalClock &clock, HalCamera &camera, HalSensor &sensor);
+
+    /**
+     * @brief Aim for the given level, 0 - 255, instead of AE_TARGET
+     */
+    void setTarget(uint8_t level);
+
+    /**
+     * @brief Slow the sensor clock down by no more than the given factor; 1 for never, which
+     * leaves only gain once the exposure is a whole frame long, as the sensor's own control does
+     */
+    void setMaxClockDiv(uint8_t div);
+
+    /**
+     * @brief Keep the exposure to what the readout mode for the given frame size allows. Call
+     * when the sensor's frame size changes; the exposure is set again at the next converge().
+     */
+    void setFrameSize(halFramesize_t size);
+
+    /**
+     * @brief Meter the scene and change the exposure until the level is close enough to the
+     * target, or it's clear it won't get any closer
+     *
+     * @param result  How it went
+     * @return false  The sensor didn't do as it was told, or the camera didn't deliver
+     */
+    bool converge(aeResult_t &result);
+
+    /**
+     * @brief Forget what the exposure was set to, so converge() sets it again. For when the
+     * sensor has lost it, e.g., by being powered down.
+     */
+    void invalidate();
+
+    /**
+     * @brief The way to spend the given amount of exposure: lines first (up to maxLines), then
+     * clockDiv (up to maxClockDiv), then gain
+     */
+    static halExposure_t split(float amount, uint8_t maxClockDiv, uint16_t maxLines = AE_MAX_LINES);
+
+    /**
+     * @brief The most lines an exposure can be at the given frame size
+     */
+    static uint16_t maxLinesFor(halFramesize_t size);
+
+    /**
+     * @brief How much exposure the given one is, in row times at the full frame rate and no gain
+     */
+    static float amountOf(const halExposure_t &exposure);
+
+  private:
+    bool apply(const halExposure_t &want, aeResult_t &result); // Set the exposure and wait for it
+
+    HalClock &clock;
+    HalCamera &camera;
+    HalSensor &sensor;
+    uint8_t target = AE_TARGET;
+    uint8_t maxClockDiv = AE_MAX_CLOCK_DIV;
+    uint16_t maxLines = AE_MAX_LINES;
+    float amount = AE_MAX_LINES;                  // What the exposure is meant to be
+    halExposure_t exposure {AE_MAX_LINES, 0, 1};  // What it's set to
+    bool set = false;                             // Whether the sensor has it
+};
@@ -0,0 +1,102 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * BootProfile.h
+ *
+ * Boot-time profiler. setup() marks the start and end of each phase of getting the camera
+ * going and, once the camera is ready, the breakdown is appended as a line to BP_LOG on the SD
+ * card. Collect boot.csv files from a bunch of cameras and boots and feed them to
+ * tools/boot_stats.py to get percentiles for each phase.
+ *
+ * Besides the phases setup() marks, two are worked out when the profile is started:
+ *
+ *    rom      Time from power-on or reset until the app started: the ROM and second stage
+ *             bootloader, including loading the app from flash. (From the RTC timer, which
+ *             only restarts on power-on, so after a wake from deep sleep it can't be told and
+ *             is 0.)
+ *    startup  Time from the app starting until setup() was called: ESP-IDF and Arduino init
+ *
+ * Phases can overlap. Camera initialization happens on the other core while setup() is
+ * mounting the SD card, for example.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include "Arduino.h"
+#include "FS.h"
+
+#define BP_LOG            "/boot.csv"               // The boot log on the SD card
+
+// The phases of booting. Keep bpPhaseNames in BootProfile.cpp in step with this.
+enum bpPhase_t : uint8_t {
+  BP_ROM,                                         // Bootloader
+  BP_STARTUP,                                     // ESP-IDF and Arduino startup
+  BP_SERIAL,                                      // Serial.begin() and banner
+  BP_CAMERA,                                      // esp_camera_init() (on the other core)
+  BP_SD_MOUNT,                                    // SD_MMC.begin()
+  BP_CARD_DETECT,                                 // SD_MMC.cardType()
+  BP_CONFIG,                                      // Checking, reading and parsing /pinhole.cfg
+  BP_FREE_SPACE,                                  // Reading the card's free space
+  BP_EEPROM,                                      // EEPROM.begin() and reading the image counter
+  BP_SHUTTER,                                     // shutter.begin()
+  BP_CAMERA_WAIT,                                 // setup() waiting for the camera to be ready
+  BP_N_PHASES                                     // Number of phases; not a phase
+};
+
+class BootProfile {
+  public:
+    /**
+     * @brief Start profiling. Call first thing in setup().
+     */
+    void begin();
+
+    /**
+     * @brief Note that the given phase is starting now
+     */
+    void start(bpPhase_t phase);
+
+    /**
+     * @brief Note that the given phase has ended now
+     */
+    void end(bpPhase_t phase);
+
+    /**
+     * @brief Note that the camera is ready. Everything up to here counts toward boot time.
+     */
+    void ready();
+
+    /**
+     * @brief The microseconds from power-on to ready(), as best we can tell, or after a wake
+     * from deep sleep, from the app starting to ready()
+     */
+    uint64_t readyMicros() const;
+
+    /**
+     * @brief Whether this boot was a wake from deep sleep rather than a power-on or reset
+     */
+    bool woke() const;
+
+    /**
+     * @brief Append the profile as a line to BP_LOG, writing a header line first if the file
+     * is new
+     *
+     * @param fs        The file system to write to
+     * @param cardType  The sdcard_type_t of the card, to tell cards apart in the stats
+     * @param cardMib   The size of the card in MiB, ditto
+     * @param sensorPid The camera sensor's product id, to tell sensors apart
+     * @return true     Success
+     * @return false    Couldn't open the log
+     */
+    bool save(fs::FS &fs, uint8_t cardType, uint32_t cardMib, uint16_t sensorPid) const;
+
+  private:
+    int64_t startUs[BP_N_PHASES];                 // esp_timer_get_time() at start of each phase
+    uint32_t phaseUs[BP_N_PHASES];                // How long each phase took
+    uint64_t romUs;                               // Time before esp_timer started; 0 after a wake
+    bool wokeUp;                                  // Whether this boot is a wake from deep sleep
+    int64_t readyUs;                              // esp_timer_get_time() at ready()
+};
@@ -0,0 +1,87 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * CardSpace.h
+ *
+ * Keeps track of how much room is left on the SD card without asking the card. Asking FatFs
+ * for the free space can mean a scan of the whole FAT, which is far too slow to do on every
+ * shot. So the card's geometry and free space are read once, at boot, and after that each
+ * image written is charged against the free space, rounded up to whole clusters, which is
+ * how FAT allocates space. The same bookkeeping keeps a running average of recent image
+ * sizes so it can estimate how many more shots will fit.
+ *
+ * All of this is plain arithmetic on numbers kept in RAM; nothing here touches the card.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include <stdint.h>
+
+#define CS_RESERVE_BYTES  (1048576UL)               // Keep this much free for directory growth, etc.
+#define CS_LOW_SHOTS      (50)                      // Fewer shots than this remaining is "low"
+#define CS_AVG_SHIFT      (3)                       // Image size average weights the newest 1/8
+
+class CardSpace {
+  public:
+    /**
+     * @brief Start tracking the card. Call once, after the card is mounted.
+     *
+     * @param totalBytes    The capacity of the file system in bytes
+     * @param freeBytes     The number of free bytes in the file system
+     * @param clusterBytes  The size of an allocation unit (cluster) in bytes
+     * @param estImageBytes What we expect an image to take until we've seen some
+     */
+    void begin(uint64_t totalBytes, uint64_t freeBytes, uint32_t clusterBytes, uint32_t estImageBytes);
+
+    /**
+     * @brief Whether a file of the given size will fit while leaving CS_RESERVE_BYTES free
+     */
+    bool hasRoomFor(uint32_t bytes) const;
+
+    /**
+     * @brief Charge a newly written file of the given size against the free space
+     */
+    void recordWrite(uint32_t bytes);
+
+    /**
+     * @brief The number of bytes we believe are free on the card
+     */
+    uint64_t freeBytes() const;
+
+    /**
+     * @brief The capacity of the card in bytes
+     */
+    uint64_t totalBytes() const;
+
+    /**
+     * @brief About how many more images will fit, based on the sizes of recent ones
+     */
+    uint32_t shotsRemaining() const;
+
+    /**
+     * @brief The running average of recent image sizes, as they take up space on the card
+     */
+    uint32_t avgImageBytes() const;
+
+    /**
+     * @brief The card's allocation unit (cluster) size in bytes
+     */
+    uint32_t clusterBytes() const;
+
+    /**
+     * @brief Whether the card is getting full (fewer than CS_LOW_SHOTS shots remaining)
+     */
+    bool low() const;
+
+  private:
+    uint64_t onDisk(uint32_t bytes) const;        // Space a file of bytes occupies on the card
+
+    uint64_t total = 0;                           // Capacity of the file system
+    uint64_t free = 0;                            // Our running idea of the free space
+    uint32_t cluster = 1;                         // Allocation unit size
+    uint32_t avgImage = 0;                        // Running average on-card image size
+};
@@ -0,0 +1,76 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * DeepSleep.h
+ *
+ * Going into deep sleep and coming back out of it when the shutter is clicked. GPIO 12, the
+ * shutter, is one of the GPIOs the RTC controller can watch while the rest of the chip is
+ * powered down, so we use ext0 wakeup on it going low.
+ *
+ * A wake from deep sleep is a reset as far as the app is concerned: setup() runs again and
+ * everything in ordinary RAM is gone. To avoid redoing work that doesn't need redoing, things
+ * worth remembering go in rtcState, which lives in RTC slow memory and survives deep sleep.
+ *
+ * To measure how long it takes from the click to the image being saved, a deep sleep wake
+ * stub notes the RTC time the moment the chip wakes, before the bootloader even runs.
+ *
+ * A caution about GPIO 12: it's a strapping pin that selects the flash voltage, and we hold
+ * it high with an RTC pull-up while asleep. As far as I can tell from the technical reference,
+ * the strapping pins are only latched on chip resets (power-on, brownout, RTC watchdog), not on
+ * deep sleep wakes, so that's okay. If a board does fail to wake, burning the flash voltage
+ * eFuse (espefuse.py set_flash_voltage 3.3V) takes GPIO 12 out of the picture.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include "Arduino.h"
+#include "PinholeConfig.h"
+
+#define RTC_STATE_MAGIC   (0x50483033UL)            // "PH03": rtcState holds something valid
+#define RTC_NO_CFG        (UINT32_MAX)              // rtcState.cfgBytes when there was no CF_PATH
+
+// What we remember across deep sleep
+struct rtcState_t {
+  uint32_t magic;                                 // RTC_STATE_MAGIC if the rest is valid
+  uint64_t cardBytes;                             // SD_MMC.cardSize() of the card, to spot a swap
+  uint32_t cardSerial;                            // Its file system's volume serial number, likewise
+  uint32_t cardFreeHint;                          // FSInfo's free cluster count, to spot writes elsewhere
+  uint64_t totalBytes;                            // Capacity of the card's file system
+  uint64_t freeBytes;                             // What CardSpace thought was free at sleep
+  uint32_t clusterBytes;                          // Card's allocation unit size
+  uint32_t avgImageBytes;                         // CardSpace's running average image size
+  cfSettings_t settings;                          // What CF_PATH said, on top of the defaults
+  uint32_t cfgBytes;                              // CF_PATH's size, to spot an edit; RTC_NO_CFG if none
+  int64_t cfgMtime;                               // CF_PATH's modification time, likewise
+};
+
+extern rtcState_t rtcState;                       // In RTC slow memory
+
+/**
+ * @brief Whether this boot is a wake from deep sleep caused by the shutter
+ */
+bool wokeByShutter();
+
+/**
+ * @brief Microseconds since the chip woke from deep sleep, or 0 if this isn't a wake
+ */
+uint32_t wakeMicros();
+
+/**
+ * @brief Go into deep sleep until the given pin is pulled low. Doesn't return.
+ *
+ * @param shutterPin  The shutter GPIO; must be RTC-capable
+ */
+void sleepUntilShutter(gpio_num_t shutterPin);
+
+/**
+ * @brief Undo what sleepUntilShutter() did to the shutter pin so it's an ordinary GPIO again.
+ * Call in setup() before starting the shutter. Harmless if we didn't wake from deep sleep.
+ *
+ * @param shutterPin  The shutter GPIO
+ */
+void releaseShutterPin(gpio_num_t shutterPin);
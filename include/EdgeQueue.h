@@ -0,0 +1,69 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * EdgeQueue.h
+ *
+ * A queue of shutter switch edges (see halEdge_t in Hal.h) from an interrupt handler to the
+ * code that reads them. One side only ever puts and the other only ever gets, and each only
+ * changes its own index, so it needs no locks and put() is safe in an interrupt handler.
+ * Everything is inline, and forced to be, so on the camera it all ends up in the handler's
+ * IRAM; the handler may run while the flash cache is off.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include <atomic>
+#include "Hal.h"
+
+#define EQ_LEN            (32)                      // Edges the queue can hold, plus one
+#define EQ_INLINE         inline __attribute__((always_inline))
+
+class EdgeQueue {
+  public:
+    /**
+     * @brief Add an edge to the end of the queue
+     *
+     * @return false  The queue is full; the edge is lost
+     */
+    EQ_INLINE bool put(const halEdge_t &edge) {
+      uint8_t t = tail.load(std::memory_order_relaxed);
+      uint8_t next = (t + 1) % EQ_LEN;
+      if (next == head.load(std::memory_order_acquire)) {
+        return false;
+      }
+      edges[t] = edge;
+      tail.store(next, std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * @brief Take the edge at the front of the queue
+     *
+     * @return false  The queue is empty
+     */
+    EQ_INLINE bool get(halEdge_t &edge) {
+      uint8_t h = head.load(std::memory_order_relaxed);
+      if (h == tail.load(std::memory_order_acquire)) {
+        return false;
+      }
+      edge = edges[h];
+      head.store((h + 1) % EQ_LEN, std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * @brief Empty the queue. Only while nothing is putting.
+     */
+    EQ_INLINE void clear() {
+      head.store(tail.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+  private:
+    halEdge_t edges[EQ_LEN];
+    std::atomic<uint8_t> head {0};                // The oldest edge (get() changes it)
+    std::atomic<uint8_t> tail {0};                // Where the next goes (put() changes it)
+};
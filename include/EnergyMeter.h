@@ -0,0 +1,88 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * EnergyMeter.h
+ *
+ * Energy accounting. The firmware tells the meter whenever it changes what it's doing, and the
+ * meter adds up how long it spent doing each thing. Multiplying those times by what the board
+ * draws doing each of them (emCurrentMa in EnergyMeter.cpp) gives an estimate of the charge
+ * used. The totals live in RTC memory, so they keep accumulating across deep sleep, and are
+ * only reset by a power-on (e.g., a fresh battery).
+ *
+ * Just before going into deep sleep, a line summarizing the session that's ending is appended
+ * to EM_LOG on the SD card. (A session's deep_sleep_s is the sleep it woke up from.) tools/battery_life.py reads these logs and projects how long a
+ * battery will last on a given shooting schedule.
+ *
+ * The LED is different from the other states: it's on or off while the camera is doing
+ * other things, so its on-time is counted separately and its current is added on top.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include "Arduino.h"
+#include "FS.h"
+
+#define EM_LOG            "/energy.csv"             // The energy log on the SD card
+
+// What the camera can be doing. Keep emStateNames and emCurrentMa in EnergyMeter.cpp in step.
+enum emState_t : uint8_t {
+  EM_BOOT,                                        // From reset until ready to take pictures
+  EM_IDLE,                                        // Awake, waiting for the shutter
+  EM_DOZE,                                        // In light sleep, waiting for the shutter
+  EM_CAPTURE,                                     // Getting a frame from the camera
+  EM_SD_WRITE,                                    // Saving an image
+  EM_DEEP_SLEEP,                                  // In deep sleep
+  EM_N_STATES                                     // Number of states; not a state
+};
+
+class EnergyMeter {
+  public:
+    /**
+     * @brief Start metering. Call first thing in setup(). Picks up the totals from before a
+     * deep sleep and charges the time spent asleep; after a power-on, starts from zero.
+     */
+    void begin();
+
+    /**
+     * @brief Note that the camera is now doing the given thing
+     */
+    void enter(emState_t state);
+
+    /**
+     * @brief Note that the LED was on for the given number of millis(). Safe from any task.
+     */
+    void ledOn(uint32_t ms);
+
+    /**
+     * @brief Note that an image was saved
+     */
+    void shot();
+
+    /**
+     * @brief Estimated charge used since the last power-on, in mAh
+     */
+    float totalMah() const;
+
+    /**
+     * @brief Wrap up the session for deep sleep: append it to EM_LOG and start timing the 
+     * sleep. Call right before going to sleep.
+     *
+     * @param fs      The file system the log is on
+     * @return true   Success
+     * @return false  Couldn't write the log; the totals are still kept
+     */
+    bool sleep(fs::FS &fs);
+
+  private:
+    float mah(const uint64_t *stateUs, uint64_t ledUs) const;
+
+    emState_t state = EM_BOOT;                    // What we're doing now
+    int64_t stateStartUs = 0;                     // esp_timer_get_time() when we started doing it
+    uint64_t sessionStartUs[EM_N_STATES];         // Totals at the start of this session
+    uint64_t sessionStartLedUs = 0;               // LED total at the start of this session
+    uint32_t sessionStartShots = 0;               // Shot count at the start of this session
+};
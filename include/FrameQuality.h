@@ -0,0 +1,64 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * FrameQuality.h
+ *
+ * Tells at a glance whether a picture is worth keeping. There's no viewfinder, so now and then
+ * a picture gets taken with the cap on, in a blur or blown out, and each one costs a write to
+ * the card and an image number. fqJudge() looks at what JpegMeter found in the picture and
+ * nothing else, so it costs next to nothing on top of metering. In order, a picture is:
+ *
+ *    Verdict           When
+ *    ================  ===========================================================
+ *    blank             FQ_BLANK_PERCENT or more of it is black (the cap is on), or
+ *                      it's all one level with next to no detail
+ *    blown out         FQ_CLIPPED_PERCENT or more of it is blown out
+ *    blurred           It has enough detail to tell, and less than minFine per mille
+ *                      of it is fine detail across or less is fine detail down (see
+ *                      JpegMeter.h)
+ *    good              Otherwise
+ *
+ * Sharpness only makes sense for the stock lens. A pinhole's own blur is much bigger than
+ * shake's, so behind one there's no fine detail to lose, and minFine should be 0, which means
+ * not to judge. The thresholds were picked from a photo, blurred, shaken, darkened and
+ * brightened on a computer, so they're a start, not the last word. A blur of a pixel or so
+ * passes, and so does shake straight up and down, since scenes tend to have more fine detail
+ * that way to begin with (horizons, water, buildings). So does a dim scene that's merely dark.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include "JpegMeter.h"
+
+#define FQ_BLANK_PERCENT  (95)                      // This much black is a blank picture
+#define FQ_FLAT_SPREAD    (8)                       // 5th to 95th percentile levels this close are all one level
+#define FQ_CLIPPED_PERCENT (50)                     // This much blown out is a blown out picture
+#define FQ_MIN_DETAIL     (8)                       // Detail per block it takes to judge sharpness (or not be blank)
+#define FQ_MIN_FINE       (22)                      // Per mille of fine detail each way a sharp picture from the lens has
+
+// What a picture looks like
+enum fqVerdict_t : uint8_t {
+  FQ_GOOD,                                        // Worth keeping
+  FQ_BLANK,                                       // Black or featureless
+  FQ_CLIPPED,                                     // Blown out
+  FQ_BLURRED                                      // Out of focus or shaken
+};
+
+/**
+ * @brief Judge a picture by what metering it found
+ *
+ * @param stats   What JpegMeter::meter() found
+ * @param minFine The least fine detail, per mille of all the detail, a sharp picture has; 0
+ *                not to judge sharpness
+ * @return fqVerdict_t What it looks like
+ */
+fqVerdict_t fqJudge(const jmStats_t &stats, uint16_t minFine);
+
+/**
+ * @brief What to call the given verdict in a message, e.g., "blown out"
+ */
+const char *fqName(fqVerdict_t verdict);
@@ -0,0 +1,361 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * Hal.h
+ *
+ * A thin hardware abstraction layer: just the handful of things the capture and save logic in
+ * PinholeCamera needs from the world, as abstract classes. HalEsp32.h has the implementations
+ * that run on the camera. The implementations in src/host run on Linux, which lets the capture
+ * and save logic be built and exercised (pio run -e native) without a camera anywhere near.
+ *
+ * Nothing in here or in anything built on it may include Arduino or ESP-IDF headers.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#define STALE_MAX_FRAMES  (4)                       // Max frames to throw away waiting for a fresh one
+#define BUTTON_DEBOUNCE_US (25000)                  // A level that lasts less than this is a bounce
+#define BUTTON_DOUBLE_US  (400000)                  // Max from a click's release to the next press for a double-click
+#define BUTTON_LONG_US    (1000000)                 // Pressed at least this long is a long press
+#define BUTTON_HOLD_US    (3000000)                 // Still down after this long is a hold
+#define HAL_MIN_WINDOW    (25)                      // Smallest window, in percent of the picture across and down
+#define HAL_MAX_GAIN      (30)                      // Highest gain the camera driver's table has (31x)
+
+/**
+ * @brief Print a message the way the platform does it (Serial on the camera, stdout on Linux)
+ */
+void halLog(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+// Time
+class HalClock {
+  public:
+    virtual ~HalClock() {}
+
+    /**
+     * @brief Milliseconds since some arbitrary starting point; wraps like Arduino millis()
+     */
+    virtual uint32_t millis() = 0;
+
+    /**
+     * @brief Microseconds since the same starting point; doesn't wrap
+     */
+    virtual int64_t micros() = 0;
+
+    /**
+     * @brief Wait for the given number of milliseconds
+     */
+    virtual void delay(uint32_t ms) = 0;
+
+    /**
+     * @brief Wait for the given number of microseconds
+     */
+    virtual void delayMicros(uint32_t us) = 0;
+};
+
+// A one-shot timer that calls its handler in the background (esp_timer's task on the camera)
+class HalTimer {
+  public:
+    virtual ~HalTimer() {}
+
+    /**
+     * @brief Get going; handler(arg) is called each time the timer goes off
+     */
+    virtual void begin(void (*handler)(void *arg), void *arg) = 0;
+
+    /**
+     * @brief Have the timer go off once, us microseconds from now
+     */
+    virtual void start(uint32_t us) = 0;
+};
+
+// The little red LED
+class HalLed {
+  public:
+    virtual ~HalLed() {}
+
+    /**
+     * @brief Turn the LED on or off
+     */
+    virtual void set(bool on) = 0;
+};
+
+// A change in the shutter switch's level, bounces and all
+struct halEdge_t {
+  int64_t atUs;                                   // HalClock::micros() when it happened
+  bool down;                                      // Whether the switch went down (or up)
+};
+
+// What someone did with the shutter switch
+enum halGesture_t : uint8_t {
+  HAL_CLICK,                                      // Pressed and released
+  HAL_DOUBLE_CLICK,                               // Clicked again right after a click
+  HAL_LONG_PRESS,                                 // Pressed for BUTTON_LONG_US or more and released
+  HAL_HOLD                                        // Still down after BUTTON_HOLD_US; nothing more when released
+};
+
+// A gesture and when it happened
+struct halButtonEvent_t {
+  halGesture_t gesture;
+  int64_t downUs;                                 // HalClock::micros() when the switch went down
+  int64_t upUs;                                   // When it came back up; 0 for HAL_HOLD
+};
+
+// The shutter switch
+class HalButton {
+  public:
+    virtual ~HalButton() {}
+
+    /**
+     * @brief Get the button going. A press already under way when this is called isn't 
+     * reported.
+     */
+    virtual void begin() = 0;
+
+    /**
+     * @brief Get the next thing someone did with the button, if they've done anything. The
+     * edges the platform has queued are debounced and turned into gestures. A click is 
+     * reported as soon as the switch comes up, with no waiting to see if it's the first half
+     * of a double-click; the second half of one is reported as HAL_DOUBLE_CLICK instead of as
+     * a second HAL_CLICK.
+     *
+     * @param clock   The clock the edges were timed with
+     * @param event   Filled in with the gesture
+     * @return true   There was one
+     * @return false  Nothing new has happened
+     */
+    bool event(HalClock &clock, halButtonEvent_t &event);
+
+    /**
+     * @brief Whether the button is being held down right now
+     */
+    virtual bool isDown() = 0;
+
+  protected:
+    /**
+     * @brief Get the oldest edge from the platform's queue of them, in the order they happened
+     *
+     * @return false  The queue is empty
+     */
+    virtual bool nextEdge(halEdge_t &edge) = 0;
+
+    /**
+     * @brief Start decoding afresh with the switch down or up; for begin()
+     */
+    void startDecoding(bool down);
+
+  private:
+    bool gesture(bool down, int64_t atUs, halButtonEvent_t &event); // The switch settled down or up at atUs
+
+    halEdge_t held;                               // An edge taken from the queue but not yet used
+    bool haveHeld = false;                        // Whether held is one
+    bool rawDown = false;                         // The level as of the latest edge
+    int64_t rawUs = 0;                            // When it changed to that
+    bool stableDown = false;                      // The debounced level
+    int64_t changeUs = 0;                         // When the level first left stableDown
+    int64_t downUs = 0;                           // When the current press started; 0 if none
+    int64_t clickUpUs = 0;                        // When the last click ended, for double-clicks
+    bool holdSent = false;                        // Whether the current press has been reported as a hold
+};
+
+// A frame from the camera
+struct halFrame_t {
+  const uint8_t *buf;                             // The JPEG image
+  size_t len;                                     // Its length in bytes
+  uint16_t width;                                 // Its width in pixels
+  uint16_t height;                                // Its height in pixels
+  int64_t timestampUs;                            // HalClock::micros() when the frame was captured
+  void *handle;                                   // The camera implementation's own reference
+};
+
+// The camera
+class HalCamera {
+  public:
+    virtual ~HalCamera() {}
+
+    /**
+     * @brief Get a frame captured entirely after the given time. Frames that are older than
+     * that (stale) are thrown away.
+     *
+     * @param frame       Filled in with the frame
+     * @param sinceMicros HalClock::micros() before which frames are stale; 0 means any will do
+     * @return true       Got one. Give it back with release() when done with it.
+     * @return false      The camera didn't deliver
+     */
+    bool get(halFrame_t &frame, int64_t sinceMicros = 0);
+
+    /**
+     * @brief Get whatever frame the camera driver hands over next, however old it is (this is
+     * esp_camera_fb_get()).
+     *
+     * @return true       Got one. Give it back with release() when done with it.
+     * @return false      The camera didn't deliver
+     */
+    virtual bool grab(halFrame_t &frame) = 0;
+
+    /**
+     * @brief Give a frame from get() back to the camera
+     */
+    virtual void release(halFrame_t &frame) = 0;
+
+    /**
+     * @brief Stop the camera and start it again from scratch (esp_camera_deinit() and 
+     * esp_camera_init()). Every frame from get() has to have been given back first.
+     *
+     * @return false  It didn't start
+     */
+    virtual bool restart() = 0;
+};
+
+// An exposure set by hand rather than by the sensor's own automatic exposure and gain control
+struct halExposure_t {
+  uint16_t lines;                                 // How long, in row times (the OV2640's aec_value)
+  uint8_t gain;                                   // Analog gain, 0 (none) to HAL_MAX_GAIN; see halGainOf()
+  uint8_t clockDiv;                               // Slow the sensor's clock (and frame rate) this many times
+};
+
+/**
+ * @brief How many times a halExposure_t's gain multiplies the signal. The camera driver's
+ * set_agc_gain() looks the gain up in a table of OV2640 GAIN register values (0x00, 0x10, 0x18,
+ * 0x30, ...), which work out to 1x, 2x, 3x and so on: one more times for each step, to 31x.
+ */
+float halGainOf(uint8_t gain);
+
+// Frame sizes, in the same order as the camera driver's framesize_t, which has more
+enum halFramesize_t : uint8_t {
+  HAL_FRAMESIZE_QVGA,                             // 320x240
+  HAL_FRAMESIZE_CIF,                              // 400x296
+  HAL_FRAMESIZE_VGA,                              // 640x480
+  HAL_FRAMESIZE_SVGA,                             // 800x600
+  HAL_FRAMESIZE_XGA,                              // 1024x768
+  HAL_FRAMESIZE_SXGA,                             // 1280x1024
+  HAL_FRAMESIZE_UXGA                              // 1600x1200
+};
+
+// The middle of the picture, as the sensor's DSP crops it out of the readout mode's pixels and
+// scales it to the frame's (see HalSensor::setWindow())
+struct halWindow_t {
+  uint16_t x;                                     // Where it starts, in the mode's pixels
+  uint16_t y;
+  uint16_t columns;                               // How big it is, in the mode's pixels
+  uint16_t rows;
+  uint16_t width;                                 // The size of the frames it makes
+  uint16_t height;
+};
+
+/**
+ * @brief Work out the window for the middle percent of the picture, across and down, at the
+ * given frame size. The frames come out a whole number of the OV2640's JPEG MCUs (16x8) so
+ * they have no padding, which makes them a little smaller than percent; the DSP's registers
+ * count in fours, and the window is scaled the way the frame size is.
+ *
+ * @return false  percent is less than HAL_MIN_WINDOW or more than 100, or size isn't one
+ */
+bool halWindow(halFramesize_t size, uint8_t percent, halWindow_t &window);
+
+// The camera sensor's exposure controls
+class HalSensor {
+  public:
+    virtual ~HalSensor() {}
+
+    /**
+     * @brief Take the exposure away from the sensor's automatic control and set it as given.
+     * It may take effect a frame or so later; see HalCamera::get().
+     */
+    virtual bool setExposure(const halExposure_t &exposure) = 0;
+
+    /**
+     * @brief Hand the exposure back to the sensor's automatic control, at its own frame rate
+     */
+    virtual bool setAutomatic() = 0;
+
+    /**
+     * @brief The average brightness of the latest frame, 0 to 255, as the sensor measured it
+     * (no decoding involved)
+     */
+    virtual bool meter(uint8_t &level) = 0;
+
+    /**
+     * @brief Change the size of the frames the sensor sends, no bigger than the size the camera
+     * started with, since that's what the frame buffers hold. The OV2640 makes CIF and smaller
+     * and SVGA and smaller from readout modes with a half or a quarter of the rows, so they
+     * come that many times as often. Frames already on the way are the old size; see
+     * HalCamera::get(). Every frame from get() has to have been given back first.
+     */
+    virtual bool setFrameSize(halFramesize_t size) = 0;
+
+    /**
+     * @brief Send only the middle percent of the picture across and down (see halWindow()),
+     * now and at every frame size from now on; 100 for all of it. The window is cut out of the
+     * sensor's pixels before they're scaled and compressed, so frames are smaller, take less
+     * time to meter and save, and still have the frame size's resolution. They don't come any
+     * sooner: the sensor still reads out all its rows. Every frame from get() has to have been
+     * given back first.
+     */
+    virtual bool setWindow(uint8_t percent) = 0;
+};
+
+// Where the images go
+class HalStorage {
+  public:
+    virtual ~HalStorage() {}
+
+    /**
+     * @brief Create (or truncate) a file for writing
+     *
+     * @param path    The file's path, e.g. "/Image1.jpg"
+     * @return int    A handle for write() and close(), or -1 if it couldn't be created
+     */
+    virtual int open(const char *path) = 0;
+
+    /**
+     * @brief Write to a file from open()
+     *
+     * @return size_t The number of bytes written; fewer than len means something went wrong
+     */
+    virtual size_t write(int handle, const uint8_t *buf, size_t len) = 0;
+
+    /**
+     * @brief Close a file from open(). Only once this returns true is the file sure to be there.
+     */
+    virtual bool close(int handle) = 0;
+
+    /**
+     * @brief Whether the file at path exists
+     */
+    virtual bool exists(const char *path) = 0;
+
+    /**
+     * @brief Unmount the card and mount it again. Files that were open are gone.
+     *
+     * @return false  It didn't mount
+     */
+    virtual bool remount() = 0;
+};
+
+// The persistent image counter
+class HalCounter {
+  public:
+    virtual ~HalCounter() {}
+
+    /**
+     * @brief The counter's value
+     */
+    virtual uint16_t read() = 0;
+
+    /**
+     * @brief Set the counter's value; not persistent until commit()
+     */
+    virtual void write(uint16_t value) = 0;
+
+    /**
+     * @brief Make the value from write() persistent
+     */
+    virtual bool commit() = 0;
+};
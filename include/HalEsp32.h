@@ -0,0 +1,170 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * HalEsp32.h
+ *
+ * The ESP32 CAM implementations of the hardware abstraction layer in Hal.h: millis() and 
+ * friends for the clock, esp_timer for the timer, a GPIO for the LED, a GPIO interrupt for the shutter, esp_camera for the 
+ * camera, the file system SD_MMC mounts for storage and "EEPROM" for the image counter.
+ *
+ * Storage uses the POSIX open(), write() and close() on the mounted card rather than 
+ * SD_MMC's File. A File allocates on the heap every time one is opened; the ESP-IDF FAT 
+ * file system sets aside what it needs for open files when the card is mounted. Saving a 
+ * picture doesn't touch the heap at all, so long time-lapse runs can't fragment it.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include "Arduino.h"
+#include "esp_timer.h"                            // esp_timer
+#include "esp_camera.h"                           // camera_config_t
+#include "Hal.h"
+#include "EdgeQueue.h"
+#include "EnergyMeter.h"
+
+#define HAL_MAX_FILES     (2)                       // Max files open at once
+#define HAL_PATH_LEN      (40)                      // Longest full path, mount point and all
+
+class Esp32Clock : public HalClock {
+  public:
+    uint32_t millis() override;
+    int64_t micros() override;
+    void delay(uint32_t ms) override;
+    void delayMicros(uint32_t us) override;
+};
+
+class Esp32Timer : public HalTimer {
+  public:
+    /**
+     * @brief A timer named name (for esp_timer_dump()); the handler runs in esp_timer's task
+     */
+    Esp32Timer(const char *name);
+    void begin(void (*handler)(void *arg), void *arg) override;
+    void start(uint32_t us) override;
+
+  private:
+    const char *name;
+    esp_timer_handle_t timer = nullptr;
+};
+
+class Esp32Led : public HalLed {
+  public:
+    /**
+     * @brief An active-low LED on the given GPIO. If there's a meter, its on-time is charged
+     * to it.
+     */
+    Esp32Led(gpio_num_t pin, EnergyMeter *meter = nullptr);
+    void begin();
+    void set(bool on) override;
+
+  private:
+    gpio_num_t pin;
+    EnergyMeter *meter;
+    unsigned long onMillis = 0;                   // When the LED was turned on
+    bool isOn = false;
+};
+
+class Esp32Button : public HalButton {
+  public:
+    /**
+     * @brief An active-low button on the given GPIO. Its edges are timed and queued by an
+     * interrupt handler, so none are missed however busy loop() is.
+     */
+    Esp32Button(gpio_num_t pin);
+    void begin() override;
+    bool isDown() override;
+
+    /**
+     * @brief Get the interrupt going again after light sleep, which takes it over to wake us.
+     * If the button went down while we slept, that's when it went down.
+     */
+    void resume(int64_t wokeMicros);
+
+  protected:
+    bool nextEdge(halEdge_t &edge) override;
+
+  private:
+    static void isr(void *self);                  // The GPIO interrupt handler
+
+    gpio_num_t pin;
+    EdgeQueue edges;
+    volatile bool lastDown = false;               // The level of the last edge queued
+};
+
+class Esp32Camera : public HalCamera, public HalSensor {
+  public:
+    /**
+     * @brief The camera esp_camera_init() starts with the given config, which restart() uses
+     * again
+     */
+    Esp32Camera(const camera_config_t &config);
+    bool grab(halFrame_t &frame) override;
+    void release(halFrame_t &frame) override;
+    bool restart() override;
+    bool setExposure(const halExposure_t &exposure) override;
+    bool setAutomatic() override;
+    bool meter(uint8_t &level) override;
+    bool setFrameSize(halFramesize_t size) override;
+    bool setWindow(uint8_t percent) override;
+
+    /**
+     * @brief Set the sensor's exposure bias (-2 to 2) and whether its lens correction is on,
+     * now and after every restart()
+     */
+    bool setProfile(int8_t aeLevel, bool lenc);
+
+  private:
+    bool applyProfile();                          // Tell the sensor what setProfile() said
+    bool applyExposure();                         // Tell it what setExposure() said
+    bool applyWindow();                           // Set the frame size and window up on the sensor
+
+    const camera_config_t &config;
+    int8_t aeLevel = 0;
+    bool lenc = true;
+    bool manual = false;                          // Whether the exposure is set by hand
+    halExposure_t exposure;                       // If so, what it is
+    int clockBits = -1;                           // The driver's CLKRC divider before that; -1 if unknown
+    framesize_t frameSize;                        // What setFrameSize() said, or the config's
+    uint8_t windowPercent = 100;                  // What setWindow() said
+    halWindow_t window;                           // The window that makes at frameSize
+};
+
+class Esp32Storage : public HalStorage {
+  public:
+    /**
+     * @brief Storage on the file system SD_MMC mounted at the given mount point, e.g., 
+     * "/sdcard", in one-bit mode or not; remount() mounts it the same way
+     */
+    Esp32Storage(const char *mountPoint, bool oneBit);
+    int open(const char *path) override;
+    size_t write(int handle, const uint8_t *buf, size_t len) override;
+    bool close(int handle) override;
+    bool exists(const char *path) override;
+    bool remount() override;
+
+  private:
+    const char *fullPath(const char *path);       // The path with the mount point in front
+
+    const char *mountPoint;
+    bool oneBit;
+    char full[HAL_PATH_LEN];                      // The last fullPath()
+    int fds[HAL_MAX_FILES] = {-1, -1};
+};
+
+class Esp32Counter : public HalCounter {
+  public:
+    /**
+     * @brief A counter at the given address in "EEPROM", which must already be begun
+     */
+    Esp32Counter(int addr);
+    uint16_t read() override;
+    void write(uint16_t value) override;
+    bool commit() override;
+
+  private:
+    int addr;
+};
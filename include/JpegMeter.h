@@ -0,0 +1,164 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * JpegMeter.h
+ *
+ * Meters a picture straight from the JPEG the sensor made, without decoding it. Each 8x8
+ * block of a JPEG carries its average brightness as its DC coefficient, so a histogram of the
+ * blocks' DC coefficients is a histogram of the picture at an eighth of its size, which is
+ * plenty to see whether it's too dark, blown out or blank. Getting at the DC coefficients
+ * still means reading the Huffman codes for all the coefficients, since that's the only way to
+ * know where one block ends and the next starts. But nothing is dequantized (except the DC
+ * coefficient) or transformed back into pixels, which is most of the work of decoding.
+ * Since each block counts as its average, detail finer than a block averages out: a block
+ * that's half black and half blown out meters as middle gray.
+ *
+ * The AC coefficients, which have to be read anyway, say how much detail there is. Their
+ * dequantized sizes are added up as detail, and those of the ones with a horizontal frequency
+ * of JM_FINE_FROM or more (a cycle every five pixels or less) as fine detail across, likewise
+ * vertically as fine detail down. Defocus and shake wipe out fine detail first, shake only in
+ * the direction it moves, so the shares of it say how sharp the picture is. See FrameQuality.h.
+ *
+ * Metering takes time in proportion to the size of the JPEG. setLimit() bounds it: once it's
+ * been at it that long, it gives up, leaving the picture unmetered.
+ *
+ * It reads baseline and extended sequential Huffman JPEGs (what the OV2640 makes, and nearly
+ * everything else), interleaved or not, with or without restart markers. Only the first
+ * component, the luminance, is metered; chroma is read past. Blocks in the padding at the
+ * right and bottom edges, if the picture isn't a whole number of MCUs, count like any other.
+ *
+ * The tables live in the JpegMeter, about 6 KB, so metering doesn't touch the heap or use
+ * much stack. One JpegMeter meters one picture at a time.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "Hal.h"
+
+#define JM_BINS           (64)                      // Histogram bins, four levels each
+#define JM_DARK           (16)                      // A block this dark or darker is black
+#define JM_CLIPPED        (240)                     // A block this bright or brighter is blown out
+#define JM_LOOKAHEAD      (9)                       // Bits of Huffman code decoded by table lookup
+#define JM_FINE_FROM      (3)                       // AC coefficients of this frequency (of 7) or more are fine detail
+
+// What metering a picture found
+struct jmStats_t {
+  uint16_t width;                                 // The picture's size in pixels
+  uint16_t height;
+  uint32_t blocks;                                // Luminance blocks metered
+  uint32_t histogram[JM_BINS];                    // Blocks by average brightness, darkest first
+  uint8_t mean;                                   // Average brightness, 0 - 255
+  uint32_t dark;                                  // Blocks JM_DARK or darker
+  uint32_t clipped;                               // Blocks JM_CLIPPED or brighter
+  uint64_t detail;                                // Sum of the luminance AC coefficients' sizes, dequantized
+  uint64_t fineAcross;                            // The part of it from horizontal frequencies JM_FINE_FROM and up
+  uint64_t fineDown;                              // The part of it from vertical frequencies JM_FINE_FROM and up
+};
+
+/**
+ * @brief Gets each block's coefficients, for whatever wants more than the meter. Blocks come
+ * in the order they're in the JPEG.
+ *
+ * @param context   The context given to meter()
+ * @param coef      The block's coefficients, quantized, in natural (not zigzag) order
+ * @param component Which component the block is of; 0 is the luminance
+ * @param blockX    Where the block is, in the component's blocks from the left
+ * @param blockY    Where the block is, in the component's blocks from the top
+ */
+typedef void (*jmBlockHandler_t)(void *context, const int16_t *coef, uint8_t component, uint16_t blockX,
+  uint16_t blockY);
+
+class JpegMeter {
+  public:
+    /**
+     * @brief Meter the given JPEG
+     *
+     * @param jpeg    The JPEG, SOI and all
+     * @param len     Its length in bytes
+     * @param stats   Filled in with what metering found
+     * @param handler If not nullptr, given every block's coefficients as well
+     * @param context Handed to handler
+     * @return false  It isn't a kind of JPEG this reads, it's damaged, or metering it ran out
+     *                of time (see timedOut())
+     */
+    bool meter(const uint8_t *jpeg, size_t len, jmStats_t &stats, jmBlockHandler_t handler = nullptr,
+      void *context = nullptr);
+
+    /**
+     * @brief Give up on metering a picture once it's taken the given number of micros, as
+     * told by clock; nullptr for no limit
+     */
+    void setLimit(HalClock *clock, uint32_t micros);
+
+    /**
+     * @brief Whether the last meter() gave up because it ran out of time
+     */
+    bool timedOut() const;
+
+    /**
+     * @brief The level at or below which the given percentage of the blocks are, to the
+     * histogram's resolution
+     */
+    static uint8_t percentile(const jmStats_t &stats, uint8_t percent);
+
+    /**
+     * @brief The luminance quantization table of the JPEG last metered, in natural order
+     */
+    const uint16_t *lumaQuant() const;
+
+  private:
+    friend class JpegStacker;                     // Which writes JPEGs the way this reads them
+
+    // A Huffman table, set up for decoding
+    struct huffTable_t {
+      uint8_t counts[16];                         // Codes of each length, as in the JPEG
+      uint8_t lookLen[1 << JM_LOOKAHEAD];         // Length of the code starting with these bits; 0 if longer
+      uint8_t lookVal[1 << JM_LOOKAHEAD];         // Its value
+      int32_t maxCode[18];                        // Biggest code of each length; -1 if none
+      int32_t valOffset[17];                      // Where each length's values are, less its first code
+      uint8_t vals[256];
+    };
+
+    // A component of the picture
+    struct component_t {
+      uint8_t id;
+      uint8_t h;                                  // Horizontal sampling factor
+      uint8_t v;                                  // Vertical sampling factor
+      uint8_t quant;                              // Which quantization table
+      uint8_t dcTable;                            // Which Huffman tables, from the scan
+      uint8_t acTable;
+      int16_t pred;                               // The last DC coefficient
+    };
+
+    bool readHeaders(const uint8_t *jpeg, size_t len, jmStats_t &stats); // Up to the scan
+    bool buildTable(const uint8_t *counts, const uint8_t *vals, int nVals, huffTable_t &table);
+    bool scan(jmStats_t &stats, jmBlockHandler_t handler, void *context); // The entropy-coded data
+    uint32_t mcuCount(const jmStats_t &stats, uint32_t &mcusX) const; // MCUs in the scan, and across it
+    bool restart();                               // Get past a restart marker
+    void fill();                                  // Top up the bit buffer
+    int decode(const huffTable_t &table);         // The next Huffman-coded value; -1 if none
+    int receive(uint8_t n);                       // The next n bits as a signed coefficient
+
+    huffTable_t dcTables[2];
+    huffTable_t acTables[2];
+    uint16_t quant[4][64];                        // Quantization tables, natural order
+    component_t components[3];
+    uint8_t nComponents = 0;
+    uint8_t scanComponents[3];                    // Indices of the components in the scan
+    uint8_t nScanComponents = 0;
+    uint16_t restartInterval = 0;                 // MCUs between restart markers; 0 for none
+    const uint8_t *pos = nullptr;                 // Where the next byte of scan data is
+    const uint8_t *end = nullptr;
+    uint32_t bits = 0;                            // Bits not yet used, first one at the top
+    int8_t nBits = 0;                             // How many
+    bool atMarker = false;                        // Whether pos is at a marker, past the scan data
+    HalClock *clock = nullptr;                    // What times metering, if it's limited
+    uint32_t limitUs = 0;                         // How long it may take
+    bool outOfTime = false;                       // Whether the last meter() ran out of time
+};
@@ -0,0 +1,122 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * JpegStacker.h
+ *
+ * Averages several JPEGs of the same scene into one, for dim scenes, where each frame is noisy
+ * but the noise differs from frame to frame while the scene doesn't. Averaging N frames cuts
+ * the noise by the square root of N.
+ *
+ * There's neither the memory nor the time on the camera to decode the frames into pixels,
+ * add them up and encode the result. But the DCT is linear, so the average of the frames'
+ * coefficients is the coefficients of the average of the frames, give or take the rounding
+ * that quantization already does. So the stacker reads each frame's quantized coefficients
+ * (with JpegMeter), adds them up block by block, and finish() divides by the number of frames
+ * and Huffman-codes the result with the frames' own tables, behind their own headers. Nothing
+ * is dequantized or transformed.
+ *
+ * The frames must be the same kind of picture: the same headers byte for byte (same size,
+ * quality and tables), all in a single scan, as the OV2640's are. The sums are 16 bits, so
+ * JS_MAX_FRAMES is as many as can be stacked. The caller provides the memory: 128 bytes a
+ * block for the sums (see blocksFor()) and a buffer for the JPEG finish() makes, which is
+ * seldom bigger than one of the frames, since averaging smooths out the noise that takes the
+ * most bits to code. Stacking doesn't touch the heap otherwise.
+ *
+ * Stacking doesn't line the frames up, so the camera mustn't move between them.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include "JpegMeter.h"
+
+#define JS_MAX_FRAMES     (8)                       // Most frames that can be stacked
+
+class JpegStacker {
+  public:
+    /**
+     * @brief Use the given memory for stacking
+     *
+     * @param sums      Room for the sums, 64 coefficients a block
+     * @param maxBlocks How many blocks there's room for
+     * @param out       Where finish() puts the stacked JPEG
+     * @param outSize   How big it is in bytes
+     */
+    void setBuffers(int16_t *sums, uint32_t maxBlocks, uint8_t *out, size_t outSize);
+
+    /**
+     * @brief Forget the frames added so far and start a new stack
+     */
+    void reset();
+
+    /**
+     * @brief Add a frame to the stack. The frame isn't needed once this returns.
+     *
+     * @param jpeg    The frame's JPEG
+     * @param len     Its length in bytes
+     * @return false  It can't be stacked: it isn't the same kind of picture as the first one,
+     *                it's damaged, it's too big for the buffers, or the stack is full. The
+     *                stack is no good after that until reset().
+     */
+    bool add(const uint8_t *jpeg, size_t len);
+
+    /**
+     * @brief How many frames are in the stack
+     */
+    uint8_t frames() const;
+
+    /**
+     * @brief Average the frames in the stack into one JPEG. The stack is used up doing it.
+     *
+     * @param len     Set to the length of the JPEG
+     * @return false  There's nothing to average, a frame couldn't be stacked, the frames'
+     *                Huffman tables have no code for something the average needs, or the JPEG
+     *                doesn't fit in the buffer
+     */
+    bool finish(size_t &len);
+
+    /**
+     * @brief The stacked JPEG, once finish() has made it
+     */
+    const uint8_t *jpeg() const;
+
+    /**
+     * @brief The number of blocks a picture of the given size has, sampled as the OV2640
+     * does (4:2:2); size the sums for this
+     */
+    static uint32_t blocksFor(uint16_t width, uint16_t height);
+
+  private:
+    // A Huffman table, set up for coding
+    struct codeTable_t {
+      uint16_t code[256];                         // Each value's code
+      uint8_t size[256];                          // And its length; 0 if it hasn't one
+    };
+
+    static void addBlock(void *context, const int16_t *coef, uint8_t component, uint16_t blockX,
+      uint16_t blockY);                           // The meter's handler
+    void buildCodes(const JpegMeter::huffTable_t &table, codeTable_t &codes);
+    bool encodeBlock(const int16_t *coef, int16_t &pred, const codeTable_t &dc, const codeTable_t &ac);
+    bool put(uint32_t value, uint8_t n);          // Write n bits
+    bool flush();                                 // Pad out to a whole byte with 1s
+    bool putByte(uint8_t byte);
+
+    JpegMeter reader;
+    codeTable_t dcCodes[2];
+    codeTable_t acCodes[2];
+    int16_t *sums = nullptr;
+    uint32_t maxBlocks = 0;
+    uint8_t *out = nullptr;
+    size_t outSize = 0;
+    size_t headerLen = 0;                         // Bytes of the first frame up to its scan data, copied to out
+    uint32_t blocks = 0;                          // Blocks in each frame
+    uint32_t at = 0;                              // Which block the frame being added is at
+    uint8_t nFrames = 0;
+    bool broken = false;                          // Whether a frame couldn't be stacked
+    size_t outLen = 0;                            // How much of out is written
+    uint32_t bits = 0;                            // Bits not yet written, last one at the bottom
+    uint8_t nBits = 0;                            // How many
+};
@@ -0,0 +1,90 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * LedPatterns.h
+ *
+ * Plays the little red LED's flash patterns (one flash for a saved picture, five for hello
+ * and goodbye, and so on) in the background, so saying how things went never holds up taking
+ * the next picture. The patterns are in a table in LedPatterns.cpp; each is a list of how
+ * long the LED is on, then off, then on, and so on. play() puts a pattern in a short queue
+ * and returns at once. A one-shot HalTimer steps through the patterns in the queue in turn.
+ *
+ * play() and the timer's handler may run at the same time in different tasks. They share
+ * nothing but the queue's indices and whether a pattern is playing, all atomic: play() only
+ * adds to the queue, the handler only takes from it, and whichever of them finds nothing
+ * playing takes over the playing.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include <atomic>
+#include "Hal.h"
+
+#define LP_FLASH_MILLIS   (200)                     // Length of a flash and of the gap between flashes
+#define LP_FAIL_MILLIS    (1000)                    // A long flash, and the gap between groups of flashes
+#define LP_QUEUE_LEN      (8)                       // Patterns that can be queued, playing one included, plus one
+#define LP_POLL_MILLIS    (10)                      // How often wait() checks whether the show is over
+
+// The patterns
+enum lpPattern_t : uint8_t {
+  LP_SNAP,                                        // Picture saved: one flash
+  LP_LOW,                                         // Picture saved, card nearly full: two flashes
+  LP_FULL,                                        // Card full, picture not saved: three flashes
+  LP_CAMERA_ERROR,                                // No picture, even after restarting the camera: long flash, short flash
+  LP_CARD_ERROR,                                  // Picture not saved, even after remounting the card: long, short, short
+  LP_REJECTED,                                    // Picture no good, so not saved: short flash, long flash
+  LP_PROFILE,                                     // Profile chosen: one long flash, played once per step along the list
+  LP_WAVE,                                        // Hello and goodbye: five flashes
+  LP_CAMERA_FAIL,                                 // Camera init failed: two flashes and a pause
+  LP_MOUNT_FAIL,                                  // SD card mount failed: three flashes and a pause
+  LP_NO_CARD,                                     // No SD card: four flashes and a pause
+  LP_BENCH_FAIL,                                  // SD card benchmark failed: six flashes and a pause
+  LP_PATTERN_COUNT                                // Not a pattern; the number of them
+};
+
+class LedPatterns {
+  public:
+    /**
+     * @brief Patterns on the given LED, timed by the given timer
+     */
+    LedPatterns(HalLed &led, HalTimer &timer);
+
+    /**
+     * @brief Get going. Call once, before play().
+     */
+    void begin();
+
+    /**
+     * @brief Play the given pattern once those ahead of it are done. Returns at once.
+     *
+     * @return true   It's queued (or already playing)
+     * @return false  The queue is full; it won't be played
+     */
+    bool play(lpPattern_t pattern);
+
+    /**
+     * @brief Whether a pattern is playing (or waiting to)
+     */
+    bool busy() const;
+
+    /**
+     * @brief Wait until all the queued patterns have been played
+     */
+    void wait(HalClock &clock);
+
+  private:
+    static void expired(void *self);              // The timer's handler
+    void advance();                               // Start the next step, or stop if there isn't one
+
+    HalLed &led;
+    HalTimer &timer;
+    lpPattern_t queue[LP_QUEUE_LEN];              // Patterns to play, from head up to tail
+    std::atomic<uint8_t> head {0};                // The one playing (advance() changes it)
+    std::atomic<uint8_t> tail {0};                // Where the next one goes (play() changes it)
+    std::atomic<bool> playing {false};            // Whether advance() is in charge
+    uint8_t step = 0;                             // The step of the head pattern that's next
+};
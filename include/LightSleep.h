@@ -0,0 +1,33 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * LightSleep.h
+ *
+ * Dozing between shots. In light sleep the CPUs are stopped and most clocks are gated, but RAM
+ * and all the peripheral state are kept, so when the shutter is pressed we pick up right where
+ * we left off in a millisecond or so instead of rebooting. The catch is that the camera's XCLK
+ * comes from the LEDC, which stops along with everything else, so the sensor stops too and the
+ * frame sitting in the frame buffer when we went to sleep is stale. Throw one away after a
+ * wake before taking the picture.
+ *
+ * (The automatic light sleep the ESP-IDF power management offers isn't compiled into the
+ * Arduino core, so we go to sleep explicitly when there's nothing to do.)
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include "Arduino.h"
+
+/**
+ * @brief Go into light sleep until the shutter is pressed or maxMillis have passed
+ *
+ * @param shutterPin  The shutter GPIO (active low)
+ * @param maxMillis   The longest to sleep
+ * @return true       The shutter woke us
+ * @return false      We woke because the time ran out
+ */
+bool lightSleepUntilShutter(gpio_num_t shutterPin, uint32_t maxMillis);
@@ -0,0 +1,109 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * OpticalProfiles.h
+ *
+ * What the camera knows about the optics in front of the sensor. The pinhole assemblies are
+ * interchangeable (see the Readme), and each one needs the camera set up a little differently
+ * and its pictures labeled differently, so each has a profile: what it's called, its focal
+ * length and pinhole diameter, the exposure bias it wants, whether the sensor's own lens
+ * correction should be on and how much of the picture to keep. "lens" is the stock lens the
+ * board comes with, and the default.
+ *
+ * Everything worked out from a profile is worked out once, in begin(), for every profile: its
+ * f-number, its vignetting map and the EXIF segment that goes in its pictures. Switching
+ * profiles is just picking another set of tables; nothing is worked out when a picture is
+ * taken.
+ *
+ * A pinhole has no lens to even out the light, so the corners of the picture get less of it
+ * than the middle: cos^4 of the angle off the axis, which is 1 / (1 + (r / f)^2)^2 at r from
+ * the center of the sensor. The vignetting map is the gain that undoes that, at OP_RINGS
+ * radii from the center to the corner of the sensor. The camera only ever has the JPEG the
+ * sensor makes, so it can't apply the map itself. Instead, the map goes in each picture's
+ * EXIF MakerNote, for whatever develops the pictures to flatten the field with.
+ *
+ * Close to the sensor, a pinhole's corners get so little light that they're mostly noise, so a
+ * profile can have the sensor send just the middle of the picture (see HalSensor::setWindow()),
+ * which makes for smaller pictures that are quicker to save. The map then goes from the center
+ * to the corner of the picture that's kept:
+ *
+ *    Bytes  What
+ *    =====  ===========================================================
+ *    4      "PHC1"
+ *    1      The sensor's ae_level, -2 to 2
+ *    1      OP_RINGS
+ *    2      The radius of the last ring (center to corner of the picture) in
+ *           micrometers
+ *    2 * n  The gains, 8.8 fixed point, center first
+ *
+ * All multi-byte numbers are little-endian, as is the rest of the EXIF. The stock lens has no
+ * map or f-number (it's unknown), and uses the sensor's lens correction instead.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include <stdint.h>
+
+#define OP_PROFILE_COUNT  (4)                       // Profiles there are; see OpticalProfiles.cpp
+#define OP_RINGS          (8)                       // Radii in a vignetting map
+#define OP_EXIF_MAX       (256)                     // Biggest EXIF APP1 segment, marker and all
+#define OP_LENS_MODEL_LEN (48)                      // Longest EXIF LensModel, plus one
+#define OP_SENSOR_UM      (2200)                    // Center to corner of the OV2640's pixel array
+#define OP_MAKE           "ESP32-CAM"               // EXIF Make
+#define OP_MODEL          "ESP32 Pinhole Camera"    // EXIF Model
+
+// A pinhole assembly (or lens)
+struct opProfile_t {
+  const char *name;                               // What pinhole.cfg calls it
+  uint16_t focalUm;                               // Pinhole to sensor; 0 if unknown
+  uint16_t pinholeUm;                             // Pinhole diameter; 0 for a lens
+  int8_t aeLevel;                                 // Exposure bias, as the sensor's ae_level (-2 to 2)
+  bool lenc;                                      // Whether the sensor's lens correction is on
+  uint8_t windowPercent;                          // How much of the picture to keep across and down, centered
+};
+
+// What's worked out from a profile ahead of time
+struct opTables_t {
+  uint16_t fNumber10;                             // Ten times the f-number; 0 if unknown
+  uint16_t radiusUm;                              // Center to corner of the picture kept
+  uint16_t gains[OP_RINGS];                       // Vignetting map, 8.8 fixed point
+  uint8_t exif[OP_EXIF_MAX];                      // The APP1 segment that goes after a picture's SOI
+  uint16_t exifLen;                               // Its length
+};
+
+class OpticalProfiles {
+  public:
+    /**
+     * @brief Work out every profile's tables. Call once, at boot.
+     */
+    void begin();
+
+    /**
+     * @brief The number of profiles
+     */
+    static uint8_t count();
+
+    /**
+     * @brief The index of the profile with the given name, or -1 if there isn't one
+     */
+    static int find(const char *name);
+
+    /**
+     * @brief The given profile
+     */
+    static const opProfile_t &profile(uint8_t index);
+
+    /**
+     * @brief What was worked out from the given profile
+     */
+    const opTables_t &tables(uint8_t index) const;
+
+  private:
+    void makeExif(const opProfile_t &p, opTables_t &t);
+
+    opTables_t all[OP_PROFILE_COUNT];
+};
@@ -0,0 +1,246 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * PinholeCamera.h
+ *
+ * The heart of the camera: taking a picture and saving it. When the shutter is clicked,
+ * shoot() gets a frame from the camera, makes sure there's room for it, names it after the
+ * next value of the image counter, writes and closes the file, commits the counter and 
+ * flashes the LED to say how it went. The flashing goes on in the background (see 
+ * LedPatterns.h), so shoot() is ready for the next picture as soon as this one is saved.
+ *
+ * When the camera doesn't deliver, shoot() tries again a couple of times, waiting a little 
+ * longer each time, and then restarts the camera. When the card won't take the picture, it
+ * remounts the card and tries once more. Either way, the frame always goes back to the camera.
+ * A glitch costs the time it takes to recover from, which lastRecoveryMicros() says, rather
+ * than the picture and every one after it. That order means the power can go out at any point 
+ * without a picture the LED said was saved being lost or a saved picture being overwritten
+ * by the next one; src/host/powercut checks that. It also keeps track of when the last picture was taken so the
+ * platform knows when it's time to go to sleep.
+ *
+ * Given a JpegMeter (setMeter()), shoot() also meters each frame from its JPEG before saving
+ * it, so whoever's interested can see from lastStats() whether the picture came out too dark,
+ * blown out or blank. It also judges the frame (see FrameQuality.h) and, depending on the
+ * gate (setGate()), saves a bad one anyway, saying so, drops it, or takes it again up to
+ * PC_RETAKES times before dropping it. A dropped frame costs neither a write to the card nor
+ * an image number. Judging costs the metering, which JpegMeter::setLimit() bounds, and
+ * lastMeterMicros() says how long it took.
+ *
+ * Given a JpegStacker (setStacker()), shoot() can take several frames in a row and save their
+ * average, for dim scenes (see JpegStacker.h). Each frame goes back to the camera as soon as
+ * it's been added to the stack, so stacking needs no more frame buffers than a single frame.
+ * If the frames won't stack, shoot() takes a single frame instead.
+ *
+ * Everything it touches, it touches through the hardware abstraction layer in Hal.h, so the
+ * same code runs on the camera and on Linux.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include "Hal.h"
+#include "CardSpace.h"
+#include "LedPatterns.h"
+#include "JpegMeter.h"
+#include "FrameQuality.h"
+#include "JpegStacker.h"
+
+#define PC_AWAKE_MILLIS   (300000UL)                // Default millis() to stay awake waiting for shutter press
+#define PC_CAPTURE_TRIES  (3)                       // Tries at getting a frame before restarting the camera
+#define PC_BACKOFF_MILLIS (50)                      // Wait before the first retry; doubles for each one after
+#define PC_SAVE_TRIES     (2)                       // Tries at saving, remounting the card between them
+#define PC_PATH_LEN       (16)                      // Room for "/Image65535.jpg"
+#define PC_RETAKES        (2)                       // Times PC_GATE_RETAKE takes a bad picture again
+#define PC_GAP_SCAN       (4)                       // Missing image numbers begin() looks past for more images
+
+// How a shot went
+enum pcResult_t : uint8_t {
+  PC_SAVED,                                       // The image was saved
+  PC_NO_FRAME,                                    // The camera didn't deliver a frame
+  PC_CARD_FULL,                                   // There's no room for the image
+  PC_NO_FILE,                                     // The image file couldn't be created
+  PC_SHORT_WRITE,                                 // Not all of the image got written
+  PC_REJECTED                                     // The picture was no good (see FrameQuality.h), so wasn't saved
+};
+
+// What to do with a picture that's no good
+enum pcGate_t : uint8_t {
+  PC_GATE_OFF,                                    // Don't judge pictures
+  PC_GATE_FLAG,                                   // Save it anyway, saying what's wrong
+  PC_GATE_SKIP,                                   // Don't save it
+  PC_GATE_RETAKE                                  // Take it again; if it's still no good, don't save it
+};
+
+// What shoot() is doing, for anyone who wants to know (e.g., for energy accounting)
+enum pcPhase_t : uint8_t {
+  PC_PHASE_CAPTURE,                               // Getting a frame from the camera
+  PC_PHASE_WRITE,                                 // Saving it
+  PC_PHASE_DONE                                   // Done, one way or another
+};
+
+class PinholeCamera {
+  public:
+    /**
+     * @brief Construct a new PinholeCamera from its parts
+     */
+    PinholeCamera(HalClock &clock, HalCamera &camera, HalStorage &storage, HalCounter &counter,
+      LedPatterns &leds, CardSpace &space);
+
+    /**
+     * @brief Get going. Call once the parts are ready (storage mounted, counter readable). If
+     * the power went out last time between saving an image and counting it, counts it now.
+     */
+    void begin();
+
+    /**
+     * @brief Have the given function called as shoot() moves from one phase to the next
+     */
+    void onPhase(void (*handler)(pcPhase_t phase));
+
+    /**
+     * @brief Stay awake waiting for the shutter for the given millis() rather than 
+     * PC_AWAKE_MILLIS
+     */
+    void setAwakeMillis(uint32_t ms);
+
+    /**
+     * @brief Put the given JPEG segment (an EXIF APP1, say) right after the SOI of every picture 
+     * from now on; nullptr for none. It's written as is, so it has to stay put.
+     */
+    void setHeader(const uint8_t *segment, uint16_t len);
+
+    /**
+     * @brief Meter every picture with the given JpegMeter from now on; nullptr for none
+     */
+    void setMeter(JpegMeter *meter);
+
+    /**
+     * @brief What to do with pictures that are no good; PC_GATE_FLAG until told otherwise.
+     * Pictures are only judged when there's a meter.
+     */
+    void setGate(pcGate_t gate);
+
+    /**
+     * @brief Judge pictures blurred with less than the given fine detail, per mille, each way;
+     * 0 not to judge sharpness (see FrameQuality.h)
+     */
+    void setMinFine(uint16_t perMille);
+
+    /**
+     * @brief Stack frames with the given JpegStacker from now on; nullptr for none
+     */
+    void setStacker(JpegStacker *stacker);
+
+    /**
+     * @brief Take a picture and save it, flashing the LED to say how it went
+     *
+     * @param staleMicros HalClock::micros() before which frames are stale; 0 if none are
+     * @param frames      How many frames in a row to average into the picture, up to
+     *                    JS_MAX_FRAMES; more than 1 needs a stacker
+     * @return pcResult_t How it went
+     */
+    pcResult_t shoot(int64_t staleMicros = 0, uint8_t frames = 1);
+
+    /**
+     * @brief Whether it's been long enough since the last shot that it's time to sleep
+     */
+    bool sleepDue();
+
+    /**
+     * @brief Millis left until sleepDue(), 0 if it already is
+     */
+    uint32_t awakeMillisLeft();
+
+    /**
+     * @brief The number of the last image saved (or being saved)
+     */
+    uint16_t imageCount() const;
+
+    /**
+     * @brief The path of the last image saved (or being saved)
+     */
+    const char *lastPath() const;
+
+    /**
+     * @brief HalClock::micros() when the last shot's frame arrived from the camera
+     */
+    int64_t lastCaptureMicros() const;
+
+    /**
+     * @brief The camera's timestamp for the last shot's frame
+     */
+    int64_t lastFrameMicros() const;
+
+    /**
+     * @brief HalClock::micros() when the last shot was safely saved
+     */
+    int64_t lastSavedMicros() const;
+
+    /**
+     * @brief How long the last shot spent recovering, from the start of the first thing that 
+     * went wrong to the picture being saved (or to giving up); 0 if nothing went wrong
+     */
+    int64_t lastRecoveryMicros() const;
+
+    /**
+     * @brief What metering the last shot's frame found; nullptr if it wasn't metered (no
+     * JpegMeter, no frame, or not a JPEG the meter reads)
+     */
+    const jmStats_t *lastStats() const;
+
+    /**
+     * @brief How long metering the last shot's frame took, in micros; 0 if it wasn't metered
+     */
+    uint32_t lastMeterMicros() const;
+
+    /**
+     * @brief What the last shot's frame looked like; FQ_GOOD if it wasn't judged
+     */
+    fqVerdict_t lastVerdict() const;
+
+    /**
+     * @brief How many frames went into the last shot's picture
+     */
+    uint8_t lastFrames() const;
+
+  private:
+    void phase(pcPhase_t p);                      // Tell the phase handler, if any
+    const char *makePath(uint16_t imageNumber);   // Put the image's path in path
+    bool capture(halFrame_t &frame, int64_t staleMicros); // Get a frame, retrying and restarting as need be
+    bool take(halFrame_t &frame, int64_t staleMicros, uint8_t frames); // Capture, stacking if asked
+    bool stack(halFrame_t &frame, uint8_t frames); // Add frames after the one given to it; the average
+    void giveBack(halFrame_t &frame);             // Release a frame, if it's the camera's
+    bool judge(const halFrame_t &frame);          // Meter and judge a frame; whether to keep it
+    void trouble(int64_t sinceMicros);            // Note that something that started then went wrong
+
+    HalClock &clock;
+    HalCamera &camera;
+    HalStorage &storage;
+    HalCounter &counter;
+    LedPatterns &leds;
+    CardSpace &space;
+    void (*phaseHandler)(pcPhase_t) = nullptr;    // Who to tell about phase changes
+    uint16_t imageCtr = 0;                        // The image counter for numbering image files
+    uint32_t clickedMillis = 0;                   // When the last shot was taken
+    uint32_t awakeMillis = PC_AWAKE_MILLIS;       // How long to stay awake after it
+    const uint8_t *header = nullptr;              // What goes after each picture's SOI
+    uint16_t headerLen = 0;
+    JpegMeter *meter = nullptr;                   // What meters each frame, if anything
+    jmStats_t stats;                              // What it found in the last one
+    bool metered = false;                         // Whether stats is the last frame's
+    uint32_t meterUs = 0;                         // How long metering it took
+    pcGate_t gate = PC_GATE_FLAG;                 // What to do with a frame that's no good
+    uint16_t minFine = 0;                         // Fine detail, per mille, a sharp frame has; 0 not to judge
+    fqVerdict_t verdict = FQ_GOOD;                // What the last frame looked like
+    JpegStacker *stacker = nullptr;               // What stacks frames, if anything
+    uint8_t stacked = 0;                          // Frames in the last picture
+    int64_t captureUs = 0;                        // When the last frame arrived
+    int64_t frameUs = 0;                          // The last frame's timestamp
+    int64_t savedUs = 0;                          // When the last image was saved
+    int64_t troubleUs = 0;                        // When the first thing to go wrong this shot started; 0 if none
+    int64_t recoveryUs = 0;                       // How long the last shot spent recovering
+    char path[PC_PATH_LEN] = "";                  // The last image's path
+};
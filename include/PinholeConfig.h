@@ -0,0 +1,120 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * PinholeConfig.h
+ *
+ * The settings in /pinhole.cfg on the SD card, and the parser for it. The file is optional;
+ * anything it doesn't mention keeps its default. It has one setting per line, like this:
+ *
+ *    # Smaller pictures, kept awake longer
+ *    framesize = svga
+ *    jpeg_quality = 12
+ *    awake_millis = 600000
+ *
+ *    Setting           Values                                  Default
+ *    ================  ======================================  =========
+ *    framesize         qvga, cif, vga, svga, xga, sxga, uxga   uxga
+ *    jpeg_quality      0 (best) to 63                          10
+ *    fb_count          1 to 3                                  2
+ *    grab_mode         latest, when_empty                      latest
+ *    xclk_freq_hz      8000000 to 20000000                     20000000
+ *    awake_millis      10000 to 86400000                       300000
+ *    doze              yes, no                                 yes
+ *    sensor_off        yes, no                                 no
+ *    profile           lens, 4mm-f40, 4mm-f80, 8mm-f64         lens
+ *    quality_gate      off, flag, skip, retake                 flag
+ *    dim_framesize     qvga, cif, vga, svga                    svga
+ *    dim_frames        1 to 8                                  4
+ *
+ * On a board without PSRAM, the defaults are svga, 12 and 1, and those are the most it can do.
+ * doze is light sleep between shots (see LightSleep.h) and sensor_off powering the sensor
+ * down while idle (see SensorPower.h). profile is what's in front of the sensor (see
+ * OpticalProfiles.h); a long press of the shutter moves on to the next one. quality_gate is
+ * what to do with a picture that comes out blank, blown out or blurred (see PinholeCamera.h
+ * and FrameQuality.h): save it and say so, don't save it, or take it again. Holding the
+ * shutter down takes a picture for a dim scene: dim_frames frames in a row at dim_framesize,
+ * which comes from a faster readout mode, averaged into one (see JpegStacker.h). Without
+ * PSRAM there's no room to stack, so it's a single frame. Blank lines and everything from a
+ * # on are ignored. A line that doesn't make sense is reported, with its line number, and
+ * skipped.
+ *
+ * cfParse() works on the file's text in place: no heap, no copies beyond a key's and a
+ * value's worth of stack. cfSettings_t is plain data, so it can be kept in RTC memory (see
+ * DeepSleep.h) and the file needn't be parsed again when the camera wakes from deep sleep.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define CF_PATH           "/pinhole.cfg"            // Where the settings are on the card
+#define CF_FILE_MAX       (1024)                    // Biggest settings file we'll read
+#define CF_TOKEN_LEN      (24)                      // Longest key or value, plus one
+
+// Frame sizes, in the same order as the camera driver's framesize_t, which has more
+enum cfFramesize_t : uint8_t {
+  CF_FRAMESIZE_QVGA,                              // 320x240
+  CF_FRAMESIZE_CIF,                               // 400x296
+  CF_FRAMESIZE_VGA,                               // 640x480
+  CF_FRAMESIZE_SVGA,                              // 800x600
+  CF_FRAMESIZE_XGA,                               // 1024x768
+  CF_FRAMESIZE_SXGA,                              // 1280x1024
+  CF_FRAMESIZE_UXGA                               // 1600x1200
+};
+
+// What happens to finished frames nobody has asked for, as in the driver's camera_grab_mode_t
+enum cfGrabMode_t : uint8_t {
+  CF_GRAB_WHEN_EMPTY,                             // They queue up, oldest first
+  CF_GRAB_LATEST                                  // Only the newest is kept
+};
+
+// What to do with a picture that's no good, in the same order as PinholeCamera's pcGate_t
+enum cfGate_t : uint8_t {
+  CF_GATE_OFF,                                    // Don't judge pictures
+  CF_GATE_FLAG,                                   // Save it anyway, saying what's wrong
+  CF_GATE_SKIP,                                   // Don't save it
+  CF_GATE_RETAKE                                  // Take it again
+};
+
+// The settings. No initializers, so one can live in RTC memory; cfDefaults() fills one in.
+struct cfSettings_t {
+  cfFramesize_t frameSize;
+  uint8_t jpegQuality;                            // 0 (best) to 63
+  uint8_t fbCount;                                // Number of frame buffers
+  cfGrabMode_t grabMode;
+  uint32_t xclkHz;                                // Sensor clock
+  uint32_t awakeMillis;                           // How long to stay awake without a click
+  bool doze;                                      // Light sleep between shots
+  bool sensorOff;                                 // Power the sensor down while idle
+  uint8_t profile;                                // Which of the OpticalProfiles
+  cfGate_t gate;                                  // What to do with a picture that's no good
+  cfFramesize_t dimFrameSize;                     // Frame size for a dim scene, no bigger than SVGA
+  uint8_t dimFrames;                              // Frames to average for a dim scene
+};
+
+/**
+ * @brief Set the settings to their defaults
+ */
+void cfDefaults(cfSettings_t &settings);
+
+/**
+ * @brief Apply the settings in the given text, the contents of CF_PATH, to settings. Settings
+ * the text doesn't mention are left as they are. Says what it doesn't understand with halLog().
+ *
+ * @param text      The text; needn't be NUL-terminated
+ * @param len       Its length in bytes
+ * @param settings  The settings to change
+ * @return int      The number of lines that didn't make sense; 0 if all was well
+ */
+int cfParse(const char *text, size_t len, cfSettings_t &settings);
+
+/**
+ * @brief Whether a and b set the camera up the same way, so changing from one to the other
+ * doesn't mean restarting it
+ */
+bool cfSameCamera(const cfSettings_t &a, const cfSettings_t &b);
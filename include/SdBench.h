@@ -0,0 +1,49 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * SdBench.h
+ *
+ * On-device SD card benchmark. When the firmware is built with SD_BENCH defined (the
+ * esp32cam_sdbench environment in platformio.ini), setup() runs the benchmark against
+ * whatever card is in the slot instead of starting the camera. The tests are:
+ *
+ *    Test        What it measures
+ *    ==========  ==============================================================
+ *    seq         Sequential write throughput for each of several chunk sizes
+ *    create      Latency of creating (open + close) a small file
+ *    fat         Cost of forcing a FAT / directory update (flush) per cluster
+ *    sustained   Per-chunk latency over a large file, exposing card GC stalls
+ *
+ * The whole suite is run twice, once with the card in 1-bit mode (what the camera uses)
+ * and once in 4-bit mode. Results are printed on Serial and appended to SD_BENCH_CSV on
+ * the card so that results from many cards can be collected and compared.
+ *
+ * Note that in 4-bit mode GPIO 4 (the white "flash" LED) and GPIO 12 (the shutter) are
+ * used as SD data lines. The white LED will flicker and the shutter is ignored.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include "Arduino.h"
+
+#define SD_BENCH_CSV        "/sdbench.csv"          // Where the results go on the card
+#define SD_BENCH_SEQ_BYTES  (1048576UL)             // Bytes written per sequential chunk-size test
+#define SD_BENCH_CREATES    (50)                    // Number of files created in the create test
+#define SD_BENCH_FAT_FLUSHES (64)                   // Number of flushes in the FAT update test
+#define SD_BENCH_SUS_BYTES  (33554432UL)            // Bytes written in the sustained test (32 MiB)
+#define SD_BENCH_SUS_CHUNK  (32768UL)               // Chunk size used in the sustained test
+#define SD_BENCH_STALL_X    (8)                     // A chunk slower than this many times median is a stall
+
+/**
+ * @brief Run the whole SD card benchmark suite in 1-bit and 4-bit mode
+ *
+ * Expects SD_MMC to be mounted in 1-bit mode when called and leaves it that way.
+ *
+ * @return true   The suite ran and the results were written to SD_BENCH_CSV
+ * @return false  Something went wrong; see Serial for what
+ */
+bool runSdBench();
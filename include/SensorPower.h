@@ -0,0 +1,52 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * SensorPower.h
+ *
+ * Powering the OV2640 down between shots. On the AI Thinker board PWDN_GPIO_NUM doesn't just
+ * put the sensor in standby, it switches off the sensor's regulators, so everything the camera
+ * driver loaded into the sensor's registers is lost. Getting it back the usual way means
+ * esp_camera_deinit() and esp_camera_init(), which probes for the sensor, resets it and works
+ * through its init tables. Instead, each time we power down, we read the registers that
+ * have changed since the driver's init tables into a snapshot in internal RAM. When we power
+ * back up, we run the driver's reset() (just its init tables), write the snapshot back over
+ * SCCB and check that every register in it reads back as it was. The camera driver's DMA and
+ * frame buffers are left alone the whole time.
+ *
+ * The frames waiting in the frame buffers when the sensor is powered up are from before it was
+ * powered down. Use a fresh frame.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include "Arduino.h"
+#include "esp_camera.h"
+
+#define SENSOR_SETTLE_MILLIS (10)                   // millis() for the regulators to come up after PWDN
+
+/**
+ * @brief Power the sensor down, taking a fresh register snapshot first
+ *
+ * @param pwdnPin   The sensor's PWDN GPIO
+ * @return true     Success
+ * @return false    Couldn't take the snapshot; the sensor has been left running
+ */
+bool sensorPowerDown(gpio_num_t pwdnPin);
+
+/**
+ * @brief Power the sensor back up and restore its registers from the snapshot
+ *
+ * @param pwdnPin   The sensor's PWDN GPIO
+ * @return true     The sensor is back the way it was
+ * @return false    The restored registers didn't read back right; reinitialize the camera
+ */
+bool sensorPowerUp(gpio_num_t pwdnPin);
+
+/**
+ * @brief Forget the register snapshot; e.g., after the camera has been reinitialized
+ */
+void sensorForgetSnapshot();
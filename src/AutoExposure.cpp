@@ -0,0 +1,134 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * AutoExposure.cpp
+ *
+ * Implementation of the pinhole exposure controller. See AutoExposure.h for how it works.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "AutoExposure.h"
+#include <math.h>
+
+// Uncomment to enable rather verbose debug printing
+//#define DEBUG
+
+AutoExposure::AutoExposure(HalClock &clock, HalCamera &camera, HalSensor &sensor) :
+  clock(clock), camera(camera), sensor(sensor) {
+}
+
+void AutoExposure::setTarget(uint8_t level) {
+  target = level;
+}
+
+void AutoExposure::setMaxClockDiv(uint8_t div) {
+  maxClockDiv = div < 1 ? 1 : div;
+}
+
+void AutoExposure::setFrameSize(halFramesize_t size) {
+  maxLines = maxLinesFor(size);
+  set = false;
+}
+
+/**
+ * Each step aims straight for the target, assuming the level goes up with the exposure, which
+ * it does until it clips. A clipped or black reading only says which way to go, so those move
+ * by the most a step may.
+ */
+bool AutoExposure::converge(aeResult_t &result) {
+  int64_t startUs = clock.micros();
+  result.converged = false;
+  result.steps = 0;
+  result.changedUs = 0;
+  if (!set && !apply(split(amount, maxClockDiv, maxLines), result)) {
+    return false;
+  }
+  float most = (float)maxLines * maxClockDiv * amountOf({1, AE_MAX_GAIN, 1});
+  while (true) {
+    if (!sensor.meter(result.level)) {
+      return false;
+    }
+    #ifdef DEBUG
+    halLog("AE: %u lines, clock / %u, gain %u: level %u.\n", exposure.lines, exposure.clockDiv,
+      exposure.gain, result.level);
+    #endif
+    int error = (int)result.level - target;
+    if (error >= -AE_TOLERANCE && error <= AE_TOLERANCE) {
+      result.converged = true;
+      break;
+    }
+    if (result.steps >= AE_MAX_STEPS) {
+      break;
+    }
+    float next = result.level >= AE_CLIPPED ? amount / AE_MAX_CHANGE :
+      result.level == 0 ? amount * AE_MAX_CHANGE : amount * target / result.level;
+    next = fminf(fmaxf(next, amount / AE_MAX_CHANGE), amount * AE_MAX_CHANGE);
+    next = fminf(fmaxf(next, 1.0f), most);
+    halExposure_t want = split(next, maxClockDiv, maxLines);
+    if (want.lines == exposure.lines && want.gain == exposure.gain && want.clockDiv == exposure.clockDiv) {
+      break;                                      // As far as it goes
+    }
+    amount = next;
+    if (!apply(want, result)) {
+      return false;
+    }
+  }
+  result.exposure = exposure;
+  result.micros = (uint32_t)(clock.micros() - startUs);
+  return true;
+}
+
+void AutoExposure::invalidate() {
+  set = false;
+}
+
+halExposure_t AutoExposure::split(float amount, uint8_t maxClockDiv, uint16_t maxLines) {
+  halExposure_t exposure {0, 0, 1};
+  float lines = amount;
+  if (lines > maxLines) {
+    float div = ceilf(lines / maxLines);
+    exposure.clockDiv = div > maxClockDiv ? maxClockDiv : (uint8_t)div;
+    lines /= exposure.clockDiv;
+  }
+  if (lines > maxLines) {
+    float gain = ceilf(lines / maxLines) - 1.0f;
+    exposure.gain = gain > AE_MAX_GAIN ? AE_MAX_GAIN : (uint8_t)gain;
+    lines /= halGainOf(exposure.gain);
+  }
+  lines = roundf(lines);
+  exposure.lines = lines < 1.0f ? 1 : lines > maxLines ? maxLines : (uint16_t)lines;
+  return exposure;
+}
+
+uint16_t AutoExposure::maxLinesFor(halFramesize_t size) {
+  return size <= HAL_FRAMESIZE_CIF ? AE_CIF_LINES : size <= HAL_FRAMESIZE_SVGA ? AE_SVGA_LINES : AE_MAX_LINES;
+}
+
+float AutoExposure::amountOf(const halExposure_t &exposure) {
+  return exposure.lines * exposure.clockDiv * halGainOf(exposure.gain);
+}
+
+/**
+ * The sensor may take a frame to act on a change, so this waits for the second frame that
+ * starts after it, which is what HalCamera::get() hands over.
+ */
+bool AutoExposure::apply(const halExposure_t &want, aeResult_t &result) {
+  if (!sensor.setExposure(want)) {
+    halLog("Unable to set the exposure.\n");
+    return false;
+  }
+  exposure = want;
+  set = true;
+  result.steps++;
+  result.changedUs = clock.micros();
+  halFrame_t frame;
+  if (!camera.get(frame, result.changedUs)) {
+    return false;
+  }
+  camera.release(frame);
+  return true;
+}
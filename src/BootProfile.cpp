@@ -0,0 +1,79 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * BootProfile.cpp
+ *
+ * Implementation of the boot-time profiler. See BootProfile.h for what it does.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "BootProfile.h"
+#include "esp_timer.h"                            // esp_timer_get_time()
+#include "esp_system.h"                           // esp_reset_reason()
+#include "esp32/rtc.h"                            // esp_rtc_get_time_us()
+
+// The names of the phases as they appear in the log header, in bpPhase_t order
+static const char *bpPhaseNames[BP_N_PHASES] = {
+  "rom", "startup", "serial", "camera", "sd_mount", "card_detect", "config",
+  "free_space", "eeprom", "shutter", "camera_wait"
+};
+
+void BootProfile::begin() {
+  int64_t nowUs = esp_timer_get_time();
+  uint64_t rtcUs = esp_rtc_get_time_us();
+  wokeUp = esp_reset_reason() == ESP_RST_DEEPSLEEP;
+  romUs = !wokeUp && rtcUs > (uint64_t)nowUs ? rtcUs - nowUs : 0;
+  for (uint8_t i = 0; i < BP_N_PHASES; i++) {
+    startUs[i] = 0;
+    phaseUs[i] = 0;
+  }
+  phaseUs[BP_ROM] = (uint32_t)romUs;
+  phaseUs[BP_STARTUP] = (uint32_t)nowUs;
+  readyUs = 0;
+}
+
+void BootProfile::start(bpPhase_t phase) {
+  startUs[phase] = esp_timer_get_time();
+}
+
+void BootProfile::end(bpPhase_t phase) {
+  phaseUs[phase] = (uint32_t)(esp_timer_get_time() - startUs[phase]);
+}
+
+void BootProfile::ready() {
+  readyUs = esp_timer_get_time();
+}
+
+uint64_t BootProfile::readyMicros() const {
+  return romUs + (uint64_t)readyUs;
+}
+
+bool BootProfile::woke() const {
+  return wokeUp;
+}
+
+bool BootProfile::save(fs::FS &fs, uint8_t cardType, uint32_t cardMib, uint16_t sensorPid) const {
+  bool exists = fs.exists(BP_LOG);
+  File f = fs.open(BP_LOG, FILE_APPEND);
+  if (!f) {
+    return false;
+  }
+  if (!exists) {
+    f.print("reset,card_type,card_mib,sensor_pid");
+    for (uint8_t i = 0; i < BP_N_PHASES; i++) {
+      f.printf(",%s_us", bpPhaseNames[i]);
+    }
+    f.print(",ready_us\n");
+  }
+  f.printf("%d,%u,%u,0x%04x", (int)esp_reset_reason(), cardType, cardMib, sensorPid);
+  for (uint8_t i = 0; i < BP_N_PHASES; i++) {
+    f.printf(",%u", phaseUs[i]);
+  }
+  f.printf(",%llu\n", (unsigned long long)readyMicros());
+  f.close();
+  return true;
+}
@@ -0,0 +1,62 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * CardSpace.cpp
+ *
+ * Implementation of the CardSpace free-space tracker. See CardSpace.h for what it does.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "CardSpace.h"
+
+void CardSpace::begin(uint64_t totalBytes, uint64_t freeBytes, uint32_t clusterBytes, uint32_t estImageBytes) {
+  total = totalBytes;
+  free = freeBytes;
+  cluster = clusterBytes == 0 ? 1 : clusterBytes;
+  avgImage = (uint32_t)onDisk(estImageBytes);
+}
+
+bool CardSpace::hasRoomFor(uint32_t bytes) const {
+  return onDisk(bytes) + CS_RESERVE_BYTES <= free;
+}
+
+void CardSpace::recordWrite(uint32_t bytes) {
+  uint64_t used = onDisk(bytes);
+  free = used > free ? 0 : free - used;
+  avgImage = (uint32_t)(avgImage - (avgImage >> CS_AVG_SHIFT) + (used >> CS_AVG_SHIFT));
+}
+
+uint64_t CardSpace::freeBytes() const {
+  return free;
+}
+
+uint64_t CardSpace::totalBytes() const {
+  return total;
+}
+
+uint32_t CardSpace::shotsRemaining() const {
+  if (free <= CS_RESERVE_BYTES || avgImage == 0) {
+    return 0;
+  }
+  return (uint32_t)((free - CS_RESERVE_BYTES) / avgImage);
+}
+
+uint32_t CardSpace::avgImageBytes() const {
+  return avgImage;
+}
+
+uint32_t CardSpace::clusterBytes() const {
+  return cluster;
+}
+
+bool CardSpace::low() const {
+  return shotsRemaining() < CS_LOW_SHOTS;
+}
+
+uint64_t CardSpace::onDisk(uint32_t bytes) const {
+  return ((uint64_t)bytes + cluster - 1) / cluster * cluster;
+}
@@ -0,0 +1,60 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * DeepSleep.cpp
+ *
+ * Implementation of deep sleep and shutter wakeup. See DeepSleep.h for what it does.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "DeepSleep.h"
+#include "esp_sleep.h"                            // Sleep modes and wakeup sources
+#include "esp_attr.h"                             // RTC_IRAM_ATTR
+#include "driver/rtc_io.h"                        // RTC GPIO pull-ups
+#include "soc/rtc.h"                              // rtc_time_get(), rtc_time_slowclk_to_us()
+#include "soc/rtc_cntl_reg.h"                     // RTC timer registers, for the wake stub
+#include "esp32/clk.h"                            // esp_clk_slowclk_cal_get()
+#include "rom/rtc.h"                              // esp_default_wake_deep_sleep()
+
+RTC_DATA_ATTR rtcState_t rtcState;
+static RTC_DATA_ATTR uint64_t wakeTicks;          // RTC time when the wake stub ran
+
+/**
+ * @brief The deep sleep wake stub. Runs from RTC fast memory as soon as the chip wakes, before
+ * the bootloader; all it can use are registers, RTC memory and ROM functions. It reads the RTC
+ * timer the same way rtc_time_get() does, since that lives in flash and isn't available yet.
+ */
+void RTC_IRAM_ATTR esp_wake_deep_sleep(void) {
+  esp_default_wake_deep_sleep();
+  SET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_UPDATE);
+  while (GET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_VALID) == 0) {
+  }
+  wakeTicks = READ_PERI_REG(RTC_CNTL_TIME0_REG) | ((uint64_t)READ_PERI_REG(RTC_CNTL_TIME1_REG) << 32);
+}
+
+bool wokeByShutter() {
+  return esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT0;
+}
+
+uint32_t wakeMicros() {
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_UNDEFINED) {
+    return 0;
+  }
+  return (uint32_t)rtc_time_slowclk_to_us(rtc_time_get() - wakeTicks, esp_clk_slowclk_cal_get());
+}
+
+void sleepUntilShutter(gpio_num_t shutterPin) {
+  // Keep the shutter pulled up while we're asleep; clicking it pulls it low
+  rtc_gpio_pullup_en(shutterPin);
+  rtc_gpio_pulldown_dis(shutterPin);
+  esp_sleep_enable_ext0_wakeup(shutterPin, 0);
+  esp_deep_sleep_start();
+}
+
+void releaseShutterPin(gpio_num_t shutterPin) {
+  rtc_gpio_deinit(shutterPin);
+}
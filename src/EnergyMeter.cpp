@@ -0,0 +1,135 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * EnergyMeter.cpp
+ *
+ * Implementation of energy accounting. See EnergyMeter.h for what it does.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "EnergyMeter.h"
+#include "esp_timer.h"                            // esp_timer_get_time()
+#include "soc/rtc.h"                              // rtc_time_get(), rtc_time_slowclk_to_us()
+#include "esp32/clk.h"                            // esp_clk_slowclk_cal_get()
+
+#define EM_MAGIC          (0x454D3031UL)            // "EM01": emRtc holds something valid
+#define EM_US_PER_HOUR    (3600000000.0f)           // Microseconds in an hour
+
+// The names of the states as they appear in the log header, in emState_t order
+static const char *emStateNames[EM_N_STATES] = {
+  "boot", "idle", "doze", "capture", "sd_write", "deep_sleep"
+};
+
+// What an AI Thinker ESP32-CAM draws from a 5V supply in each state, in mA, in emState_t order.
+// These are ballpark figures, not careful measurements; measure your own board and adjust.
+// tools/battery_life.py can also be given its own table.
+static const float emCurrentMa[EM_N_STATES] = {
+  130.0f,                                         // Boot
+  110.0f,                                         // Idle: 80MHz, sensor streaming
+  35.0f,                                          // Doze: light sleep, sensor clock stopped
+  170.0f,                                         // Capture: 240MHz, DMA running
+  190.0f,                                         // SD write
+  6.0f                                            // Deep sleep: regulators and sensor leakage
+};
+static const float emLedMa = 5.0f;                // Extra when the little red LED is on
+
+// What survives deep sleep
+struct emRtc_t {
+  uint32_t magic;                                 // EM_MAGIC if the rest is valid
+  uint32_t sessions;                              // Number of awake sessions since power-on
+  uint32_t shots;                                 // Images saved since power-on
+  uint64_t stateUs[EM_N_STATES];                  // Time spent in each state since power-on
+  uint64_t ledUs;                                 // Time the LED has been on since power-on
+  uint64_t sleepTicks;                            // RTC time when we went to sleep
+};
+static RTC_DATA_ATTR emRtc_t emRtc;
+static portMUX_TYPE ledMux = portMUX_INITIALIZER_UNLOCKED;
+
+void EnergyMeter::begin() {
+  if (emRtc.magic == EM_MAGIC) {
+    // Woke from deep sleep. Charge the sleep, which lasted until the app started.
+    uint64_t asleepTicks = rtc_time_get() - emRtc.sleepTicks;
+    uint64_t asleepUs = rtc_time_slowclk_to_us(asleepTicks, esp_clk_slowclk_cal_get());
+    uint64_t appUs = (uint64_t)esp_timer_get_time();
+    emRtc.stateUs[EM_DEEP_SLEEP] += asleepUs > appUs ? asleepUs - appUs : 0;
+  } else {
+    memset(&emRtc, 0, sizeof(emRtc));
+    emRtc.magic = EM_MAGIC;
+  }
+  emRtc.sessions++;
+  for (uint8_t i = 0; i < EM_N_STATES; i++) {
+    sessionStartUs[i] = emRtc.stateUs[i];
+  }
+  sessionStartLedUs = emRtc.ledUs;
+  sessionStartShots = emRtc.shots;
+
+  // Booting started when the app did
+  state = EM_BOOT;
+  stateStartUs = 0;
+}
+
+void EnergyMeter::enter(emState_t newState) {
+  int64_t nowUs = esp_timer_get_time();
+  emRtc.stateUs[state] += (uint64_t)(nowUs - stateStartUs);
+  state = newState;
+  stateStartUs = nowUs;
+}
+
+void EnergyMeter::ledOn(uint32_t ms) {
+  portENTER_CRITICAL(&ledMux);
+  emRtc.ledUs += (uint64_t)ms * 1000;
+  portEXIT_CRITICAL(&ledMux);
+}
+
+void EnergyMeter::shot() {
+  emRtc.shots++;
+}
+
+float EnergyMeter::totalMah() const {
+  return mah(emRtc.stateUs, emRtc.ledUs);
+}
+
+bool EnergyMeter::sleep(fs::FS &fs) {
+  enter(EM_DEEP_SLEEP);
+  uint64_t sessionUs[EM_N_STATES];
+  for (uint8_t i = 0; i < EM_N_STATES; i++) {
+    sessionUs[i] = emRtc.stateUs[i] - sessionStartUs[i];
+  }
+  uint64_t sessionLedUs = emRtc.ledUs - sessionStartLedUs;
+
+  // The deep sleep we're about to go into is charged to the next session
+  bool logged = false;
+  bool exists = fs.exists(EM_LOG);
+  File f = fs.open(EM_LOG, FILE_APPEND);
+  if (f) {
+    if (!exists) {
+      f.print("session");
+      for (uint8_t i = 0; i < EM_N_STATES; i++) {
+        f.printf(",%s_s", emStateNames[i]);
+      }
+      f.print(",led_s,shots,session_mah,total_mah\n");
+    }
+    f.printf("%u", emRtc.sessions);
+    for (uint8_t i = 0; i < EM_N_STATES; i++) {
+      f.printf(",%.3f", sessionUs[i] / 1000000.0f);
+    }
+    f.printf(",%.3f,%u,%.4f,%.4f\n", sessionLedUs / 1000000.0f, emRtc.shots - sessionStartShots,
+      mah(sessionUs, sessionLedUs), totalMah());
+    f.close();
+    logged = true;
+  }
+  emRtc.sleepTicks = rtc_time_get();
+  return logged;
+}
+
+float EnergyMeter::mah(const uint64_t *stateUs, uint64_t ledUs) const {
+  float total = ledUs * emLedMa;
+  for (uint8_t i = 0; i < EM_N_STATES; i++) {
+    total += stateUs[i] * emCurrentMa[i];
+  }
+  return total / EM_US_PER_HOUR;
+}
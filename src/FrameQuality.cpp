@@ -0,0 +1,42 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * FrameQuality.cpp
+ *
+ * Implementation of judging pictures. See FrameQuality.h for the verdicts.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "FrameQuality.h"
+
+static const char *const verdictNames[] = {"good", "blank", "blown out", "blurred"};
+
+fqVerdict_t fqJudge(const jmStats_t &stats, uint16_t minFine) {
+  if (stats.blocks == 0) {
+    return FQ_BLANK;
+  }
+  uint64_t blocks = stats.blocks;
+  bool detailed = stats.detail >= blocks * FQ_MIN_DETAIL;
+  if ((uint64_t)stats.dark * 100 >= blocks * FQ_BLANK_PERCENT) {
+    return FQ_BLANK;
+  }
+  if ((uint64_t)stats.clipped * 100 >= blocks * FQ_CLIPPED_PERCENT) {
+    return FQ_CLIPPED;
+  }
+  if (!detailed && JpegMeter::percentile(stats, 95) - JpegMeter::percentile(stats, 5) <= FQ_FLAT_SPREAD) {
+    return FQ_BLANK;
+  }
+  uint64_t fine = stats.fineAcross < stats.fineDown ? stats.fineAcross : stats.fineDown;
+  if (minFine != 0 && detailed && fine * 1000 < stats.detail * minFine) {
+    return FQ_BLURRED;
+  }
+  return FQ_GOOD;
+}
+
+const char *fqName(fqVerdict_t verdict) {
+  return verdict <= FQ_BLURRED ? verdictNames[verdict] : "unknown";
+}
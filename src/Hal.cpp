@@ -0,0 +1,175 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * Hal.cpp
+ *
+ * The parts of the hardware abstraction layer that are the same on every platform. See Hal.h.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "Hal.h"
+
+/**
+ * The OV2640 makes the frame sizes from three readout modes, and each frame size from a mode's
+ * whole picture (CIF's is 296 rows, not 300), scaled.
+ */
+static const struct {
+  uint16_t width;
+  uint16_t height;
+  uint16_t columns;                               // The mode's
+  uint16_t rows;
+} halSizes[] = {
+  { 320,  240,  400,  296},                       // HAL_FRAMESIZE_QVGA
+  { 400,  296,  400,  296},                       // HAL_FRAMESIZE_CIF
+  { 640,  480,  800,  600},                       // HAL_FRAMESIZE_VGA
+  { 800,  600,  800,  600},                       // HAL_FRAMESIZE_SVGA
+  {1024,  768, 1600, 1200},                       // HAL_FRAMESIZE_XGA
+  {1280, 1024, 1600, 1200},                       // HAL_FRAMESIZE_SXGA
+  {1600, 1200, 1600, 1200}                        // HAL_FRAMESIZE_UXGA
+};
+
+/**
+ * The GAIN register is four doubling bits over a fraction in sixteenths: (bit 7 + 1) times
+ * (bit 6 + 1) times (bit 5 + 1) times (bit 4 + 1) times (1 + bits 3 - 0 / 16), and the driver's
+ * table picks the values that make each whole number of times.
+ */
+float halGainOf(uint8_t gain) {
+  return 1.0f + (gain > HAL_MAX_GAIN ? HAL_MAX_GAIN : gain);
+}
+
+/**
+ * The frame is worked out first, then the part of the mode's picture that scales to it, so
+ * the scale is the frame size's, give or take the rounding to fours. The window's offset is
+ * kept even so the chroma pairs stay as they were.
+ */
+bool halWindow(halFramesize_t size, uint8_t percent, halWindow_t &window) {
+  if (size > HAL_FRAMESIZE_UXGA || percent < HAL_MIN_WINDOW || percent > 100) {
+    return false;
+  }
+  uint16_t width = halSizes[size].width;
+  uint16_t height = halSizes[size].height;
+  uint16_t columns = halSizes[size].columns;
+  uint16_t rows = halSizes[size].rows;
+  window.width = (uint16_t)(width * percent / 100 / 16 * 16);
+  window.height = (uint16_t)(height * percent / 100 / 8 * 8);
+  window.columns = (uint16_t)((uint32_t)window.width * columns / width / 4 * 4);
+  window.rows = (uint16_t)((uint32_t)window.height * rows / height / 4 * 4);
+  window.x = (uint16_t)((columns - window.columns) / 4 * 2);
+  window.y = (uint16_t)((rows - window.rows) / 4 * 2);
+  return true;
+}
+
+/**
+ * A level is believed once it has lasted BUTTON_DEBOUNCE_US: until the next edge or, with the
+ * queue empty, until now. The time of the change is that of the first edge away from the old
+ * level after it had settled, when the switch really started to move. Releases are the 
+ * exception: once a press has been believed, the first edge up is the release, bounces or no,
+ * so a click is reported without waiting for it to settle. If the queue ran over, or edges went 
+ * unnoticed while the interrupt was off, the pin's level says what the missing edges were.
+ */
+bool HalButton::event(HalClock &clock, halButtonEvent_t &event) {
+  while (true) {
+    if (!haveHeld) {
+      haveHeld = nextEdge(held);
+    }
+    int64_t untilUs = haveHeld ? held.atUs : clock.micros();
+    if (rawDown != stableDown && untilUs - rawUs >= BUTTON_DEBOUNCE_US) {
+      stableDown = rawDown;
+      if (gesture(stableDown, changeUs, event)) {
+        return true;
+      }
+      continue;
+    }
+    if (!haveHeld) {
+      break;
+    }
+    haveHeld = false;
+    if (stableDown && rawDown && !held.down) {
+      rawDown = stableDown = false;
+      rawUs = held.atUs;
+      if (gesture(false, held.atUs, event)) {
+        return true;
+      }
+      continue;
+    }
+    if (held.down != rawDown) {
+      if (rawDown == stableDown && held.atUs - rawUs >= BUTTON_DEBOUNCE_US) {
+        changeUs = held.atUs;
+      }
+      rawDown = held.down;
+      rawUs = held.atUs;
+    }
+  }
+  int64_t nowUs = clock.micros();
+  bool pinDown = isDown();
+  if (pinDown != rawDown) {
+    if (rawDown == stableDown && nowUs - rawUs >= BUTTON_DEBOUNCE_US) {
+      changeUs = nowUs;
+    }
+    rawDown = pinDown;
+    rawUs = nowUs;
+  }
+  if (stableDown && downUs != 0 && !holdSent && nowUs - downUs >= BUTTON_HOLD_US) {
+    holdSent = true;
+    event = {HAL_HOLD, downUs, 0};
+    return true;
+  }
+  return false;
+}
+
+void HalButton::startDecoding(bool down) {
+  haveHeld = false;
+  rawDown = stableDown = down;
+  downUs = clickUpUs = 0;
+  holdSent = false;
+}
+
+bool HalButton::gesture(bool down, int64_t atUs, halButtonEvent_t &event) {
+  if (down) {
+    downUs = atUs;
+    holdSent = false;
+    return false;
+  }
+  int64_t pressUs = downUs;
+  downUs = 0;
+  if (pressUs == 0 || holdSent) {
+    return false;
+  }
+  if (atUs - pressUs >= BUTTON_LONG_US) {
+    event = {HAL_LONG_PRESS, pressUs, atUs};
+    clickUpUs = 0;
+  } else if (clickUpUs != 0 && pressUs - clickUpUs <= BUTTON_DOUBLE_US) {
+    event = {HAL_DOUBLE_CLICK, pressUs, atUs};
+    clickUpUs = 0;
+  } else {
+    event = {HAL_CLICK, pressUs, atUs};
+    clickUpUs = atUs;
+  }
+  return true;
+}
+
+/**
+ * Frames stamped before sinceMicros are thrown away, as is the first one stamped after, since
+ * it may have been in progress. Gives up waiting for a fresh one after STALE_MAX_FRAMES.
+ */
+bool HalCamera::get(halFrame_t &frame, int64_t sinceMicros) {
+  bool gotOne = grab(frame);
+  if (sinceMicros != 0) {
+    bool straddlerSeen = false;
+    for (uint8_t i = 0; gotOne && i < STALE_MAX_FRAMES; i++) {
+      if (frame.timestampUs >= sinceMicros) {
+        if (straddlerSeen) {
+          break;
+        }
+        straddlerSeen = true;
+      }
+      release(frame);
+      gotOne = grab(frame);
+    }
+  }
+  return gotOne;
+}
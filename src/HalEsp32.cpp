@@ -0,0 +1,392 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * HalEsp32.cpp
+ *
+ * The ESP32 CAM implementations of the hardware abstraction layer. See HalEsp32.h.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "HalEsp32.h"
+#include "esp_camera.h"                           // Camera support
+#include <EEPROM.h>                               // EEPROM access
+#include "SD_MMC.h"                               // SD card mounting
+#include "driver/gpio.h"                          // GPIO interrupts
+#include "soc/gpio_reg.h"                         // GPIO input registers
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define HAL_LOG_LEN       (256)                     // Longest message halLog() will print
+#define OV2640_CLKRC      (0x111)                   // Sensor bank (0x100) clock control register
+#define OV2640_YAVG       (0x12F)                   // Sensor bank average luminance register
+#define CLKRC_DIV_MASK    (0x3F)                    // CLKRC's clock divider field
+#define OV2640_MODE_UXGA  (0)                       // The driver's ov2640_sensor_mode_t, for set_res_raw()
+#define OV2640_MODE_SVGA  (1)
+#define OV2640_MODE_CIF   (2)
+
+// The driver's frame sizes, in halFramesize_t order
+static const framesize_t halSizes[] = {
+  FRAMESIZE_QVGA, FRAMESIZE_CIF, FRAMESIZE_VGA, FRAMESIZE_SVGA, FRAMESIZE_XGA, FRAMESIZE_SXGA, FRAMESIZE_UXGA
+};
+
+/**
+ * @brief The halFramesize_t for the given framesize_t; UXGA for one it doesn't have
+ */
+static halFramesize_t halSizeOf(framesize_t size) {
+  for (uint8_t i = 0; i <= HAL_FRAMESIZE_UXGA; i++) {
+    if (halSizes[i] == size) {
+      return (halFramesize_t)i;
+    }
+  }
+  return HAL_FRAMESIZE_UXGA;
+}
+
+void halLog(const char *format, ...) {
+  char msg[HAL_LOG_LEN];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(msg, sizeof(msg), format, args);
+  va_end(args);
+  Serial.print(msg);
+}
+
+uint32_t Esp32Clock::millis() {
+  return ::millis();
+}
+
+int64_t Esp32Clock::micros() {
+  return esp_timer_get_time();
+}
+
+void Esp32Clock::delay(uint32_t ms) {
+  ::delay(ms);
+}
+
+void Esp32Clock::delayMicros(uint32_t us) {
+  delayMicroseconds(us);
+}
+
+Esp32Timer::Esp32Timer(const char *name) : name(name) {
+}
+
+void Esp32Timer::begin(void (*handler)(void *arg), void *arg) {
+  esp_timer_create_args_t args = {};
+  args.callback = handler;
+  args.arg = arg;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = name;
+  if (esp_timer_create(&args, &timer) != ESP_OK) {
+    halLog("Unable to create the '%s' timer.\n", name);
+  }
+}
+
+void Esp32Timer::start(uint32_t us) {
+  esp_timer_start_once(timer, us);
+}
+
+Esp32Led::Esp32Led(gpio_num_t pin, EnergyMeter *meter) : pin(pin), meter(meter) {
+}
+
+void Esp32Led::begin() {
+  pinMode(pin, OUTPUT);
+  digitalWrite(pin, HIGH);                        // It's active low
+}
+
+void Esp32Led::set(bool on) {
+  digitalWrite(pin, on ? LOW : HIGH);
+  if (on && !isOn) {
+    onMillis = ::millis();
+  } else if (!on && isOn && meter != nullptr) {
+    meter->ledOn(::millis() - onMillis);
+  }
+  isOn = on;
+}
+
+/**
+ * @brief Whether the (active-low) button on pin is down. Reads the register directly, since
+ * gpio_get_level() isn't in IRAM.
+ */
+static inline bool IRAM_ATTR pinIsDown(gpio_num_t pin) {
+  uint32_t in = pin < 32 ? REG_READ(GPIO_IN_REG) >> pin : REG_READ(GPIO_IN1_REG) >> (pin - 32);
+  return (in & 1) == 0;
+}
+
+Esp32Button::Esp32Button(gpio_num_t pin) : pin(pin) {
+}
+
+/**
+ * The camera driver installs the GPIO interrupt service with ESP_INTR_FLAG_IRAM for its VSYNC
+ * interrupt; whichever of us is first gets it installed and the other is told it already is.
+ * Either way, the handler has to be in IRAM.
+ */
+void Esp32Button::begin() {
+  pinMode(pin, INPUT_PULLUP);
+  lastDown = pinIsDown(pin);
+  edges.clear();
+  startDecoding(lastDown);
+  gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+  gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+  gpio_isr_handler_add(pin, isr, this);
+}
+
+bool Esp32Button::isDown() {
+  return pinIsDown(pin);
+}
+
+void Esp32Button::resume(int64_t wokeMicros) {
+  bool down = pinIsDown(pin);
+  if (down != lastDown && edges.put({wokeMicros, down})) {
+    lastDown = down;
+  }
+  gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+  gpio_intr_enable(pin);
+}
+
+bool Esp32Button::nextEdge(halEdge_t &edge) {
+  return edges.get(edge);
+}
+
+/**
+ * Queues every change in level, bounces included; HalButton::event() sorts them out. If the
+ * queue is full, the edge is dropped and event() finds out from the pin.
+ */
+void IRAM_ATTR Esp32Button::isr(void *self) {
+  Esp32Button *button = (Esp32Button *)self;
+  bool down = pinIsDown(button->pin);
+  if (down != button->lastDown && button->edges.put({esp_timer_get_time(), down})) {
+    button->lastDown = down;
+  }
+}
+
+Esp32Camera::Esp32Camera(const camera_config_t &config) : config(config), frameSize(config.frame_size) {
+  halWindow(halSizeOf(frameSize), windowPercent, window);
+}
+
+/**
+ * The camera driver's frame timestamps come from esp_timer_get_time(), same as 
+ * Esp32Clock::micros().
+ */
+bool Esp32Camera::grab(halFrame_t &frame) {
+  camera_fb_t *fb = esp_camera_fb_get();
+  if (fb == nullptr) {
+    return false;
+  }
+  frame.buf = fb->buf;
+  frame.len = fb->len;
+  frame.width = window.width;                     // The driver's fb->width is the size it started with
+  frame.height = window.height;
+  frame.timestampUs = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+  frame.handle = fb;
+  return true;
+}
+
+void Esp32Camera::release(halFrame_t &frame) {
+  esp_camera_fb_return((camera_fb_t *)frame.handle);
+  frame.handle = nullptr;
+}
+
+bool Esp32Camera::restart() {
+  esp_camera_deinit();
+  esp_err_t err = esp_camera_init(&config);
+  if (err != ESP_OK) {
+    halLog("Camera init failed with error 0x%x.\n", err);
+    return false;
+  }
+  clockBits = -1;                                 // The driver may set the clock up differently
+  if ((frameSize != config.frame_size || windowPercent != 100) && !applyWindow()) {
+    return false;
+  }
+  return applyProfile() && applyExposure();
+}
+
+bool Esp32Camera::setExposure(const halExposure_t &exposure) {
+  this->exposure = exposure;
+  manual = true;
+  return applyExposure();
+}
+
+bool Esp32Camera::setAutomatic() {
+  manual = false;
+  return applyExposure();
+}
+
+bool Esp32Camera::meter(uint8_t &level) {
+  sensor_t *sensor = esp_camera_sensor_get();
+  int yavg = sensor == nullptr ? -1 : sensor->get_reg(sensor, OV2640_YAVG, 0xFF);
+  if (yavg < 0) {
+    return false;
+  }
+  level = (uint8_t)yavg;
+  return true;
+}
+
+/**
+ * Changing the frame size sets the sensor's window and clock up again, so the exposure is set
+ * again on top of that.
+ */
+bool Esp32Camera::setFrameSize(halFramesize_t size) {
+  if (size > HAL_FRAMESIZE_UXGA || halSizes[size] > config.frame_size) {
+    return false;
+  }
+  if (halSizes[size] == frameSize) {
+    return true;
+  }
+  frameSize = halSizes[size];
+  return applyWindow() && applyProfile() && applyExposure();
+}
+
+bool Esp32Camera::setWindow(uint8_t percent) {
+  halWindow_t check;
+  if (!halWindow(halSizeOf(frameSize), percent, check)) {
+    return false;
+  }
+  if (percent == windowPercent) {
+    return true;
+  }
+  windowPercent = percent;
+  return applyWindow() && applyProfile() && applyExposure();
+}
+
+bool Esp32Camera::setProfile(int8_t aeLevel, bool lenc) {
+  this->aeLevel = aeLevel;
+  this->lenc = lenc;
+  return applyProfile();
+}
+
+/**
+ * The driver picks the CLKRC divider for the frame size, so the clock is slowed down from
+ * there: a divider field of n divides by n + 1.
+ */
+bool Esp32Camera::applyExposure() {
+  sensor_t *sensor = esp_camera_sensor_get();
+  if (sensor == nullptr) {
+    return false;
+  }
+  if (clockBits < 0) {
+    clockBits = sensor->get_reg(sensor, OV2640_CLKRC, CLKRC_DIV_MASK);
+    if (clockBits < 0) {
+      return false;
+    }
+  }
+  if (!manual) {
+    return sensor->set_reg(sensor, OV2640_CLKRC, CLKRC_DIV_MASK, clockBits) == 0 &&
+      sensor->set_exposure_ctrl(sensor, 1) == 0 && sensor->set_gain_ctrl(sensor, 1) == 0;
+  }
+  int divBits = (clockBits + 1) * exposure.clockDiv - 1;
+  return sensor->set_exposure_ctrl(sensor, 0) == 0 && sensor->set_gain_ctrl(sensor, 0) == 0 &&
+    sensor->set_aec_value(sensor, exposure.lines) == 0 && sensor->set_agc_gain(sensor, exposure.gain) == 0 &&
+    sensor->set_reg(sensor, OV2640_CLKRC, CLKRC_DIV_MASK, divBits > CLKRC_DIV_MASK ? CLKRC_DIV_MASK : divBits) == 0;
+}
+
+/**
+ * The whole picture is what set_framesize() sets up. A window is set with set_res_raw(), which
+ * on the OV2640 takes the sensor mode in place of its first argument and sets the DSP's window
+ * and output size from the mode's picture the same way. Either way, the driver sets the
+ * sensor's clock up again.
+ */
+bool Esp32Camera::applyWindow() {
+  sensor_t *sensor = esp_camera_sensor_get();
+  halFramesize_t size = halSizeOf(frameSize);
+  if (sensor == nullptr || !halWindow(size, windowPercent, window)) {
+    return false;
+  }
+  clockBits = -1;
+  if (windowPercent == 100) {
+    return sensor->set_framesize(sensor, frameSize) == 0;
+  }
+  int mode = size >= HAL_FRAMESIZE_XGA ? OV2640_MODE_UXGA : size >= HAL_FRAMESIZE_VGA ? OV2640_MODE_SVGA : OV2640_MODE_CIF;
+  return sensor->set_res_raw(sensor, mode, 0, 0, 0, window.x, window.y, window.columns, window.rows,
+    window.width, window.height, false, false) == 0;
+}
+
+bool Esp32Camera::applyProfile() {
+  sensor_t *sensor = esp_camera_sensor_get();
+  if (sensor == nullptr) {
+    return false;
+  }
+  return sensor->set_ae_level(sensor, aeLevel) == 0 && sensor->set_lenc(sensor, lenc ? 1 : 0) == 0;
+}
+
+Esp32Storage::Esp32Storage(const char *mountPoint, bool oneBit) : 
+  mountPoint(mountPoint), oneBit(oneBit) {
+}
+
+int Esp32Storage::open(const char *path) {
+  for (int i = 0; i < HAL_MAX_FILES; i++) {
+    if (fds[i] < 0) {
+      fds[i] = ::open(fullPath(path), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      return fds[i] < 0 ? -1 : i;
+    }
+  }
+  return -1;
+}
+
+size_t Esp32Storage::write(int handle, const uint8_t *buf, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = ::write(fds[handle], buf + done, len - done);
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+  return done;
+}
+
+bool Esp32Storage::close(int handle) {
+  int err = ::close(fds[handle]);
+  fds[handle] = -1;
+  return err == 0;
+}
+
+bool Esp32Storage::exists(const char *path) {
+  struct stat st;
+  return stat(fullPath(path), &st) == 0;
+}
+
+/**
+ * Whatever was open goes with the old mount; closing it is only so its slot is free again.
+ */
+bool Esp32Storage::remount() {
+  for (int i = 0; i < HAL_MAX_FILES; i++) {
+    if (fds[i] >= 0) {
+      ::close(fds[i]);
+      fds[i] = -1;
+    }
+  }
+  SD_MMC.end();
+  return SD_MMC.begin(mountPoint, oneBit);
+}
+
+const char *Esp32Storage::fullPath(const char *path) {
+  char *p = full;
+  char *end = full + sizeof(full) - 1;
+  for (const char *s = mountPoint; *s != '\0' && p < end; s++) {
+    *p++ = *s;
+  }
+  for (const char *s = path; *s != '\0' && p < end; s++) {
+    *p++ = *s;
+  }
+  *p = '\0';
+  return full;
+}
+
+Esp32Counter::Esp32Counter(int addr) : addr(addr) {
+}
+
+uint16_t Esp32Counter::read() {
+  return EEPROM.readUShort(addr);
+}
+
+void Esp32Counter::write(uint16_t value) {
+  EEPROM.writeUShort(addr, value);
+}
+
+bool Esp32Counter::commit() {
+  return EEPROM.commit();
+}
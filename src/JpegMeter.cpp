@@ -0,0 +1,425 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * JpegMeter.cpp
+ *
+ * Implementation of metering from JPEG DC coefficients. See JpegMeter.h for what it does and
+ * ITU-T T.81 (the JPEG standard) for the format.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "JpegMeter.h"
+#include <string.h>
+
+// Natural-order index of each zigzag position, plus room for a run that goes too far
+static const uint8_t zigzag[64 + 16] = {
+   0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+  63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63
+};
+
+static uint16_t get16(const uint8_t *p) {
+  return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+bool JpegMeter::meter(const uint8_t *jpeg, size_t len, jmStats_t &stats, jmBlockHandler_t handler,
+  void *context) {
+  memset(&stats, 0, sizeof(stats));
+  outOfTime = false;
+  return readHeaders(jpeg, len, stats) && scan(stats, handler, context);
+}
+
+void JpegMeter::setLimit(HalClock *clock, uint32_t micros) {
+  this->clock = clock;
+  limitUs = micros;
+}
+
+bool JpegMeter::timedOut() const {
+  return outOfTime;
+}
+
+uint8_t JpegMeter::percentile(const jmStats_t &stats, uint8_t percent) {
+  uint32_t want = (uint32_t)((uint64_t)stats.blocks * percent / 100);
+  uint32_t seen = 0;
+  for (uint8_t bin = 0; bin < JM_BINS; bin++) {
+    seen += stats.histogram[bin];
+    if (seen >= want) {
+      return (uint8_t)(bin * (256 / JM_BINS) + (256 / JM_BINS - 1));
+    }
+  }
+  return 255;
+}
+
+const uint16_t *JpegMeter::lumaQuant() const {
+  return quant[components[0].quant];
+}
+
+/**
+ * Reads the tables, the frame header and the scan header, leaving pos at the start of the
+ * scan's data. Anything it doesn't need is skipped.
+ */
+bool JpegMeter::readHeaders(const uint8_t *jpeg, size_t len, jmStats_t &stats) {
+  if (len < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8) {
+    return false;
+  }
+  end = jpeg + len;
+  nComponents = 0;
+  restartInterval = 0;
+  bool haveDc[2] = {false, false};
+  bool haveAc[2] = {false, false};
+  for (const uint8_t *p = jpeg + 2; p + 4 <= end; ) {
+    if (p[0] != 0xFF) {
+      return false;
+    }
+    uint8_t marker = p[1];
+    if (marker == 0xFF) {
+      p++;                                        // Fill byte
+      continue;
+    }
+    uint16_t segLen = get16(p + 2);
+    const uint8_t *seg = p + 4;
+    const uint8_t *segEnd = p + 2 + segLen;
+    if (segLen < 2 || segEnd > end) {
+      return false;
+    }
+    switch (marker) {
+      case 0xDB:                                  // Quantization tables
+        while (seg < segEnd) {
+          uint8_t id = *seg & 0x0F;
+          bool wide = (*seg >> 4) != 0;
+          seg++;
+          if (id > 3 || seg + (wide ? 128 : 64) > segEnd) {
+            return false;
+          }
+          for (uint8_t k = 0; k < 64; k++) {
+            quant[id][zigzag[k]] = wide ? get16(seg + 2 * k) : seg[k];
+          }
+          seg += wide ? 128 : 64;
+        }
+        break;
+      case 0xC4:                                  // Huffman tables
+        while (seg + 17 <= segEnd) {
+          uint8_t tableClass = *seg >> 4;
+          uint8_t id = *seg & 0x0F;
+          int nVals = 0;
+          for (uint8_t i = 0; i < 16; i++) {
+            nVals += seg[1 + i];
+          }
+          if (tableClass > 1 || id > 1 || nVals > 256 || seg + 17 + nVals > segEnd) {
+            return false;
+          }
+          huffTable_t &table = tableClass == 0 ? dcTables[id] : acTables[id];
+          if (!buildTable(seg + 1, seg + 17, nVals, table)) {
+            return false;
+          }
+          (tableClass == 0 ? haveDc : haveAc)[id] = true;
+          seg += 17 + nVals;
+        }
+        break;
+      case 0xC0:                                  // Baseline or extended sequential, Huffman
+      case 0xC1:
+        if (segLen < 8 || seg[0] != 8) {
+          return false;
+        }
+        stats.height = get16(seg + 1);
+        stats.width = get16(seg + 3);
+        nComponents = seg[5];
+        if (nComponents < 1 || nComponents > 3 || segLen != 8 + 3 * nComponents || stats.width == 0 ||
+          stats.height == 0) {
+          return false;
+        }
+        for (uint8_t i = 0; i < nComponents; i++) {
+          component_t &c = components[i];
+          c.id = seg[6 + 3 * i];
+          c.h = seg[7 + 3 * i] >> 4;
+          c.v = seg[7 + 3 * i] & 0x0F;
+          c.quant = seg[8 + 3 * i] & 0x03;
+          if (c.h < 1 || c.h > 2 || c.v < 1 || c.v > 2) {
+            return false;
+          }
+        }
+        break;
+      case 0xDD:                                  // Restart interval
+        if (segLen != 4) {
+          return false;
+        }
+        restartInterval = get16(seg);
+        break;
+      case 0xDA:                                  // Start of scan
+        if (nComponents == 0 || segLen < 3 || seg[0] < 1 || seg[0] > nComponents ||
+          segLen != 6 + 2 * seg[0]) {
+          return false;
+        }
+        nScanComponents = seg[0];
+        for (uint8_t i = 0; i < nScanComponents; i++) {
+          uint8_t id = seg[1 + 2 * i];
+          uint8_t c = 0;
+          while (c < nComponents && components[c].id != id) {
+            c++;
+          }
+          if (c == nComponents) {
+            return false;
+          }
+          components[c].dcTable = seg[2 + 2 * i] >> 4;
+          components[c].acTable = seg[2 + 2 * i] & 0x0F;
+          if (components[c].dcTable > 1 || components[c].acTable > 1 ||
+            !haveDc[components[c].dcTable] || !haveAc[components[c].acTable]) {
+            return false;
+          }
+          scanComponents[i] = c;
+        }
+        if (scanComponents[0] != 0) {
+          return false;                           // The luminance isn't in this scan
+        }
+        pos = segEnd;
+        return true;
+      case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+      case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+        return false;                             // Progressive, lossless, hierarchical or arithmetic
+      case 0xD9:
+        return false;
+      default:
+        break;
+    }
+    p = segEnd;
+  }
+  return false;
+}
+
+/**
+ * Codes are assigned in order of length, and in order within each length (T.81 Annex C).
+ * Codes up to JM_LOOKAHEAD bits long fill every lookup entry that starts with them. A damaged
+ * table with more codes of a length than there's room for is caught before any of them are
+ * filled in, since they'd run off the end of the lookup.
+ */
+bool JpegMeter::buildTable(const uint8_t *counts, const uint8_t *vals, int nVals, huffTable_t &table) {
+  memset(table.lookLen, 0, sizeof(table.lookLen));
+  memcpy(table.counts, counts, sizeof(table.counts));
+  memcpy(table.vals, vals, nVals);
+  int32_t code = 0;
+  int k = 0;
+  for (uint8_t len = 1; len <= 16; len++) {
+    if (code + counts[len - 1] > (1 << len)) {
+      return false;                               // More codes than there's room for
+    }
+    table.valOffset[len] = k - code;
+    table.maxCode[len] = counts[len - 1] == 0 ? -1 : code + counts[len - 1] - 1;
+    for (uint8_t i = 0; i < counts[len - 1]; i++, k++, code++) {
+      if (len <= JM_LOOKAHEAD) {
+        int shift = JM_LOOKAHEAD - len;
+        for (int fill = code << shift; fill < (code + 1) << shift; fill++) {
+          table.lookLen[fill] = len;
+          table.lookVal[fill] = vals[k];
+        }
+      }
+    }
+    code <<= 1;
+  }
+  table.maxCode[17] = INT32_MAX;
+  return true;
+}
+
+/**
+ * One pass over the MCUs. For each block: the DC difference, then the AC coefficients as runs
+ * of zeros and values, up to the end of the block. Only the luminance blocks' DC coefficients
+ * and the sizes of their AC coefficients are kept, unless there's a handler, which gets them
+ * all. With a limit, the
+ * clock is looked at once per row of MCUs.
+ */
+bool JpegMeter::scan(jmStats_t &stats, jmBlockHandler_t handler, void *context) {
+  for (uint8_t i = 0; i < nComponents; i++) {
+    components[i].pred = 0;
+  }
+
+  uint32_t mcusX;
+  uint32_t mcus = mcuCount(stats, mcusX);
+  bool interleaved = nScanComponents > 1;
+  const uint16_t *lumaQ = quant[components[0].quant];
+  uint16_t dcQuant = lumaQ[0];
+  uint32_t sum = 0;
+  int64_t startUs = clock == nullptr ? 0 : clock->micros();
+  int16_t coef[64];
+  bits = 0;
+  nBits = 0;
+  atMarker = false;
+
+  for (uint32_t mcu = 0; mcu < mcus; mcu++) {
+    if (restartInterval != 0 && mcu != 0 && mcu % restartInterval == 0 && !restart()) {
+      return false;
+    }
+    if (clock != nullptr && mcu % mcusX == 0 && clock->micros() - startUs > limitUs) {
+      outOfTime = true;
+      return false;
+    }
+    for (uint8_t s = 0; s < nScanComponents; s++) {
+      component_t &c = components[scanComponents[s]];
+      bool luma = scanComponents[s] == 0;
+      uint8_t blocksH = interleaved ? c.h : 1;
+      uint8_t blocksV = interleaved ? c.v : 1;
+      for (uint8_t v = 0; v < blocksV; v++) {
+        for (uint8_t h = 0; h < blocksH; h++) {
+          int n = decode(dcTables[c.dcTable]);
+          if (n < 0 || n > 15) {
+            return false;
+          }
+          c.pred = (int16_t)(c.pred + (n == 0 ? 0 : receive((uint8_t)n)));
+          bool keep = handler != nullptr;
+          if (keep) {
+            memset(coef, 0, sizeof(coef));
+            coef[0] = c.pred;
+          }
+          for (uint8_t k = 1; k < 64; k++) {
+            int rs = decode(acTables[c.acTable]);
+            if (rs < 0) {
+              return false;
+            }
+            uint8_t run = (uint8_t)(rs >> 4);
+            uint8_t size = (uint8_t)(rs & 0x0F);
+            if (size == 0) {
+              if (run != 15) {
+                break;                            // End of block
+              }
+              k += 15;
+              continue;
+            }
+            k += run;
+            int value = receive(size);
+            if (luma) {
+              uint8_t at = zigzag[k];
+              uint32_t amount = (uint32_t)(value < 0 ? -value : value) * lumaQ[at];
+              stats.detail += amount;
+              stats.fineAcross += (at & 7) >= JM_FINE_FROM ? amount : 0;
+              stats.fineDown += (at >> 3) >= JM_FINE_FROM ? amount : 0;
+            }
+            if (keep) {
+              coef[zigzag[k]] = (int16_t)value;
+            }
+          }
+          if (luma) {
+            int dc = c.pred * dcQuant;
+            int level = 128 + (dc >= 0 ? (dc + 4) / 8 : -((4 - dc) / 8));
+            level = level < 0 ? 0 : level > 255 ? 255 : level;
+            stats.histogram[level / (256 / JM_BINS)]++;
+            stats.dark += level <= JM_DARK;
+            stats.clipped += level >= JM_CLIPPED;
+            sum += (uint32_t)level;
+          }
+          if (keep) {
+            uint32_t bx = interleaved ? (mcu % mcusX) * c.h + h : mcu % mcusX;
+            uint32_t by = interleaved ? (mcu / mcusX) * c.v + v : mcu / mcusX;
+            handler(context, coef, scanComponents[s], (uint16_t)bx, (uint16_t)by);
+          }
+        }
+      }
+    }
+  }
+  stats.blocks = mcus * (interleaved ? components[0].h * components[0].v : 1);
+  stats.mean = (uint8_t)(stats.blocks == 0 ? 0 : (sum + stats.blocks / 2) / stats.blocks);
+  return true;
+}
+
+/**
+ * A scan of one component has one block per MCU, however it's sampled.
+ */
+uint32_t JpegMeter::mcuCount(const jmStats_t &stats, uint32_t &mcusX) const {
+  uint8_t hMax = 1;
+  uint8_t vMax = 1;
+  for (uint8_t i = 0; i < nComponents; i++) {
+    hMax = components[i].h > hMax ? components[i].h : hMax;
+    vMax = components[i].v > vMax ? components[i].v : vMax;
+  }
+  uint32_t mcusY;
+  if (nScanComponents > 1) {
+    mcusX = (stats.width + 8 * hMax - 1) / (8 * hMax);
+    mcusY = (stats.height + 8 * vMax - 1) / (8 * vMax);
+  } else {
+    mcusX = ((stats.width * components[0].h + hMax - 1) / hMax + 7) / 8;
+    mcusY = ((stats.height * components[0].v + vMax - 1) / vMax + 7) / 8;
+  }
+  return mcusX * mcusY;
+}
+
+/**
+ * The data before a restart marker is padded out to a whole byte, which is thrown away along
+ * with anything else short of the marker. Then everything starts over.
+ */
+bool JpegMeter::restart() {
+  bits = 0;
+  nBits = 0;
+  atMarker = false;
+  while (pos + 1 < end && !(pos[0] == 0xFF && (pos[1] & 0xF8) == 0xD0)) {
+    pos++;
+  }
+  if (pos + 1 >= end) {
+    return false;
+  }
+  pos += 2;
+  for (uint8_t i = 0; i < nComponents; i++) {
+    components[i].pred = 0;
+  }
+  return true;
+}
+
+/**
+ * Past the end of the scan data, in comes nothing but zeros. A 0xFF in the data is followed
+ * by a stuffed 0x00, which isn't data.
+ */
+void JpegMeter::fill() {
+  while (nBits <= 24) {
+    uint32_t byte = 0;
+    if (!atMarker && pos < end) {
+      byte = *pos;
+      if (byte != 0xFF) {
+        pos++;
+      } else if (pos + 1 < end && pos[1] == 0x00) {
+        pos += 2;
+      } else {
+        atMarker = true;
+        byte = 0;
+      }
+    }
+    bits |= byte << (24 - nBits);
+    nBits += 8;
+  }
+}
+
+int JpegMeter::decode(const huffTable_t &table) {
+  if (nBits < 16) {
+    fill();
+  }
+  uint32_t look = bits >> (32 - JM_LOOKAHEAD);
+  uint8_t len = table.lookLen[look];
+  if (len != 0) {
+    bits <<= len;
+    nBits -= len;
+    return table.lookVal[look];
+  }
+  for (len = JM_LOOKAHEAD + 1; len <= 16; len++) {
+    int32_t code = (int32_t)(bits >> (32 - len));
+    if (code <= table.maxCode[len]) {
+      bits <<= len;
+      nBits -= len;
+      return table.vals[(table.valOffset[len] + code) & 0xFF];
+    }
+  }
+  return -1;
+}
+
+/**
+ * A value of n bits starting with a 0 is negative: it's that less 2^n - 1 (T.81 F.2.2.1).
+ */
+int JpegMeter::receive(uint8_t n) {
+  if (nBits < 16) {
+    fill();
+  }
+  int value = (int)(bits >> (32 - n));
+  bits <<= n;
+  nBits -= n;
+  return value < (1 << (n - 1)) ? value - (1 << n) + 1 : value;
+}
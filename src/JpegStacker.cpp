@@ -0,0 +1,269 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * JpegStacker.cpp
+ *
+ * Implementation of stacking JPEGs. See JpegStacker.h for how it works and ITU-T T.81 (the
+ * JPEG standard) for the format.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "JpegStacker.h"
+#include <string.h>
+
+// Natural-order index of each zigzag position
+static const uint8_t zigzag[64] = {
+   0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// The number of bits it takes to hold the given coefficient's size
+static uint8_t sizeOf(int value) {
+  uint32_t magnitude = (uint32_t)(value < 0 ? -value : value);
+  uint8_t n = 0;
+  while (magnitude != 0) {
+    n++;
+    magnitude >>= 1;
+  }
+  return n;
+}
+
+void JpegStacker::setBuffers(int16_t *sums, uint32_t maxBlocks, uint8_t *out, size_t outSize) {
+  this->sums = sums;
+  this->maxBlocks = maxBlocks;
+  this->out = out;
+  this->outSize = outSize;
+  reset();
+}
+
+void JpegStacker::reset() {
+  nFrames = 0;
+  broken = false;
+  outLen = 0;
+}
+
+/**
+ * The first frame sets the headers the rest have to match, and how many blocks there are.
+ * The whole picture has to be in the one scan, since only the first one is read.
+ */
+bool JpegStacker::add(const uint8_t *jpeg, size_t len) {
+  jmStats_t stats;
+  memset(&stats, 0, sizeof(stats));
+  if (broken || sums == nullptr || nFrames >= JS_MAX_FRAMES || !reader.readHeaders(jpeg, len, stats) ||
+    reader.nScanComponents != reader.nComponents) {
+    broken = true;
+    return false;
+  }
+  size_t thisHeaderLen = (size_t)(reader.pos - jpeg);
+  if (nFrames == 0) {
+    uint32_t mcusX;
+    uint32_t perMcu = 0;
+    for (uint8_t s = 0; s < reader.nScanComponents; s++) {
+      const JpegMeter::component_t &c = reader.components[reader.scanComponents[s]];
+      perMcu += reader.nScanComponents > 1 ? c.h * c.v : 1;
+    }
+    blocks = reader.mcuCount(stats, mcusX) * perMcu;
+    if (blocks > maxBlocks || thisHeaderLen > outSize) {
+      broken = true;
+      return false;
+    }
+    headerLen = thisHeaderLen;
+    memcpy(out, jpeg, headerLen);
+    memset(sums, 0, (size_t)blocks * 64 * sizeof(int16_t));
+  } else if (thisHeaderLen != headerLen || memcmp(out, jpeg, headerLen) != 0) {
+    broken = true;
+    return false;
+  }
+  at = 0;
+  if (!reader.scan(stats, addBlock, this) || at != blocks) {
+    broken = true;
+    return false;
+  }
+  nFrames++;
+  return true;
+}
+
+uint8_t JpegStacker::frames() const {
+  return nFrames;
+}
+
+/**
+ * The average is rounded to the nearest, halves away from zero, so it's the same for the
+ * positive and negative coefficients. Then the blocks are coded in the order the frames had
+ * them in, with a restart marker wherever the frames had one.
+ */
+bool JpegStacker::finish(size_t &len) {
+  if (broken || nFrames == 0) {
+    return false;
+  }
+  int half = nFrames / 2;
+  for (uint32_t i = 0; i < blocks * 64; i++) {
+    int sum = sums[i];
+    sums[i] = (int16_t)(sum >= 0 ? (sum + half) / nFrames : -((half - sum) / nFrames));
+  }
+  nFrames = 0;
+  for (uint8_t i = 0; i < 2; i++) {
+    buildCodes(reader.dcTables[i], dcCodes[i]);
+    buildCodes(reader.acTables[i], acCodes[i]);
+  }
+
+  jmStats_t stats;
+  memset(&stats, 0, sizeof(stats));
+  if (!reader.readHeaders(out, headerLen, stats)) {
+    return false;
+  }
+  uint32_t mcusX;
+  uint32_t mcus = reader.mcuCount(stats, mcusX);
+  bool interleaved = reader.nScanComponents > 1;
+  int16_t preds[3] = {0, 0, 0};
+  const int16_t *coef = sums;
+  outLen = headerLen;
+  bits = 0;
+  nBits = 0;
+  for (uint32_t mcu = 0; mcu < mcus; mcu++) {
+    uint16_t interval = reader.restartInterval;
+    if (interval != 0 && mcu != 0 && mcu % interval == 0) {
+      if (!flush() || !putByte(0xFF) || !putByte((uint8_t)(0xD0 + (mcu / interval - 1) % 8))) {
+        return false;
+      }
+      memset(preds, 0, sizeof(preds));
+    }
+    for (uint8_t s = 0; s < reader.nScanComponents; s++) {
+      uint8_t index = reader.scanComponents[s];
+      const JpegMeter::component_t &c = reader.components[index];
+      uint8_t n = interleaved ? c.h * c.v : 1;
+      for (uint8_t b = 0; b < n; b++) {
+        if (!encodeBlock(coef, preds[index], dcCodes[c.dcTable], acCodes[c.acTable])) {
+          return false;
+        }
+        coef += 64;
+      }
+    }
+  }
+  if (!flush() || !putByte(0xFF) || !putByte(0xD9)) {
+    return false;
+  }
+  len = outLen;
+  return true;
+}
+
+const uint8_t *JpegStacker::jpeg() const {
+  return out;
+}
+
+/**
+ * A 4:2:2 MCU is 16 pixels across and 8 down, with two luminance blocks and one of each chroma.
+ */
+uint32_t JpegStacker::blocksFor(uint16_t width, uint16_t height) {
+  return (uint32_t)((width + 15) / 16) * ((height + 7) / 8) * 4;
+}
+
+void JpegStacker::addBlock(void *context, const int16_t *coef, uint8_t component, uint16_t blockX,
+  uint16_t blockY) {
+  (void)component;                                // The blocks come in the order the sums are in
+  (void)blockX;
+  (void)blockY;
+  JpegStacker &stacker = *(JpegStacker *)context;
+  if (stacker.at >= stacker.blocks) {
+    stacker.at++;                                 // More blocks than the first frame had
+    return;
+  }
+  int16_t *sum = stacker.sums + (size_t)stacker.at * 64;
+  for (uint8_t k = 0; k < 64; k++) {
+    sum[k] = (int16_t)(sum[k] + coef[k]);
+  }
+  stacker.at++;
+}
+
+/**
+ * Canonical Huffman codes (T.81 C.2): each length's codes count up from one more than the last
+ * code of the length before, doubled.
+ */
+void JpegStacker::buildCodes(const JpegMeter::huffTable_t &table, codeTable_t &codes) {
+  memset(codes.size, 0, sizeof(codes.size));
+  uint16_t code = 0;
+  uint16_t v = 0;
+  for (uint8_t len = 1; len <= 16; len++) {
+    for (uint8_t i = 0; i < table.counts[len - 1] && v < 256; i++) {
+      uint8_t value = table.vals[v++];
+      codes.code[value] = code++;
+      codes.size[value] = len;
+    }
+    code = (uint16_t)(code << 1);
+  }
+}
+
+/**
+ * The DC coefficient is coded as the difference from the last block's of the same component,
+ * the AC coefficients in zigzag order as runs of zeros and the value that ends each (T.81
+ * F.1.2). A negative value is written as itself less 1, in its size's bits.
+ */
+bool JpegStacker::encodeBlock(const int16_t *coef, int16_t &pred, const codeTable_t &dc,
+  const codeTable_t &ac) {
+  int diff = coef[0] - pred;
+  pred = coef[0];
+  uint8_t size = sizeOf(diff);
+  if (dc.size[size] == 0 || !put(dc.code[size], dc.size[size]) ||
+    (size != 0 && !put((uint32_t)(diff < 0 ? diff - 1 : diff), size))) {
+    return false;
+  }
+  uint8_t run = 0;
+  for (uint8_t k = 1; k < 64; k++) {
+    int value = coef[zigzag[k]];
+    if (value == 0) {
+      run++;
+      continue;
+    }
+    while (run > 15) {
+      if (ac.size[0xF0] == 0 || !put(ac.code[0xF0], ac.size[0xF0])) {
+        return false;
+      }
+      run -= 16;
+    }
+    size = sizeOf(value);
+    uint8_t symbol = (uint8_t)(run << 4 | size);
+    if (ac.size[symbol] == 0 || !put(ac.code[symbol], ac.size[symbol]) ||
+      !put((uint32_t)(value < 0 ? value - 1 : value), size)) {
+      return false;
+    }
+    run = 0;
+  }
+  if (run != 0 && (ac.size[0x00] == 0 || !put(ac.code[0x00], ac.size[0x00]))) {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * A 0xFF in the coded data has a 0x00 stuffed after it, so it isn't taken for a marker.
+ */
+bool JpegStacker::put(uint32_t value, uint8_t n) {
+  bits = bits << n | (value & ((1u << n) - 1));
+  nBits = (uint8_t)(nBits + n);
+  while (nBits >= 8) {
+    nBits -= 8;
+    uint8_t byte = (uint8_t)(bits >> nBits);
+    if (!putByte(byte) || (byte == 0xFF && !putByte(0x00))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool JpegStacker::flush() {
+  return nBits == 0 || put(0x7F, (uint8_t)(8 - nBits));
+}
+
+bool JpegStacker::putByte(uint8_t byte) {
+  if (outLen >= outSize) {
+    return false;
+  }
+  out[outLen++] = byte;
+  return true;
+}
@@ -0,0 +1,101 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * LedPatterns.cpp
+ *
+ * Implementation of the background LED pattern player. See LedPatterns.h for what it does.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "LedPatterns.h"
+
+static const uint16_t F = LP_FLASH_MILLIS;
+static const uint16_t P = LP_FAIL_MILLIS;
+
+// The patterns: millis on, off, on, off, ..., ending with 0. Each ends with a gap so the next
+// one doesn't run into it.
+static const uint16_t lpSnap[] = {F, F, 0};
+static const uint16_t lpLow[] = {F, F, F, F, 0};
+static const uint16_t lpFull[] = {F, F, F, F, F, F, 0};
+static const uint16_t lpCameraError[] = {P, F, F, F, 0};
+static const uint16_t lpCardError[] = {P, F, F, F, F, F, 0};
+static const uint16_t lpRejected[] = {F, F, P, F, 0};
+static const uint16_t lpProfile[] = {P, F, 0};
+static const uint16_t lpWave[] = {F, F, F, F, F, F, F, F, F, F, 0};
+static const uint16_t lpCameraFail[] = {F, F, F, P, 0};
+static const uint16_t lpMountFail[] = {F, F, F, F, F, P, 0};
+static const uint16_t lpNoCard[] = {F, F, F, F, F, F, F, P, 0};
+static const uint16_t lpBenchFail[] = {F, F, F, F, F, F, F, F, F, F, F, P, 0};
+static const uint16_t *const lpPatterns[LP_PATTERN_COUNT] = {
+  lpSnap, lpLow, lpFull, lpCameraError, lpCardError, lpRejected, lpProfile, lpWave, lpCameraFail, lpMountFail, lpNoCard,
+  lpBenchFail
+};
+
+LedPatterns::LedPatterns(HalLed &led, HalTimer &timer) : led(led), timer(timer) {
+}
+
+void LedPatterns::begin() {
+  timer.begin(expired, this);
+}
+
+bool LedPatterns::play(lpPattern_t pattern) {
+  uint8_t t = tail.load(std::memory_order_relaxed);
+  uint8_t next = (t + 1) % LP_QUEUE_LEN;
+  if (next == head.load(std::memory_order_acquire)) {
+    return false;
+  }
+  queue[t] = pattern;
+  tail.store(next, std::memory_order_release);
+  bool wasPlaying = false;
+  if (playing.compare_exchange_strong(wasPlaying, true)) {
+    advance();
+  }
+  return true;
+}
+
+bool LedPatterns::busy() const {
+  return playing.load();
+}
+
+void LedPatterns::wait(HalClock &clock) {
+  while (busy()) {
+    clock.delay(LP_POLL_MILLIS);
+  }
+}
+
+void LedPatterns::expired(void *self) {
+  ((LedPatterns *)self)->advance();
+}
+
+/**
+ * Only ever runs in whoever set playing, so it has the LED, step and head to itself. When the
+ * queue runs dry it gives up playing, then looks again in case play() added a pattern just
+ * before it did, when play() would have seen it still playing and left the pattern to it.
+ */
+void LedPatterns::advance() {
+  while (true) {
+    uint8_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+      led.set(false);
+      playing.store(false);
+      bool wasPlaying = false;
+      if (h == tail.load(std::memory_order_acquire) || !playing.compare_exchange_strong(wasPlaying, true)) {
+        return;
+      }
+      continue;
+    }
+    const uint16_t *steps = lpPatterns[queue[h]];
+    if (steps[step] == 0) {
+      step = 0;
+      head.store((h + 1) % LP_QUEUE_LEN, std::memory_order_release);
+      continue;
+    }
+    led.set(step % 2 == 0);
+    timer.start((uint32_t)steps[step++] * 1000);
+    return;
+  }
+}
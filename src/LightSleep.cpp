@@ -0,0 +1,36 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * LightSleep.cpp
+ *
+ * Implementation of light sleep between shots. See LightSleep.h for what it does.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "LightSleep.h"
+#include "esp_sleep.h"                            // Sleep modes and wakeup sources
+#include "driver/gpio.h"                          // GPIO wakeup
+
+/**
+ * Arming the wakeup makes the shutter's interrupt a level one, which would fire over and over
+ * while the shutter is held after we wake. So the interrupt is off until the shutter's
+ * resume() puts it back the way it was.
+ */
+bool lightSleepUntilShutter(gpio_num_t shutterPin, uint32_t maxMillis) {
+  gpio_intr_disable(shutterPin);
+  gpio_wakeup_enable(shutterPin, GPIO_INTR_LOW_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+  esp_sleep_enable_timer_wakeup((uint64_t)maxMillis * 1000);
+  esp_light_sleep_start();
+  bool shutterWoke = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO;
+
+  // Leave things so they don't interfere with deep sleep's wakeup
+  gpio_wakeup_disable(shutterPin);
+  esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_GPIO);
+  esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+  return shutterWoke;
+}
@@ -0,0 +1,422 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * PinholeCamera.cpp
+ *
+ * Implementation of taking and saving pictures. See PinholeCamera.h for what it does.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "PinholeCamera.h"
+
+// Uncomment to enable rather verbose debug printing
+//#define DEBUG
+
+PinholeCamera::PinholeCamera(HalClock &clock, HalCamera &camera, HalStorage &storage,
+  HalCounter &counter, LedPatterns &leds, CardSpace &space) :
+  clock(clock), camera(camera), storage(storage), counter(counter), leds(leds), space(space) {
+}
+
+/**
+ * If the power went out after an image was saved but before the counter was committed, the
+ * image is on the card under the next number, or a little past it if there's a gap (say, from
+ * a file deleted on a computer). Move the counter past the last one within PC_GAP_SCAN missing
+ * numbers rather than overwrite it.
+ */
+void PinholeCamera::begin() {
+  imageCtr = counter.read();
+  uint16_t counted = imageCtr;
+  uint16_t probe = imageCtr;
+  for (uint8_t missing = 0; missing < PC_GAP_SCAN && probe < UINT16_MAX; ) {
+    if (storage.exists(makePath(++probe))) {
+      imageCtr = probe;
+      missing = 0;
+    } else {
+      missing++;
+    }
+  }
+  if (imageCtr != counted) {
+    halLog("Found Image%u.jpg on the card; numbering from there.\n", (unsigned)imageCtr);
+    counter.write(imageCtr);
+    counter.commit();
+  }
+  clickedMillis = clock.millis();
+  #ifdef DEBUG
+  halLog("Last stored image was Image%d.jpg.\n", imageCtr);
+  #endif
+}
+
+void PinholeCamera::onPhase(void (*handler)(pcPhase_t phase)) {
+  phaseHandler = handler;
+}
+
+void PinholeCamera::setAwakeMillis(uint32_t ms) {
+  awakeMillis = ms;
+}
+
+void PinholeCamera::setHeader(const uint8_t *segment, uint16_t len) {
+  header = segment;
+  headerLen = segment == nullptr ? 0 : len;
+}
+
+void PinholeCamera::setMeter(JpegMeter *meter) {
+  this->meter = meter;
+}
+
+void PinholeCamera::setGate(pcGate_t gate) {
+  this->gate = gate;
+}
+
+void PinholeCamera::setMinFine(uint16_t perMille) {
+  minFine = perMille;
+}
+
+void PinholeCamera::setStacker(JpegStacker *stacker) {
+  this->stacker = stacker;
+}
+
+pcResult_t PinholeCamera::shoot(int64_t staleMicros, uint8_t frames) {
+  clickedMillis = clock.millis();
+  troubleUs = recoveryUs = 0;
+  metered = false;
+  meterUs = 0;
+
+  // Capture image, metering and judging it if there's a meter. A bad one is kept, dropped or
+  // taken again, as the gate says.
+  halFrame_t frame;
+  verdict = FQ_GOOD;
+  for (uint8_t takes = 0; ; takes++) {
+    phase(PC_PHASE_CAPTURE);
+    if (!take(frame, staleMicros, frames)) {
+      halLog("Camera capture failed, even after restarting the camera.\n");
+      recoveryUs = clock.micros() - troubleUs;
+      phase(PC_PHASE_DONE);
+      leds.play(LP_CAMERA_ERROR);
+      return PC_NO_FRAME;
+    }
+    captureUs = clock.micros();
+    frameUs = frame.timestampUs;
+    #ifdef DEBUG
+    halLog("Got the framebuffer.\n");
+    #endif
+    if (judge(frame)) {
+      break;
+    }
+    giveBack(frame);
+    if (gate == PC_GATE_SKIP || takes >= PC_RETAKES) {
+      halLog("Not saving it.\n");
+      phase(PC_PHASE_DONE);
+      leds.play(LP_REJECTED);
+      return PC_REJECTED;
+    }
+    halLog("Taking it again.\n");
+    staleMicros = captureUs;
+  }
+
+  // Make sure it'll fit on the card
+  if (!space.hasRoomFor(frame.len + headerLen)) {
+    halLog("The SD card is full.\n");
+    giveBack(frame);
+    phase(PC_PHASE_DONE);
+    leds.play(LP_FULL);
+    return PC_CARD_FULL;
+  }
+
+  // Figure out what to call the image file
+  makePath(++imageCtr);
+  #ifdef DEBUG
+  halLog("The file name for the image is '%s'.\n", path);
+  #endif
+
+  // Save the image, remounting the card and trying again if that doesn't work. The header, if
+  // there is one, goes between the frame's SOI and the rest of it.
+  phase(PC_PHASE_WRITE);
+  bool withHeader = headerLen != 0 && frame.len >= 2 && frame.buf[0] == 0xFF && frame.buf[1] == 0xD8;
+  size_t total = withHeader ? frame.len + headerLen : frame.len;
+  pcResult_t result = PC_NO_FILE;
+  bool created = false;
+  size_t sz = 0;
+  for (uint8_t tries = 0; tries < PC_SAVE_TRIES && result != PC_SAVED; tries++) {
+    int64_t tryUs = clock.micros();
+    if (tries != 0) {
+      halLog("Remounting the SD card.\n");
+      if (!storage.remount()) {
+        halLog("Unable to remount the SD card.\n");
+        break;
+      }
+    }
+    int file = storage.open(path);
+    if (file < 0) {
+      halLog("Unable to create the file for the image.\n");
+      result = PC_NO_FILE;
+      trouble(tryUs);
+      continue;
+    }
+    created = true;
+    if (withHeader) {
+      sz = storage.write(file, frame.buf, 2);
+      sz += storage.write(file, header, headerLen);
+      sz += storage.write(file, frame.buf + 2, frame.len - 2);
+    } else {
+      sz = storage.write(file, frame.buf, frame.len);
+    }
+    bool closed = storage.close(file);
+    if (sz != total || !closed) {
+      halLog("Unable to write all of '%s'.\n", path);
+      result = PC_SHORT_WRITE;
+      trouble(tryUs);
+      continue;
+    }
+    result = PC_SAVED;
+  }
+  size_t len = total;
+  giveBack(frame);
+  space.recordWrite(sz);
+  if (result != PC_SAVED) {
+    if (!created) {
+      imageCtr--;                                 // Nothing's on the card under that number; use it next time
+    }
+    recoveryUs = clock.micros() - troubleUs;
+    phase(PC_PHASE_DONE);
+    leds.play(LP_CARD_ERROR);
+    return result;
+  }
+  halLog("Saved image to: '%s' (%u bytes). Room for about %u more.\n",
+    path, (unsigned)len, (unsigned)space.shotsRemaining());
+
+  // Only now that the image is safely on the card, count it, and only once it's counted, say 
+  // it's saved. The order matters if the power goes out; see src/host/powercut.
+  counter.write(imageCtr);
+  counter.commit();
+  savedUs = clock.micros();
+  if (troubleUs != 0) {
+    recoveryUs = savedUs - troubleUs;
+    halLog("Recovered in %u ms.\n", (unsigned)(recoveryUs / 1000));
+  }
+  #ifdef DEBUG
+  halLog("Committed imageCtr (%d) to 'eeprom'.\n", imageCtr);
+  #endif
+  phase(PC_PHASE_DONE);
+  leds.play(space.low() ? LP_LOW : LP_SNAP);
+  return PC_SAVED;
+}
+
+bool PinholeCamera::sleepDue() {
+  return clock.millis() - clickedMillis > awakeMillis;
+}
+
+uint32_t PinholeCamera::awakeMillisLeft() {
+  uint32_t awake = clock.millis() - clickedMillis;
+  return awake >= awakeMillis ? 0 : awakeMillis - awake;
+}
+
+uint16_t PinholeCamera::imageCount() const {
+  return imageCtr;
+}
+
+const char *PinholeCamera::lastPath() const {
+  return path;
+}
+
+int64_t PinholeCamera::lastCaptureMicros() const {
+  return captureUs;
+}
+
+int64_t PinholeCamera::lastFrameMicros() const {
+  return frameUs;
+}
+
+int64_t PinholeCamera::lastSavedMicros() const {
+  return savedUs;
+}
+
+int64_t PinholeCamera::lastRecoveryMicros() const {
+  return recoveryUs;
+}
+
+const jmStats_t *PinholeCamera::lastStats() const {
+  return metered ? &stats : nullptr;
+}
+
+uint32_t PinholeCamera::lastMeterMicros() const {
+  return meterUs;
+}
+
+fqVerdict_t PinholeCamera::lastVerdict() const {
+  return verdict;
+}
+
+uint8_t PinholeCamera::lastFrames() const {
+  return stacked;
+}
+
+/**
+ * A stack that doesn't work out costs the frames it took, and then a single frame is taken
+ * the usual way.
+ */
+bool PinholeCamera::take(halFrame_t &frame, int64_t staleMicros, uint8_t frames) {
+  frames = frames > JS_MAX_FRAMES ? JS_MAX_FRAMES : frames;
+  stacked = 0;
+  if (!capture(frame, staleMicros)) {
+    return false;
+  }
+  stacked = 1;
+  if (frames <= 1 || stacker == nullptr) {
+    return true;
+  }
+  if (stack(frame, frames)) {
+    stacked = frames;
+    return true;
+  }
+  halLog("Unable to stack the frames; taking just one.\n");
+  return capture(frame, 0);
+}
+
+/**
+ * Each frame after the first has to have started after the one before it; an older one (a
+ * frame that was waiting in a buffer) is thrown away, up to STALE_MAX_FRAMES of them. The
+ * frame given is released, as is each frame after it once it's added. The average is in the
+ * stacker's buffer, so the frame that says where it is has no handle.
+ */
+bool PinholeCamera::stack(halFrame_t &frame, uint8_t frames) {
+  halFrame_t first = frame;
+  stacker->reset();
+  bool added = stacker->add(frame.buf, frame.len);
+  int64_t lastUs = frame.timestampUs;
+  camera.release(frame);
+  for (uint8_t n = 1; added && n < frames; n++) {
+    bool gotOne = false;
+    for (uint8_t i = 0; i <= STALE_MAX_FRAMES && !gotOne; i++) {
+      if (!camera.grab(frame)) {
+        return false;
+      }
+      gotOne = frame.timestampUs > lastUs;
+      if (!gotOne) {
+        camera.release(frame);
+      }
+    }
+    if (!gotOne) {
+      return false;
+    }
+    added = stacker->add(frame.buf, frame.len);
+    lastUs = frame.timestampUs;
+    camera.release(frame);
+  }
+  size_t len;
+  if (!added || !stacker->finish(len)) {
+    return false;
+  }
+  #ifdef DEBUG
+  halLog("Stacked %u frames into %u bytes.\n", frames, (unsigned)len);
+  #endif
+  frame = first;
+  frame.buf = stacker->jpeg();
+  frame.len = len;
+  frame.handle = nullptr;
+  return true;
+}
+
+void PinholeCamera::giveBack(halFrame_t &frame) {
+  if (frame.handle != nullptr) {
+    camera.release(frame);
+  }
+}
+
+/**
+ * A frame the meter can't make sense of, or runs out of time on, is given the benefit of the
+ * doubt.
+ */
+bool PinholeCamera::judge(const halFrame_t &frame) {
+  metered = false;
+  meterUs = 0;
+  verdict = FQ_GOOD;
+  if (meter == nullptr) {
+    return true;
+  }
+  int64_t meterStartUs = clock.micros();
+  metered = meter->meter(frame.buf, frame.len, stats);
+  meterUs = (uint32_t)(clock.micros() - meterStartUs);
+  if (!metered) {
+    halLog(meter->timedOut() ? "Metering the frame took too long.\n" : "Unable to meter the frame.\n");
+    return true;
+  }
+  if (gate == PC_GATE_OFF) {
+    return true;
+  }
+  verdict = fqJudge(stats, minFine);
+  if (verdict == FQ_GOOD) {
+    return true;
+  }
+  halLog("The picture looks %s.\n", fqName(verdict));
+  return gate == PC_GATE_FLAG;
+}
+
+/**
+ * Waits PC_BACKOFF_MILLIS before the first retry, twice that before the next and so on, to
+ * give a camera that's only busy a chance to catch up. If it still won't deliver, restarts it
+ * and tries once more. Only asks for a fresh frame the first time; by the time of a retry,
+ * any frame is later than the click.
+ */
+bool PinholeCamera::capture(halFrame_t &frame, int64_t staleMicros) {
+  uint32_t backoffMillis = PC_BACKOFF_MILLIS;
+  for (uint8_t tries = 0; tries < PC_CAPTURE_TRIES; tries++) {
+    int64_t tryUs = clock.micros();
+    if (camera.get(frame, tries == 0 ? staleMicros : 0)) {
+      return true;
+    }
+    trouble(tryUs);
+    if (tries + 1 < PC_CAPTURE_TRIES) {
+      halLog("No frame from the camera; trying again in %u ms.\n", (unsigned)backoffMillis);
+      clock.delay(backoffMillis);
+      backoffMillis *= 2;
+    }
+  }
+  halLog("Restarting the camera.\n");
+  if (!camera.restart()) {
+    return false;
+  }
+  return camera.get(frame, 0);
+}
+
+void PinholeCamera::trouble(int64_t sinceMicros) {
+  if (troubleUs == 0) {
+    troubleUs = sinceMicros;
+  }
+}
+
+/**
+ * Done by hand rather than with snprintf() or String, so saving a picture never touches the
+ * heap. path has room for the longest one, "/Image65535.jpg".
+ */
+const char *PinholeCamera::makePath(uint16_t imageNumber) {
+  static const char prefix[] = "/Image";
+  static const char suffix[] = ".jpg";
+  char digits[5];
+  uint8_t nDigits = 0;
+  do {
+    digits[nDigits++] = (char)('0' + imageNumber % 10);
+    imageNumber /= 10;
+  } while (imageNumber != 0);
+  char *p = path;
+  for (const char *s = prefix; *s != '\0'; s++) {
+    *p++ = *s;
+  }
+  while (nDigits > 0) {
+    *p++ = digits[--nDigits];
+  }
+  for (const char *s = suffix; *s != '\0'; s++) {
+    *p++ = *s;
+  }
+  *p = '\0';
+  return path;
+}
+
+void PinholeCamera::phase(pcPhase_t p) {
+  if (phaseHandler != nullptr) {
+    phaseHandler(p);
+  }
+}
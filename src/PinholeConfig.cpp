@@ -0,0 +1,194 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * PinholeConfig.cpp
+ *
+ * Implementation of the /pinhole.cfg parser. See PinholeConfig.h for the settings.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "PinholeConfig.h"
+#include "Hal.h"
+#include "OpticalProfiles.h"
+#include <string.h>
+
+static const char *const frameSizeNames[] = {"qvga", "cif", "vga", "svga", "xga", "sxga", "uxga"};
+static const char *const grabModeNames[] = {"when_empty", "latest"};
+static const char *const yesNoNames[] = {"no", "yes"};
+static const char *const gateNames[] = {"off", "flag", "skip", "retake"};
+
+void cfDefaults(cfSettings_t &settings) {
+  settings.frameSize = CF_FRAMESIZE_UXGA;
+  settings.jpegQuality = 10;
+  settings.fbCount = 2;
+  settings.grabMode = CF_GRAB_LATEST;
+  settings.xclkHz = 20000000;
+  settings.awakeMillis = 300000;
+  settings.doze = true;
+  settings.sensorOff = false;
+  settings.profile = 0;
+  settings.gate = CF_GATE_FLAG;
+  settings.dimFrameSize = CF_FRAMESIZE_SVGA;
+  settings.dimFrames = 4;
+}
+
+/**
+ * @brief Whether c is a space, a tab or the \r of a \r\n
+ */
+static bool isBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * @brief Copy the token from text up to end, less leading and trailing blanks, into out
+ *
+ * @return false  It's empty or too long
+ */
+static bool token(const char *text, const char *end, char (&out)[CF_TOKEN_LEN]) {
+  while (text < end && isBlank(*text)) {
+    text++;
+  }
+  while (end > text && isBlank(end[-1])) {
+    end--;
+  }
+  if (end == text || end - text >= CF_TOKEN_LEN) {
+    return false;
+  }
+  memcpy(out, text, end - text);
+  out[end - text] = '\0';
+  return true;
+}
+
+/**
+ * @brief Look value up in names and put its index in choice
+ *
+ * @return false  It isn't one of them
+ */
+template <typename T>
+static bool choose(const char *value, const char *const names[], uint8_t nNames, T &choice) {
+  for (uint8_t i = 0; i < nNames; i++) {
+    if (strcmp(value, names[i]) == 0) {
+      choice = (T)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Put value, a decimal number from min to max, in result
+ *
+ * @return false  It isn't one
+ */
+template <typename T>
+static bool number(const char *value, uint32_t min, uint32_t max, T &result) {
+  uint32_t n = 0;
+  for (const char *c = value; *c != '\0'; c++) {
+    if (*c < '0' || *c > '9' || n > (UINT32_MAX - 9) / 10) {
+      return false;
+    }
+    n = n * 10 + (uint32_t)(*c - '0');
+  }
+  if (n < min || n > max) {
+    return false;
+  }
+  result = (T)n;
+  return true;
+}
+
+/**
+ * @brief Apply one setting
+ *
+ * @return false  The key or the value doesn't make sense
+ */
+static bool apply(const char *key, const char *value, cfSettings_t &settings) {
+  if (strcmp(key, "framesize") == 0) {
+    return choose(value, frameSizeNames, 7, settings.frameSize);
+  }
+  if (strcmp(key, "jpeg_quality") == 0) {
+    return number(value, 0, 63, settings.jpegQuality);
+  }
+  if (strcmp(key, "fb_count") == 0) {
+    return number(value, 1, 3, settings.fbCount);
+  }
+  if (strcmp(key, "grab_mode") == 0) {
+    return choose(value, grabModeNames, 2, settings.grabMode);
+  }
+  if (strcmp(key, "xclk_freq_hz") == 0) {
+    return number(value, 8000000, 20000000, settings.xclkHz);
+  }
+  if (strcmp(key, "awake_millis") == 0) {
+    return number(value, 10000, 86400000, settings.awakeMillis);
+  }
+  if (strcmp(key, "doze") == 0) {
+    return choose(value, yesNoNames, 2, settings.doze);
+  }
+  if (strcmp(key, "sensor_off") == 0) {
+    return choose(value, yesNoNames, 2, settings.sensorOff);
+  }
+  if (strcmp(key, "profile") == 0) {
+    int profile = OpticalProfiles::find(value);
+    if (profile < 0) {
+      return false;
+    }
+    settings.profile = (uint8_t)profile;
+    return true;
+  }
+  if (strcmp(key, "quality_gate") == 0) {
+    return choose(value, gateNames, 4, settings.gate);
+  }
+  if (strcmp(key, "dim_framesize") == 0) {
+    return choose(value, frameSizeNames, CF_FRAMESIZE_SVGA + 1, settings.dimFrameSize);
+  }
+  if (strcmp(key, "dim_frames") == 0) {
+    return number(value, 1, 8, settings.dimFrames);
+  }
+  return false;
+}
+
+/**
+ * One pass over the text. Each line is cut at its # (if any) and its =, and the key and
+ * value copied out only once they're known to be short enough to be worth looking at.
+ */
+int cfParse(const char *text, size_t len, cfSettings_t &settings) {
+  const char *end = text + len;
+  int errors = 0;
+  unsigned lineNo = 0;
+  for (const char *line = text; line < end; ) {
+    lineNo++;
+    const char *eol = (const char *)memchr(line, '\n', end - line);
+    if (eol == nullptr) {
+      eol = end;
+    }
+    const char *hash = (const char *)memchr(line, '#', eol - line);
+    const char *stop = hash == nullptr ? eol : hash;
+    const char *c = line;
+    while (c < stop && isBlank(*c)) {
+      c++;
+    }
+    while (stop > c && isBlank(stop[-1])) {
+      stop--;
+    }
+    if (c < stop) {
+      const char *eq = (const char *)memchr(c, '=', stop - c);
+      char key[CF_TOKEN_LEN];
+      char value[CF_TOKEN_LEN];
+      if (eq == nullptr || !token(c, eq, key) || !token(eq + 1, stop, value) ||
+        !apply(key, value, settings)) {
+        halLog(CF_PATH ":%u: don't understand '%.*s'; ignoring it.\n", lineNo, (int)(stop - c), c);
+        errors++;
+      }
+    }
+    line = eol + 1;
+  }
+  return errors;
+}
+
+bool cfSameCamera(const cfSettings_t &a, const cfSettings_t &b) {
+  return a.frameSize == b.frameSize && a.jpegQuality == b.jpegQuality && a.fbCount == b.fbCount &&
+    a.grabMode == b.grabMode && a.xclkHz == b.xclkHz;
+}
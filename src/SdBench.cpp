@@ -0,0 +1,331 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * SdBench.cpp
+ *
+ * Implementation of the on-device SD card benchmark. See SdBench.h for what it does.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "SdBench.h"
+#include "FS.h"                                   // File system
+#include "SD_MMC.h"                               // SD Card support
+#include "ff.h"                                   // FatFs, for the cluster size
+
+#define SD_BENCH_MAX_ROWS   (16)                    // Max result rows per bus width
+#define SD_BENCH_FRAME_BYTES (163840UL)             // Rough size of a UXGA, quality 10 image
+#define SD_BENCH_SEQ_FILE   "/sdb_seq.tmp"          // Scratch file for the seq and sustained tests
+#define SD_BENCH_FAT_FILE   "/sdb_fat.tmp"          // Scratch file for the fat test
+
+// The chunk sizes used in the sequential write test; the largest is only used with PSRAM
+static const uint32_t seqChunks[] = {512, 4096, 16384, 32768, 65536};
+
+// One line of results
+struct benchRow_t {
+  const char *test;                               // Which test
+  uint32_t param;                                 // Chunk size, file count, etc.
+  uint32_t bytes;                                 // Bytes written
+  uint32_t ms;                                    // Total time taken
+  uint32_t meanUs;                                // Mean latency per operation
+  uint32_t maxUs;                                 // Worst latency of any operation
+  uint32_t stalls;                                // Number of operations counted as stalls
+};
+
+static benchRow_t rows[SD_BENCH_MAX_ROWS];        // The results for the bus width being run
+static uint8_t nRows;                             // How many of rows[] are in use
+static uint8_t *buf;                              // The buffer we write from
+static uint32_t bufLen;                           // How big buf is
+
+/**
+ * @brief Record a result row and print it
+ */
+static void addRow(const char *test, uint32_t param, uint32_t bytes, uint32_t ms,
+  uint32_t meanUs, uint32_t maxUs, uint32_t stalls) {
+  Serial.printf("  %-9s %6u: %8u bytes in %6u ms (%5u KiB/s), mean %7u us, max %7u us, stalls %u\n",
+    test, param, bytes, ms, ms == 0 ? 0 : (uint32_t)((uint64_t)bytes * 1000 / 1024 / ms),
+    meanUs, maxUs, stalls);
+  if (nRows < SD_BENCH_MAX_ROWS) {
+    rows[nRows++] = {test, param, bytes, ms, meanUs, maxUs, stalls};
+  }
+}
+
+/**
+ * @brief The allocation unit (cluster) size of the mounted card, or 0 if unknown
+ */
+static uint32_t clusterBytes() {
+  FATFS *fs;
+  DWORD freeClusters;
+  if (f_getfree("0:", &freeClusters, &fs) != FR_OK) {
+    return 0;
+  }
+  #if FF_MAX_SS != 512
+  return (uint32_t)fs->csize * fs->ssize;
+  #else
+  return (uint32_t)fs->csize * 512;
+  #endif
+}
+
+/**
+ * @brief Sequential write of SD_BENCH_SEQ_BYTES in chunks of chunkLen bytes
+ */
+static bool seqTest(uint32_t chunkLen) {
+  File f = SD_MMC.open(SD_BENCH_SEQ_FILE, FILE_WRITE);
+  if (!f) {
+    Serial.print("Unable to create the sequential test file.\n");
+    return false;
+  }
+  uint32_t maxUs = 0;
+  uint32_t nChunks = SD_BENCH_SEQ_BYTES / chunkLen;
+  unsigned long startMillis = millis();
+  for (uint32_t i = 0; i < nChunks; i++) {
+    unsigned long startMicros = micros();
+    if (f.write(buf, chunkLen) != chunkLen) {
+      Serial.print("Short write in the sequential test.\n");
+      f.close();
+      return false;
+    }
+    uint32_t us = micros() - startMicros;
+    if (us > maxUs) {
+      maxUs = us;
+    }
+  }
+  f.close();
+  uint32_t ms = millis() - startMillis;
+  addRow("seq", chunkLen, nChunks * chunkLen, ms, ms * 1000 / nChunks, maxUs, 0);
+  SD_MMC.remove(SD_BENCH_SEQ_FILE);
+  return true;
+}
+
+/**
+ * @brief Latency of creating (opening for write and closing) SD_BENCH_CREATES small files
+ */
+static bool createTest() {
+  char path[16];
+  uint32_t totalUs = 0;
+  uint32_t maxUs = 0;
+  unsigned long startMillis = millis();
+  for (uint8_t i = 0; i < SD_BENCH_CREATES; i++) {
+    snprintf(path, sizeof(path), "/sdb_c%02u.tmp", i);
+    unsigned long startMicros = micros();
+    File f = SD_MMC.open(path, FILE_WRITE);
+    if (!f) {
+      Serial.print("Unable to create a file in the create test.\n");
+      return false;
+    }
+    f.close();
+    uint32_t us = micros() - startMicros;
+    totalUs += us;
+    if (us > maxUs) {
+      maxUs = us;
+    }
+  }
+  addRow("create", SD_BENCH_CREATES, 0, millis() - startMillis, totalUs / SD_BENCH_CREATES, maxUs, 0);
+  for (uint8_t i = 0; i < SD_BENCH_CREATES; i++) {
+    snprintf(path, sizeof(path), "/sdb_c%02u.tmp", i);
+    SD_MMC.remove(path);
+  }
+  return true;
+}
+
+/**
+ * @brief Cost of a FAT / directory entry update: time a cluster-by-cluster write with and
+ * without a flush after each cluster. The difference per cluster is the update cost.
+ */
+static bool fatTest() {
+  uint32_t cluster = clusterBytes();
+  if (cluster == 0 || cluster > bufLen) {
+    Serial.printf("Skipping fat test; cluster size %u isn't usable.\n", cluster);
+    return true;
+  }
+  uint32_t us[2];
+  uint32_t maxUs = 0;
+  for (uint8_t flush = 0; flush < 2; flush++) {
+    File f = SD_MMC.open(SD_BENCH_FAT_FILE, FILE_WRITE);
+    if (!f) {
+      Serial.print("Unable to create the fat test file.\n");
+      return false;
+    }
+    unsigned long startMicros = micros();
+    for (uint8_t i = 0; i < SD_BENCH_FAT_FLUSHES; i++) {
+      unsigned long opMicros = micros();
+      if (f.write(buf, cluster) != cluster) {
+        Serial.print("Card full or write failed; fat test cut short.\n");
+        f.close();
+        SD_MMC.remove(SD_BENCH_FAT_FILE);
+        return false;
+      }
+      if (flush) {
+        f.flush();
+        uint32_t opUs = micros() - opMicros;
+        if (opUs > maxUs) {
+          maxUs = opUs;
+        }
+      }
+    }
+    us[flush] = micros() - startMicros;
+    f.close();
+    SD_MMC.remove(SD_BENCH_FAT_FILE);
+  }
+  uint32_t perUpdate = us[1] > us[0] ? (us[1] - us[0]) / SD_BENCH_FAT_FLUSHES : 0;
+  addRow("fat", cluster, cluster * SD_BENCH_FAT_FLUSHES, us[1] / 1000, perUpdate, maxUs, 0);
+  return true;
+}
+
+/**
+ * @brief Sustained write of SD_BENCH_SUS_BYTES, timing every chunk so that garbage
+ * collection stalls inside the card show up as outliers
+ */
+static bool sustainedTest() {
+  uint32_t nChunks = SD_BENCH_SUS_BYTES / SD_BENCH_SUS_CHUNK;
+  uint32_t *chunkUs = (uint32_t *)malloc(nChunks * sizeof(uint32_t));
+  if (chunkUs == nullptr) {
+    Serial.print("Not enough memory for the sustained test.\n");
+    return false;
+  }
+  File f = SD_MMC.open(SD_BENCH_SEQ_FILE, FILE_WRITE);
+  if (!f) {
+    Serial.print("Unable to create the sustained test file.\n");
+    free(chunkUs);
+    return false;
+  }
+  uint32_t written = 0;
+  unsigned long startMillis = millis();
+  for (uint32_t i = 0; i < nChunks; i++) {
+    unsigned long startMicros = micros();
+    if (f.write(buf, SD_BENCH_SUS_CHUNK) != SD_BENCH_SUS_CHUNK) {
+      Serial.print("Card full or write failed; sustained test cut short.\n");
+      nChunks = i;
+      break;
+    }
+    chunkUs[i] = micros() - startMicros;
+    written += SD_BENCH_SUS_CHUNK;
+  }
+  f.close();
+  uint32_t ms = millis() - startMillis;
+  SD_MMC.remove(SD_BENCH_SEQ_FILE);
+  if (nChunks == 0) {
+    free(chunkUs);
+    return false;
+  }
+
+  // Sorting a copy for the median would cost another buffer, so binary search on the value instead,
+  // counting the chunks at or under each guess
+  uint32_t maxUs = 0;
+  uint64_t totalUs = 0;
+  for (uint32_t i = 0; i < nChunks; i++) {
+    totalUs += chunkUs[i];
+    if (chunkUs[i] > maxUs) {
+      maxUs = chunkUs[i];
+    }
+  }
+  uint32_t lo = 0;
+  uint32_t hi = maxUs;
+  while (lo < hi) {                               // Binary search for the median value
+    uint32_t mid = lo + (hi - lo) / 2;
+    uint32_t nBelow = 0;
+    for (uint32_t i = 0; i < nChunks; i++) {
+      if (chunkUs[i] <= mid) {
+        nBelow++;
+      }
+    }
+    if (nBelow * 2 >= nChunks) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  uint32_t stalls = 0;
+  for (uint32_t i = 0; i < nChunks; i++) {
+    if (chunkUs[i] > lo * SD_BENCH_STALL_X) {
+      stalls++;
+    }
+  }
+  free(chunkUs);
+  addRow("sustained", SD_BENCH_SUS_CHUNK, written, ms, (uint32_t)(totalUs / nChunks), maxUs, stalls);
+  if (ms > 0) {
+    uint32_t bytesPerSec = (uint32_t)((uint64_t)written * 1000 / ms);
+    Serial.printf("  Sustained rate is about %u.%u UXGA images/s; worst stall %u ms.\n",
+      bytesPerSec * 10 / SD_BENCH_FRAME_BYTES / 10, bytesPerSec * 10 / SD_BENCH_FRAME_BYTES % 10,
+      maxUs / 1000);
+  }
+  return true;
+}
+
+/**
+ * @brief Run the tests at the currently mounted bus width, leaving the results in rows[]
+ */
+static bool runSuite() {
+  nRows = 0;
+  for (uint8_t i = 0; i < sizeof(seqChunks) / sizeof(seqChunks[0]); i++) {
+    if (seqChunks[i] <= bufLen && !seqTest(seqChunks[i])) {
+      return false;
+    }
+  }
+  return createTest() && fatTest() && sustainedTest();
+}
+
+/**
+ * @brief Append the rows[] for the given bus width to SD_BENCH_CSV
+ */
+static bool writeCsv(uint8_t busWidth) {
+  bool exists = SD_MMC.exists(SD_BENCH_CSV);
+  File f = SD_MMC.open(SD_BENCH_CSV, FILE_APPEND);
+  if (!f) {
+    Serial.print("Unable to open " SD_BENCH_CSV ".\n");
+    return false;
+  }
+  if (!exists) {
+    f.print("card_type,card_mib,bus_width,test,param,bytes,ms,kib_per_s,mean_us,max_us,stalls\n");
+  }
+  static const char *typeNames[] = {"none", "mmc", "sd", "sdhc", "unknown"};
+  uint8_t cardType = SD_MMC.cardType();
+  const char *typeName = typeNames[cardType < 4 ? cardType : 4];
+  uint32_t cardMib = (uint32_t)(SD_MMC.cardSize() / 1048576ULL);
+  for (uint8_t i = 0; i < nRows; i++) {
+    benchRow_t &r = rows[i];
+    f.printf("%s,%u,%u,%s,%u,%u,%u,%u,%u,%u,%u\n", typeName, cardMib, busWidth, r.test, r.param,
+      r.bytes, r.ms, r.ms == 0 ? 0 : (uint32_t)((uint64_t)r.bytes * 1000 / 1024 / r.ms),
+      r.meanUs, r.maxUs, r.stalls);
+  }
+  f.close();
+  return true;
+}
+
+bool runSdBench() {
+  bufLen = psramFound() ? 65536 : 32768;
+  buf = (uint8_t *)(psramFound() ? ps_malloc(bufLen) : malloc(bufLen));
+  if (buf == nullptr) {
+    Serial.print("Not enough memory for the SD benchmark buffer.\n");
+    return false;
+  }
+  for (uint32_t i = 0; i < bufLen; i++) {
+    buf[i] = (uint8_t)i;
+  }
+
+  bool ok = true;
+  for (uint8_t busWidth = 1; ok && busWidth <= 4; busWidth += 3) {
+    if (busWidth == 4) {
+      SD_MMC.end();
+      if (!SD_MMC.begin("/sdcard", false)) {
+        Serial.print("Card won't mount in 4-bit mode; skipping it.\n");
+        break;
+      }
+    }
+    Serial.printf("SD benchmark, %u-bit mode:\n", busWidth);
+    ok = runSuite() && writeCsv(busWidth);
+  }
+
+  // Put things back the way the camera expects them
+  SD_MMC.end();
+  if (!SD_MMC.begin("/sdcard", true)) {
+    Serial.print("Card won't remount in 1-bit mode.\n");
+    ok = false;
+  }
+  free(buf);
+  buf = nullptr;
+  return ok;
+}
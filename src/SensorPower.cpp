@@ -0,0 +1,151 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * SensorPower.cpp
+ *
+ * Implementation of sensor power-down with register snapshot restore. See SensorPower.h for 
+ * what it does.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "SensorPower.h"
+
+// OV2640 register addressing as the camera driver's get_reg() and set_reg() use it: the
+// register bank in bit 8, the register address in the low byte
+#define SP_BANK_DSP       (0x000)                   // DSP bank
+#define SP_BANK_SENSOR    (0x100)                   // Sensor bank
+#define SP_R_BYPASS       (0x05)                    // DSP bypass; on while the DSP is being set up
+#define SP_GAIN           (0x00)                    // Sensor AGC gain
+#define SP_REG04          (0x04)                    // Sensor mirror, flip and AEC low bits
+#define SP_AEC            (0x10)                    // Sensor AEC middle bits
+#define SP_COM8           (0x13)                    // Sensor AEC and AGC on / off
+#define SP_REG45          (0x45)                    // Sensor AEC high bits
+#define SP_COM8_AGC       (0x04)                    // COM8: AGC on
+#define SP_COM8_AEC       (0x01)                    // COM8: AEC on
+
+// The directly addressed registers anything changes after the driver's reset(): its frame
+// size, quality and exposure setters, set_res_raw() and our clock divider. Sensor bank first,
+// in address order, so COM7 goes before the window it resets.
+static const uint16_t spRegs[] = {
+  SP_BANK_SENSOR | 0x00, SP_BANK_SENSOR | 0x03, SP_BANK_SENSOR | 0x04, SP_BANK_SENSOR | 0x10,
+  SP_BANK_SENSOR | 0x11, SP_BANK_SENSOR | 0x12, SP_BANK_SENSOR | 0x13, SP_BANK_SENSOR | 0x14,
+  SP_BANK_SENSOR | 0x17, SP_BANK_SENSOR | 0x18, SP_BANK_SENSOR | 0x19, SP_BANK_SENSOR | 0x1A,
+  SP_BANK_SENSOR | 0x24, SP_BANK_SENSOR | 0x25, SP_BANK_SENSOR | 0x26, SP_BANK_SENSOR | 0x2A,
+  SP_BANK_SENSOR | 0x2B, SP_BANK_SENSOR | 0x2D, SP_BANK_SENSOR | 0x2E, SP_BANK_SENSOR | 0x32,
+  SP_BANK_SENSOR | 0x3D, SP_BANK_SENSOR | 0x45, SP_BANK_SENSOR | 0x46, SP_BANK_SENSOR | 0x47,
+  SP_BANK_SENSOR | 0x4F, SP_BANK_SENSOR | 0x50,
+  SP_BANK_DSP | 0x44, SP_BANK_DSP | 0x50, SP_BANK_DSP | 0x51, SP_BANK_DSP | 0x52,
+  SP_BANK_DSP | 0x53, SP_BANK_DSP | 0x54, SP_BANK_DSP | 0x55, SP_BANK_DSP | 0x56,
+  SP_BANK_DSP | 0x57, SP_BANK_DSP | 0x5A, SP_BANK_DSP | 0x5B, SP_BANK_DSP | 0x5C,
+  SP_BANK_DSP | 0x86, SP_BANK_DSP | 0x87, SP_BANK_DSP | 0x8C, SP_BANK_DSP | 0xC0,
+  SP_BANK_DSP | 0xC1, SP_BANK_DSP | 0xC2, SP_BANK_DSP | 0xC3, SP_BANK_DSP | 0xC7,
+  SP_BANK_DSP | 0xCC, SP_BANK_DSP | 0xCD, SP_BANK_DSP | 0xCE, SP_BANK_DSP | 0xD3,
+  SP_BANK_DSP | 0xDA
+};
+#define SP_N_REGS         (sizeof(spRegs) / sizeof(spRegs[0]))
+
+static uint8_t snapshot[SP_N_REGS];               // What the registers in spRegs were
+static bool haveSnapshot = false;                 // Whether the snapshot is any good
+
+/**
+ * @brief The bits of a register that should read back as they were written. The exposure and
+ * gain registers are the sensor's own to change while its automatic control of them is on.
+ */
+static uint8_t checkMask(uint16_t reg, uint8_t com8) {
+  bool aec = (com8 & SP_COM8_AEC) != 0;
+  bool agc = (com8 & SP_COM8_AGC) != 0;
+  switch (reg) {
+    case SP_BANK_SENSOR | SP_GAIN:
+      return agc ? 0x00 : 0xFF;
+    case SP_BANK_SENSOR | SP_AEC:
+    case SP_BANK_SENSOR | SP_REG45:
+      return aec ? 0x00 : 0xFF;
+    case SP_BANK_SENSOR | SP_REG04:
+      return aec ? 0xFC : 0xFF;
+    default:
+      return 0xFF;
+  }
+}
+
+/**
+ * @brief Read the registers in spRegs into the snapshot. Taken afresh at every power-down, so
+ * whatever was changed since the last one (a new profile's exposure level, lens correction or
+ * window, the dim frame size) is what comes back.
+ */
+static bool takeSnapshot(sensor_t *s) {
+  for (size_t i = 0; i < SP_N_REGS; i++) {
+    int value = s->get_reg(s, spRegs[i], 0xFF);
+    if (value < 0) {
+      return false;
+    }
+    snapshot[i] = (uint8_t)value;
+  }
+  return true;
+}
+
+/**
+ * @brief Put the sensor back. The registers behind the indirect address / data pairs (the
+ * DSP's 0x7C / 0x7D special digital effects and the driver's other init tables) can't be read
+ * out, so they're rebuilt the way they were first set: the driver's reset() and
+ * set_pixformat() load its tables, and the setters that use the pairs are run again from the
+ * driver's status. The snapshot goes on top, the DSP bypassed until it's done.
+ */
+static bool restoreSnapshot(sensor_t *s) {
+  bool ok = s->reset(s) == 0 && s->set_pixformat(s, s->pixformat) == 0;
+  ok = ok && s->set_reg(s, SP_BANK_DSP | SP_R_BYPASS, 0xFF, 0x01) == 0;
+  for (size_t i = 0; i < SP_N_REGS && ok; i++) {
+    ok = s->set_reg(s, spRegs[i], 0xFF, snapshot[i]) == 0;
+  }
+  ok = ok && s->set_reg(s, SP_BANK_DSP | SP_R_BYPASS, 0xFF, 0x00) == 0;
+  return ok && s->set_brightness(s, s->status.brightness) == 0 &&
+    s->set_contrast(s, s->status.contrast) == 0 && s->set_saturation(s, s->status.saturation) == 0 &&
+    s->set_special_effect(s, s->status.special_effect) == 0;
+}
+
+/**
+ * @brief Whether every register in spRegs reads back as it was
+ */
+static bool checkSnapshot(sensor_t *s) {
+  uint8_t com8 = 0;
+  for (size_t i = 0; i < SP_N_REGS; i++) {
+    if (spRegs[i] == (SP_BANK_SENSOR | SP_COM8)) {
+      com8 = snapshot[i];
+    }
+  }
+  for (size_t i = 0; i < SP_N_REGS; i++) {
+    uint8_t mask = checkMask(spRegs[i], com8);
+    int value = s->get_reg(s, spRegs[i], 0xFF);
+    if (value < 0 || ((value ^ snapshot[i]) & mask) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool sensorPowerDown(gpio_num_t pwdnPin) {
+  sensor_t *s = esp_camera_sensor_get();
+  if (s == nullptr) {
+    return false;
+  }
+  haveSnapshot = takeSnapshot(s);
+  if (!haveSnapshot) {
+    return false;
+  }
+  digitalWrite(pwdnPin, HIGH);
+  return true;
+}
+
+bool sensorPowerUp(gpio_num_t pwdnPin) {
+  digitalWrite(pwdnPin, LOW);
+  delay(SENSOR_SETTLE_MILLIS);
+  sensor_t *s = esp_camera_sensor_get();
+  return s != nullptr && haveSnapshot && restoreSnapshot(s) && checkSnapshot(s);
+}
+
+void sensorForgetSnapshot() {
+  haveSnapshot = false;
+}
@@ -0,0 +1,152 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * HalLinux.cpp
+ *
+ * The Linux implementations of the hardware abstraction layer. See HalLinux.h.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "HalLinux.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+static FILE *logStream = stdout;                  // Where halLog() prints
+
+void halLog(const char *format, ...) {
+  if (logStream == nullptr) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  vfprintf(logStream, format, args);
+  va_end(args);
+}
+
+void halLogTo(FILE *stream) {
+  logStream = stream;
+}
+
+LinuxLed::LinuxLed(SimTrace *trace) : trace(trace) {
+}
+
+void LinuxLed::set(bool on) {
+  if (on && !isOn) {
+    flashCount++;
+  }
+  if (on != isOn && trace != nullptr) {
+    trace->add("led", on ? "on" : "off");
+  }
+  isOn = on;
+}
+
+uint32_t LinuxLed::flashes() const {
+  return flashCount;
+}
+
+/**
+ * None of the storage or counter operations allocate memory, so they don't get in the way of
+ * checking that the capture path doesn't either.
+ */
+LinuxStorage::LinuxStorage(const char *root) {
+  snprintf(this->root, sizeof(this->root), "%s", root);
+}
+
+int LinuxStorage::open(const char *path) {
+  for (int i = 0; i < HAL_MAX_FILES; i++) {
+    if (fds[i] < 0) {
+      fds[i] = ::open(localPath(path), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      return fds[i] < 0 ? -1 : i;
+    }
+  }
+  return -1;
+}
+
+size_t LinuxStorage::write(int handle, const uint8_t *buf, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = ::write(fds[handle], buf + done, len - done);
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+  return done;
+}
+
+bool LinuxStorage::close(int handle) {
+  int err = ::close(fds[handle]);
+  fds[handle] = -1;
+  return err == 0;
+}
+
+bool LinuxStorage::exists(const char *path) {
+  struct stat st;
+  return stat(localPath(path), &st) == 0;
+}
+
+/**
+ * There's nothing to mount; the directory is always there.
+ */
+bool LinuxStorage::remount() {
+  return true;
+}
+
+bool LinuxStorage::capacity(uint64_t &totalBytes, uint64_t &freeBytes, uint32_t &blockBytes) {
+  struct statvfs sv;
+  if (statvfs(root, &sv) != 0) {
+    return false;
+  }
+  totalBytes = (uint64_t)sv.f_blocks * sv.f_frsize;
+  freeBytes = (uint64_t)sv.f_bavail * sv.f_frsize;
+  blockBytes = (uint32_t)sv.f_frsize;
+  return true;
+}
+
+const char *LinuxStorage::localPath(const char *path) {
+  snprintf(local, sizeof(local), "%s%s", root, path);
+  return local;
+}
+
+LinuxCounter::LinuxCounter(const char *dir) {
+  snprintf(path, sizeof(path), "%s/" HAL_COUNTER_FILE, dir);
+}
+
+uint16_t LinuxCounter::read() {
+  if (!loaded) {
+    char text[8] = "";
+    int fd = ::open(path, O_RDONLY);
+    if (fd >= 0) {
+      ssize_t n = ::read(fd, text, sizeof(text) - 1);
+      text[n > 0 ? n : 0] = '\0';
+      ::close(fd);
+    }
+    value = (uint16_t)strtoul(text, nullptr, 10);
+    loaded = true;
+  }
+  return value;
+}
+
+void LinuxCounter::write(uint16_t value) {
+  this->value = value;
+  loaded = true;
+}
+
+bool LinuxCounter::commit() {
+  char text[8];
+  int len = snprintf(text, sizeof(text), "%u\n", (unsigned)value);
+  int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = ::write(fd, text, len) == len;
+  return ::close(fd) == 0 && ok;
+}
@@ -0,0 +1,92 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * HalLinux.h
+ *
+ * Linux implementations of the hardware abstraction layer in Hal.h, for running the capture 
+ * and save logic on a PC: an LED that counts its flashes, storage in a directory, and an 
+ * image counter kept in a file in that directory. The clock, shutter and camera are 
+ * simulated; see VirtualClock.h, SimButton.h and SimCamera.h.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include <stdio.h>
+#include "Hal.h"
+#include "SimTrace.h"
+
+#define HAL_MAX_FILES     (2)                       // Max files open at once
+#define HAL_COUNTER_FILE  ".imagectr"               // Where LinuxCounter keeps the image counter
+#define HAL_LOCAL_PATH_LEN (256)                    // Longest local path
+
+/**
+ * @brief Have halLog() print to the given stream (stdout to begin with), or nowhere if nullptr
+ */
+void halLogTo(FILE *stream);
+
+class LinuxLed : public HalLed {
+  public:
+    /**
+     * @brief An LED that records what it does in trace if there is one
+     */
+    LinuxLed(SimTrace *trace = nullptr);
+    void set(bool on) override;
+
+    /**
+     * @brief The number of times the LED has been turned on
+     */
+    uint32_t flashes() const;
+
+  private:
+    SimTrace *trace;
+    bool isOn = false;
+    uint32_t flashCount = 0;
+};
+
+class LinuxStorage : public HalStorage {
+  public:
+    /**
+     * @brief Storage in the given (existing) directory; "/Image1.jpg" is root/Image1.jpg
+     */
+    LinuxStorage(const char *root);
+    int open(const char *path) override;
+    size_t write(int handle, const uint8_t *buf, size_t len) override;
+    bool close(int handle) override;
+    bool exists(const char *path) override;
+    bool remount() override;
+
+    /**
+     * @brief The capacity, free space and block size of the file system root is on
+     */
+    bool capacity(uint64_t &totalBytes, uint64_t &freeBytes, uint32_t &blockBytes);
+
+    /**
+     * @brief The local path for the given storage path; good until the next call
+     */
+    const char *localPath(const char *path);
+
+  private:
+    char root[HAL_LOCAL_PATH_LEN];
+    char local[HAL_LOCAL_PATH_LEN];               // The last localPath()
+    int fds[HAL_MAX_FILES] = {-1, -1};
+};
+
+class LinuxCounter : public HalCounter {
+  public:
+    /**
+     * @brief A counter kept in HAL_COUNTER_FILE in the given directory
+     */
+    LinuxCounter(const char *dir);
+    uint16_t read() override;
+    void write(uint16_t value) override;
+    bool commit() override;
+
+  private:
+    char path[HAL_LOCAL_PATH_LEN];
+    uint16_t value = 0;
+    bool loaded = false;
+};
@@ -0,0 +1,79 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * SimButton.cpp
+ *
+ * Implementation of the simulated shutter switch. See SimButton.h.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "SimButton.h"
+
+SimButton::SimButton(VirtualClock &clock, SimTrace *trace) : clock(clock), trace(trace) {
+}
+
+void SimButton::begin() {
+  begun = true;
+  edges.clear();
+  startDecoding(down);
+}
+
+bool SimButton::isDown() {
+  return down;
+}
+
+void SimButton::press(int64_t atMicros) {
+  move(atMicros, true);
+}
+
+void SimButton::release(int64_t atMicros) {
+  move(atMicros, false);
+}
+
+void SimButton::click(int64_t atMicros, uint32_t holdMillis) {
+  press(atMicros);
+  release(atMicros + (int64_t)holdMillis * 1000);
+}
+
+bool SimButton::nextEdge(halEdge_t &edge) {
+  return edges.get(edge);
+}
+
+/**
+ * The contacts meet (or part), bounce apart SIM_BOUNCES times and settle. Pressing a switch
+ * that's already pressed, or releasing one that isn't, does nothing.
+ */
+void SimButton::move(int64_t atMicros, bool toDown) {
+  clock.at(atMicros, [this, toDown]() {
+    if (pressed == toDown) {
+      return;
+    }
+    pressed = toDown;
+    if (trace != nullptr) {
+      trace->add("shutter", toDown ? "down" : "up");
+    }
+    int64_t nowUs = clock.micros();
+    level(toDown);
+    for (int i = 1; i <= SIM_BOUNCES; i++) {
+      int64_t bounceUs = nowUs + (int64_t)(2 * i - 1) * SIM_BOUNCE_US;
+      clock.at(bounceUs, [this, toDown]() { level(!toDown); });
+      clock.at(bounceUs + SIM_BOUNCE_US, [this, toDown]() { level(toDown); });
+    }
+    int64_t settledUs = nowUs + 2 * SIM_BOUNCES * SIM_BOUNCE_US;
+    clock.at(settledUs + BUTTON_DEBOUNCE_US, []() {});
+    if (toDown) {
+      clock.at(nowUs + BUTTON_HOLD_US, []() {});
+    }
+  });
+}
+
+void SimButton::level(bool isDown) {
+  down = isDown;
+  if (begun) {
+    edges.put({clock.micros(), isDown});
+  }
+}
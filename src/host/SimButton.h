@@ -0,0 +1,70 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * SimButton.h
+ *
+ * A simulated shutter switch for the host build. Presses and releases are scheduled on a 
+ * VirtualClock, so a script can say when the shutter goes down and comes back up. Like a real
+ * switch, it bounces a few times each time it moves, and like Esp32Button's interrupt handler,
+ * it queues each change in level as it happens, so HalButton::event() gets to debounce and 
+ * decode the real thing.
+ *
+ * loop() on the camera is always looking; the simulation only looks when something is 
+ * scheduled. So each time the switch moves, the button also schedules a look for when it will
+ * have settled and, on the way down, for when it will have been held down long enough to be a
+ * hold.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include "VirtualClock.h"
+#include "SimTrace.h"
+#include "EdgeQueue.h"
+
+#define SIM_DEBOUNCE_MILLIS (25)                    // A press shorter than this is a bounce
+#define SIM_CLICK_MILLIS  (120)                     // How long click() holds the button down
+#define SIM_BOUNCES       (3)                       // Times the contacts bounce when the switch moves
+#define SIM_BOUNCE_US     (700)                     // How long each half of a bounce lasts
+
+class SimButton : public HalButton {
+  public:
+    /**
+     * @brief A button on the given clock, recording what it does in trace if there is one
+     */
+    SimButton(VirtualClock &clock, SimTrace *trace = nullptr);
+    void begin() override;
+    bool isDown() override;
+
+    /**
+     * @brief Have the button go down at the given time
+     */
+    void press(int64_t atMicros);
+
+    /**
+     * @brief Have the button come up at the given time
+     */
+    void release(int64_t atMicros);
+
+    /**
+     * @brief Have the button clicked at the given time, held down for holdMillis
+     */
+    void click(int64_t atMicros, uint32_t holdMillis = SIM_CLICK_MILLIS);
+
+  protected:
+    bool nextEdge(halEdge_t &edge) override;
+
+  private:
+    void move(int64_t atMicros, bool toDown);     // Schedule the switch going down or up, bounces and all
+    void level(bool isDown);                      // The contacts are now down or up
+
+    VirtualClock &clock;
+    SimTrace *trace;
+    EdgeQueue edges;
+    bool begun = false;
+    bool down = false;                            // Where the contacts are
+    bool pressed = false;                         // Where the switch is going, bounces aside
+};
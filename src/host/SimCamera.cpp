@@ -0,0 +1,432 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * SimCamera.cpp
+ *
+ * Implementation of the simulated camera. See SimCamera.h for how it behaves.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "SimCamera.h"
+#include "SimJpeg.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * The OV2640 runs every frame size from one of three sensor modes: UXGA for anything bigger
+ * than SVGA, SVGA for anything bigger than CIF, and CIF. The datasheet gives 15, 30 and 60 
+ * frames per second for those at a 24 MHz XCLK; these are scaled to the 20 MHz the camera 
+ * uses. Real boards can do worse when the DMA or PSRAM can't keep up; set frameMicros to what
+ * you measure to model that. An exposure can't be longer than the mode's rows. The DSP scales
+ * the mode's pixels down to the frame size by averaging them.
+ */
+static const struct {
+  uint16_t width;
+  uint16_t height;
+  uint32_t frameMicros;
+  uint16_t modeColumns;
+  uint16_t modeRows;
+} frameSizes[] = {
+  { 320,  240, 20000,  400,  296},                // SIM_FRAMESIZE_QVGA
+  { 400,  296, 20000,  400,  296},                // SIM_FRAMESIZE_CIF
+  { 640,  480, 40000,  800,  600},                // SIM_FRAMESIZE_VGA
+  { 800,  600, 40000,  800,  600},                // SIM_FRAMESIZE_SVGA
+  {1024,  768, 80000, 1600, 1200},                // SIM_FRAMESIZE_XGA
+  {1280, 1024, 80000, 1600, 1200},                // SIM_FRAMESIZE_SXGA
+  {1600, 1200, 80000, 1600, 1200}                 // SIM_FRAMESIZE_UXGA
+};
+
+SimCamera::SimCamera(HalClock &clock, SimTrace *trace) : clock(clock), trace(trace) {
+}
+
+bool SimCamera::addFile(const char *jpegPath) {
+  FILE *f = fopen(jpegPath, "rb");
+  if (f == nullptr) {
+    return false;
+  }
+  simSource_t source;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    source.jpeg.insert(source.jpeg.end(), chunk, chunk + n);
+  }
+  fclose(f);
+  if (!simJpegSize(source.jpeg, source.width, source.height)) {
+    return false;
+  }
+  sources.push_back(source);
+  return true;
+}
+
+bool SimCamera::begin(const simCameraConfig_t &config) {
+  this->config = config;
+  frameSize = config.frameSize;
+  windowPercent = 100;
+  if (config.frameSize > SIM_FRAMESIZE_UXGA || config.fbCount < 1 || config.fbCount > SIM_MAX_FB) {
+    return false;
+  }
+  if (config.scene == SIM_SCENE_FILES) {
+    if (sources.empty()) {
+      return false;
+    }
+  } else {
+    sources.clear();
+    makeScene();
+  }
+  for (int i = 0; i < SIM_MAX_FB; i++) {
+    fbs[i].state = FB_FREE;
+  }
+  setRate();
+  nextVsyncUs = clock.micros();
+  filling = -1;
+  nextSource = 0;
+  return true;
+}
+
+/**
+ * Returns the oldest waiting frame, waiting a frame at a time for one to finish if need be.
+ */
+bool SimCamera::grab(halFrame_t &frame) {
+  int64_t deadlineUs = clock.micros() + SIM_FB_TIMEOUT_MICROS;
+  if (hung) {
+    clock.delayMicros(SIM_FB_TIMEOUT_MICROS);
+    timeouts++;
+    if (trace != nullptr) {
+      trace->add("camera", "timeout", "sensor hung");
+    }
+    return false;
+  }
+  advance(clock.micros());
+  int ready = oldestReady();
+  while (ready < 0) {
+    if (filling < 0 && freeBuffer() < 0) {
+      // Every buffer is held; nothing can arrive until one is released, which won't happen
+      int64_t waitUs = deadlineUs - clock.micros();
+      if (waitUs > 0) {
+        clock.delayMicros((uint32_t)waitUs);
+      }
+      advance(clock.micros());
+      timeouts++;
+      if (trace != nullptr) {
+        trace->add("camera", "timeout", "all %u buffers held", config.fbCount);
+      }
+      return false;
+    }
+    int64_t waitUs = nextVsyncUs - clock.micros();
+    if (waitUs > 0) {
+      clock.delayMicros((uint32_t)waitUs);
+    }
+    advance(clock.micros());
+    ready = oldestReady();
+  }
+  simFb_t &fb = fbs[ready];
+  const simSource_t &source = fb.covered ? capped : sources[fb.source];
+  fb.state = FB_HELD;
+  frame.buf = source.jpeg.data();
+  frame.len = source.jpeg.size();
+  frame.width = source.width;
+  frame.height = source.height;
+  frame.timestampUs = fb.timestampUs;
+  frame.handle = &fb;
+  framesDelivered++;
+  return true;
+}
+
+void SimCamera::release(halFrame_t &frame) {
+  advance(clock.micros());
+  ((simFb_t *)frame.handle)->state = FB_FREE;
+  frame.handle = nullptr;
+}
+
+/**
+ * Like esp_camera_deinit() and esp_camera_init(): whatever the buffers held is gone and the 
+ * sensor starts streaming afresh once it's set up.
+ */
+bool SimCamera::restart() {
+  clock.delayMicros(SIM_INIT_MICROS);
+  hung = false;
+  restarts++;
+  if (trace != nullptr) {
+    trace->add("camera", "restart", "%u us", SIM_INIT_MICROS);
+  }
+  simFramesize_t size = frameSize;
+  uint8_t percent = windowPercent;
+  return begin(config) && setFrameSize((halFramesize_t)size) && setWindow(percent);
+}
+
+void SimCamera::cover(bool covered) {
+  halWindow_t window;
+  halWindow((halFramesize_t)frameSize, windowPercent, window);
+  if (covered && (capped.width != window.width || capped.height != window.height)) {
+    makeCapped();
+  }
+  this->covered = covered;
+  if (trace != nullptr) {
+    trace->add("camera", covered ? "capped" : "uncapped");
+  }
+}
+
+void SimCamera::hang() {
+  hung = true;
+  if (trace != nullptr) {
+    trace->add("camera", "hang");
+  }
+}
+
+/**
+ * A new clock divider makes the frames after the next one further apart, as does a new exposure
+ * on the sensor; neither is retroactive.
+ */
+bool SimCamera::setExposure(const halExposure_t &exposure) {
+  if (exposure.clockDiv < 1 || exposure.gain > HAL_MAX_GAIN) {
+    return false;
+  }
+  advance(clock.micros());
+  manual = true;
+  this->exposure = exposure;
+  intervalUs = fullRateUs * exposure.clockDiv;
+  return true;
+}
+
+bool SimCamera::setAutomatic() {
+  advance(clock.micros());
+  manual = false;
+  intervalUs = fullRateUs;
+  return true;
+}
+
+/**
+ * A new frame size is a new sensor mode, so it's set up from scratch, as the driver does. The
+ * frames already in the buffers change along with it, which they don't on the camera.
+ */
+bool SimCamera::setFrameSize(halFramesize_t size) {
+  simFramesize_t want = (simFramesize_t)size;
+  if (want > config.frameSize || (config.scene == SIM_SCENE_FILES && want != config.frameSize)) {
+    return false;
+  }
+  if (want == frameSize) {
+    return true;
+  }
+  for (int i = 0; i < config.fbCount; i++) {
+    if (fbs[i].state == FB_HELD) {
+      return false;                               // Its content is about to go away
+    }
+  }
+  advance(clock.micros());
+  frameSize = want;
+  sources.clear();
+  makeScene();
+  if (covered) {
+    makeCapped();
+  }
+  setRate();
+  if (trace != nullptr) {
+    trace->add("camera", "framesize", "%ux%u", frameSizes[frameSize].width, frameSizes[frameSize].height);
+  }
+  return true;
+}
+
+/**
+ * Like a new frame size, a new window changes the frames already in the buffers too.
+ */
+bool SimCamera::setWindow(uint8_t percent) {
+  halWindow_t window;
+  if (!halWindow((halFramesize_t)frameSize, percent, window) ||
+    (config.scene == SIM_SCENE_FILES && percent != 100)) {
+    return false;
+  }
+  if (percent == windowPercent) {
+    return true;
+  }
+  for (int i = 0; i < config.fbCount; i++) {
+    if (fbs[i].state == FB_HELD) {
+      return false;
+    }
+  }
+  advance(clock.micros());
+  windowPercent = percent;
+  sources.clear();
+  makeScene();
+  if (covered) {
+    makeCapped();
+  }
+  if (trace != nullptr) {
+    trace->add("camera", "window", "%u%%: %ux%u", percent, window.width, window.height);
+  }
+  return true;
+}
+
+bool SimCamera::meter(uint8_t &level) {
+  advance(clock.micros());
+  if (!manual || config.light == 0) {
+    level = config.level;
+  } else {
+    uint16_t rows = frameSizes[frameSize].modeRows;
+    double amount = (meteredExposure.lines < rows ? meteredExposure.lines : rows) *
+      meteredExposure.clockDiv * halGainOf(meteredExposure.gain);
+    double value = config.light * amount / 1000.0 * binning();
+    level = value > 255 ? 255 : (uint8_t)(value + 0.5);
+  }
+  meteredLevel = level;
+  return true;
+}
+
+/**
+ * With the level fixed, each doubling of the gain halves the electrons behind it. Averaging n
+ * of the mode's pixels into each of the frame's cuts the noise by the square root of n.
+ */
+double SimCamera::snrDb() const {
+  double gain = manual ? halGainOf(meteredExposure.gain) : 1.0;
+  double electrons = meteredLevel * SIM_E_PER_LEVEL / gain;
+  if (electrons <= 0) {
+    return 0;
+  }
+  double averaged = (double)frameSizes[frameSize].modeColumns * frameSizes[frameSize].modeRows /
+    ((double)frameSizes[frameSize].width * frameSizes[frameSize].height);
+  return 20 * log10(electrons / sqrt(electrons + SIM_READ_E * SIM_READ_E)) + 10 * log10(averaged);
+}
+
+uint32_t SimCamera::frameMicros() const {
+  return intervalUs;
+}
+
+/**
+ * A frameMicros set in the configuration is for the frame size the camera starts with; the
+ * faster modes are faster in proportion.
+ */
+void SimCamera::setRate() {
+  uint32_t nominalUs = frameSizes[frameSize].frameMicros;
+  fullRateUs = config.frameMicros == 0 ? nominalUs :
+    (uint32_t)((uint64_t)config.frameMicros * nominalUs / frameSizes[config.frameSize].frameMicros);
+  intervalUs = manual ? fullRateUs * exposure.clockDiv : fullRateUs;
+}
+
+/**
+ * A binning mode collects the light of all the full-size pixels each of its pixels covers.
+ */
+double SimCamera::binning() const {
+  if (!config.binned) {
+    return 1.0;
+  }
+  const uint16_t full = SIM_FRAMESIZE_UXGA;
+  return (double)frameSizes[full].modeColumns * frameSizes[full].modeRows /
+    ((double)frameSizes[frameSize].modeColumns * frameSizes[frameSize].modeRows);
+}
+
+/**
+ * At each frame start (VSYNC), the frame being filled is finished and the next one starts in
+ * a free buffer, if there is one. The sensor meters every frame, whether there's a buffer for
+ * it or not.
+ */
+void SimCamera::advance(int64_t nowUs) {
+  while (nextVsyncUs <= nowUs) {
+    meteredExposure = frameExposure;
+    frameExposure = exposure;
+    if (filling >= 0) {
+      if (config.grabMode == SIM_GRAB_LATEST) {
+        int waiting = oldestReady();
+        if (waiting >= 0) {
+          fbs[waiting].state = FB_FREE;
+          framesDropped++;
+        }
+      }
+      fbs[filling].state = FB_READY;
+      filling = -1;
+    }
+    filling = freeBuffer();
+    if (filling >= 0) {
+      simFb_t &fb = fbs[filling];
+      fb.state = FB_FILLING;
+      fb.timestampUs = nextVsyncUs;
+      fb.seq = nextSeq++;
+      fb.source = nextSource;
+      fb.covered = covered;
+      nextSource = (uint16_t)((nextSource + 1) % sources.size());
+      framesCaptured++;
+    } else {
+      framesDropped++;
+    }
+    nextVsyncUs += intervalUs;
+
+    // Nothing changes until a buffer is released, so skip ahead
+    if (filling < 0 && nextVsyncUs <= nowUs) {
+      int64_t skipped = (nowUs - nextVsyncUs) / intervalUs + 1;
+      framesDropped += (uint32_t)skipped;
+      nextVsyncUs += skipped * intervalUs;
+      meteredExposure = frameExposure = exposure;
+    }
+  }
+}
+
+int SimCamera::freeBuffer() {
+  for (int i = 0; i < config.fbCount; i++) {
+    if (fbs[i].state == FB_FREE) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int SimCamera::oldestReady() {
+  int oldest = -1;
+  for (int i = 0; i < config.fbCount; i++) {
+    if (fbs[i].state == FB_READY && (oldest < 0 || fbs[i].seq < fbs[oldest].seq)) {
+      oldest = i;
+    }
+  }
+  return oldest;
+}
+
+/**
+ * The sensor's quality scale, 0 (best) to 63, is mapped onto libjpeg's, 100 down to 5.
+ */
+void SimCamera::makeScene() {
+  halWindow_t window;
+  halWindow((halFramesize_t)frameSize, windowPercent, window);
+  uint16_t width = window.width;
+  uint16_t height = window.height;
+  uint16_t left = (uint16_t)((frameSizes[frameSize].width - width) / 2); // Of the window, in the scene
+  std::vector<uint8_t> pixels((size_t)width * height);
+  srand(1);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      int v = config.level;
+      if (config.scene == SIM_SCENE_GRADIENT) {
+        v = (left + x) * 2 * config.level / frameSizes[frameSize].width;
+      } else if (config.scene == SIM_SCENE_NOISE) {
+        v = config.level - 32 + rand() % 64;
+      }
+      pixels[(size_t)y * width + x] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+  }
+  simSource_t source;
+  source.width = width;
+  source.height = height;
+  uint8_t quality = (uint8_t)(100 - (config.jpegQuality > 63 ? 63 : config.jpegQuality) * 95 / 63);
+  simJpegEncodeGray(pixels.data(), width, height, quality, source.jpeg);
+  sources.push_back(source);
+}
+
+/**
+ * A capped sensor still has its dark noise, a few levels' worth, at the frame size.
+ */
+void SimCamera::makeCapped() {
+  halWindow_t window;
+  halWindow((halFramesize_t)frameSize, windowPercent, window);
+  uint16_t width = window.width;
+  uint16_t height = window.height;
+  std::vector<uint8_t> pixels((size_t)width * height);
+  srand(2);
+  for (size_t i = 0; i < pixels.size(); i++) {
+    pixels[i] = (uint8_t)(rand() % 8);
+  }
+  capped.width = width;
+  capped.height = height;
+  uint8_t quality = (uint8_t)(100 - (config.jpegQuality > 63 ? 63 : config.jpegQuality) * 95 / 63);
+  simJpegEncodeGray(pixels.data(), width, height, quality, capped.jpeg);
+}
@@ -0,0 +1,204 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * SimCamera.h
+ *
+ * A simulated camera for the host build: a stand-in for esp_camera_fb_get() and 
+ * esp_camera_fb_return() that behaves the way the esp32-camera driver does. The "sensor" 
+ * streams frames at the frame interval for its frame size from the moment begin() is called,
+ * whether anyone wants them or not. Each frame needs a free frame buffer when it starts; if
+ * there isn't one, the frame is dropped. Finished frames wait in a queue for grab(). With 
+ * SIM_GRAB_WHEN_EMPTY they wait in order, so after an idle spell grab() hands over frames 
+ * that are as old as the buffers have been full; with SIM_GRAB_LATEST a newly finished 
+ * frame pushes out the one that was waiting. If the caller is holding every buffer, grab() 
+ * waits SIM_FB_TIMEOUT_MICROS and fails, as the driver does. After hang(), the sensor sends
+ * nothing at all, so grab() always times out, until restart().
+ *
+ * Frames are stamped with HalClock::micros() as of the start of the frame, as the driver 
+ * does with esp_timer_get_time().
+ *
+ * What's in the frames comes from JPEG files (used in turn) or from a synthetic scene made 
+ * at the configured frame size and quality. All the waiting is done on the HalClock it's
+ * given, so with a virtual clock it takes no time at all.
+ *
+ * It's also the sensor's exposure controls (HalSensor). Left to itself, the sensor meters
+ * the scene's level. Given light, an exposure set by hand gets a level in proportion to it:
+ * rows of exposure time (no more than there are rows in the sensor mode's frame) times the
+ * clock divider times the gain. Slowing the clock makes frames that much further apart. The
+ * meter reads the latest frame to finish, which was exposed as things were when it started.
+ * How noisy that frame is comes from a simple model of a small pixel: SIM_E_PER_LEVEL 
+ * electrons per level with no gain, their shot noise, and SIM_READ_E of read noise.
+ *
+ * setFrameSize() switches to the faster sensor mode for the size, no bigger than the one it
+ * began with, and makes the synthetic scene again at the new size (files can't be resized).
+ * Whether the OV2640's faster modes bin (add up the pixels they leave out) or merely skip them
+ * isn't documented, so it's set up either way: binned, a mode's pixel collects the light of
+ * all the full-size pixels it covers, which makes for a higher level from the same exposure.
+ *
+ * setWindow() makes the synthetic scene again, the middle of it at the window's size (see
+ * halWindow()). The frames come no sooner for it. Files can't be cropped, so with
+ * SIM_SCENE_FILES the only window there is is the whole picture.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include <vector>
+#include "Hal.h"
+#include "SimTrace.h"
+
+#define SIM_FB_TIMEOUT_MICROS (4000000)             // How long grab() waits for a frame (the driver's FB_GET_TIMEOUT)
+#define SIM_MAX_FB        (8)                       // Most frame buffers we'll simulate
+#define SIM_INIT_MICROS   (300000)                  // How long restart() takes (esp_camera_init() on the camera)
+#define SIM_E_PER_LEVEL   (32)                      // Electrons per level of brightness, with no gain
+#define SIM_READ_E        (12)                      // Read noise, in electrons
+
+// Frame sizes, as in the driver's framesize_t
+enum simFramesize_t : uint8_t {
+  SIM_FRAMESIZE_QVGA,                             // 320x240
+  SIM_FRAMESIZE_CIF,                              // 400x296
+  SIM_FRAMESIZE_VGA,                              // 640x480
+  SIM_FRAMESIZE_SVGA,                             // 800x600
+  SIM_FRAMESIZE_XGA,                              // 1024x768
+  SIM_FRAMESIZE_SXGA,                             // 1280x1024
+  SIM_FRAMESIZE_UXGA                              // 1600x1200
+};
+
+// What happens to finished frames nobody has asked for, as in the driver's camera_grab_mode_t
+enum simGrabMode_t : uint8_t {
+  SIM_GRAB_WHEN_EMPTY,                            // They queue up, oldest first
+  SIM_GRAB_LATEST                                 // Only the newest is kept
+};
+
+// What's in the frames
+enum simScene_t : uint8_t {
+  SIM_SCENE_FILES,                                // The JPEG files from addFile(), in turn
+  SIM_SCENE_FLAT,                                 // A flat gray field
+  SIM_SCENE_GRADIENT,                             // Dark on the left to light on the right
+  SIM_SCENE_NOISE                                 // Random texture, which compresses badly
+};
+
+// How the simulated camera is set up; the first four are as in camera_config_t
+struct simCameraConfig_t {
+  simFramesize_t frameSize = SIM_FRAMESIZE_UXGA;
+  uint8_t jpegQuality = 10;                       // 0 (best) to 63 (worst)
+  uint8_t fbCount = 2;                            // Number of frame buffers
+  simGrabMode_t grabMode = SIM_GRAB_LATEST;
+  uint32_t frameMicros = 0;                       // Frame interval; 0 means the nominal one for the frame size
+  simScene_t scene = SIM_SCENE_FILES;
+  uint8_t level = 128;                            // Brightness of the synthetic scenes, and the metered level
+  uint16_t light = 0;                             // Level for 1000 rows of exposure with no gain; 0 for level
+  bool binned = false;                            // Whether the faster sensor modes bin rather than skip
+};
+
+class SimCamera : public HalCamera, public HalSensor {
+  public:
+    /**
+     * @brief A camera on the given clock, recording its timeouts in trace if there is one
+     */
+    SimCamera(HalClock &clock, SimTrace *trace = nullptr);
+
+    /**
+     * @brief Add a JPEG file to the ones SIM_SCENE_FILES serves. Call before begin().
+     *
+     * @return false  Couldn't read it
+     */
+    bool addFile(const char *jpegPath);
+
+    /**
+     * @brief Start the camera streaming (esp_camera_init())
+     *
+     * @return false  The configuration doesn't make sense (e.g., SIM_SCENE_FILES but no files)
+     */
+    bool begin(const simCameraConfig_t &config);
+
+    bool grab(halFrame_t &frame) override;
+    void release(halFrame_t &frame) override;
+    bool restart() override;
+    bool setExposure(const halExposure_t &exposure) override;
+    bool setAutomatic() override;
+    bool meter(uint8_t &level) override;
+    bool setFrameSize(halFramesize_t size) override;
+    bool setWindow(uint8_t percent) override;
+
+    /**
+     * @brief The signal to noise ratio of the frame meter() last read, in dB
+     */
+    double snrDb() const;
+
+    /**
+     * @brief Make the sensor stop sending frames, as if it had locked up, until restart()
+     */
+    void hang();
+
+    /**
+     * @brief Put the cap on the lens, so frames that start from now on are black but for the
+     * sensor's noise, or take it off
+     */
+    void cover(bool covered);
+
+    /**
+     * @brief The interval between frames in microseconds
+     */
+    uint32_t frameMicros() const;
+
+    // What's happened so far
+    uint32_t framesCaptured = 0;                  // Frames captured into a buffer
+    uint32_t framesDropped = 0;                   // Frames nobody saw (no free buffer, or pushed out)
+    uint32_t framesDelivered = 0;                 // Frames handed over by grab()
+    uint32_t timeouts = 0;                        // Times grab() gave up
+    uint32_t restarts = 0;                        // Times restart() was called
+
+  private:
+    // The state of a frame buffer
+    enum fbState_t : uint8_t {FB_FREE, FB_FILLING, FB_READY, FB_HELD};
+
+    // A frame buffer
+    struct simFb_t {
+      fbState_t state;
+      int64_t timestampUs;                        // When the frame in it started
+      uint32_t seq;                               // Frame number, to tell which is oldest
+      uint16_t source;                            // Which of the sources the frame's content is
+      bool covered;                               // Whether it's capped instead
+    };
+
+    // Where frame content comes from
+    struct simSource_t {
+      std::vector<uint8_t> jpeg;
+      uint16_t width;
+      uint16_t height;
+    };
+
+    void advance(int64_t nowUs);                  // Bring the buffers up to date
+    int freeBuffer();                             // Index of a free buffer or -1
+    int oldestReady();                            // Index of the oldest ready buffer or -1
+    void makeScene();                             // Generate the synthetic scene's frame
+    void makeCapped();                            // Generate the capped frame
+    void setRate();                               // Set the frame interval for the frame size
+    double binning() const;                       // How many times the light a mode's pixel collects
+
+    HalClock &clock;
+    SimTrace *trace;
+    simCameraConfig_t config;
+    simFramesize_t frameSize = SIM_FRAMESIZE_UXGA; // What it's sending now
+    uint8_t windowPercent = 100;                  // How much of it, across and down
+    std::vector<simSource_t> sources;
+    simSource_t capped {{}, 0, 0};                // What a frame with the cap on looks like
+    bool covered = false;                         // Whether the cap is on
+    simFb_t fbs[SIM_MAX_FB];
+    uint16_t nextSource = 0;
+    uint32_t nextSeq = 0;
+    int filling = -1;                             // Index of the buffer being filled, or -1
+    int64_t nextVsyncUs = 0;                      // When the next frame starts
+    uint32_t intervalUs = 0;
+    uint32_t fullRateUs = 0;                      // intervalUs with the clock undivided
+    bool manual = false;                          // Whether the exposure was set by hand
+    halExposure_t exposure {0, 0, 1};             // If so, what it is
+    halExposure_t frameExposure {0, 0, 1};        // How the frame now being captured is exposed
+    halExposure_t meteredExposure {0, 0, 1};      // How the latest finished one was
+    uint8_t meteredLevel = 0;                     // What meter() read last
+    bool hung = false;                            // Whether the sensor has stopped sending
+};
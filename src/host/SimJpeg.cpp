@@ -0,0 +1,253 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * SimJpeg.cpp
+ *
+ * A small baseline JPEG encoder and header reader. See SimJpeg.h. The tables are the example
+ * ones from Annex K of the JPEG standard, which is what most encoders use.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "SimJpeg.h"
+#include <math.h>
+
+// Natural-order index of each zigzag position
+static const uint8_t zigzag[64] = {
+   0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+  58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// Luminance quantization table at quality 50, natural order
+static const uint8_t lumQuant[64] = {
+  16, 11, 10, 16,  24,  40,  51,  61,
+  12, 12, 14, 19,  26,  58,  60,  55,
+  14, 13, 16, 24,  40,  57,  69,  56,
+  14, 17, 22, 29,  51,  87,  80,  62,
+  18, 22, 37, 56,  68, 109, 103,  77,
+  24, 35, 55, 64,  81, 104, 113,  92,
+  49, 64, 78, 87, 103, 121, 120, 101,
+  72, 92, 95, 98, 112, 100, 103,  99
+};
+
+// Luminance DC and AC Huffman tables: number of codes of each length, then the values
+static const uint8_t dcBits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t dcVals[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t acBits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t acVals[162] = {
+  0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+  0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+  0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+  0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+  0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+  0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+  0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+  0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+  0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+  0xf9, 0xfa
+};
+
+// A Huffman code for each value: the code and its length in bits
+struct huffCode_t {
+  uint16_t code[256];
+  uint8_t len[256];
+};
+
+// Accumulates bits and writes them out a byte at a time, stuffing a 0 after each 0xFF
+struct bitWriter_t {
+  std::vector<uint8_t> &out;
+  uint32_t acc = 0;
+  int nBits = 0;
+
+  bitWriter_t(std::vector<uint8_t> &out) : out(out) {}
+
+  void put(uint32_t bits, int len) {
+    acc = (acc << len) | (bits & ((1u << len) - 1));
+    nBits += len;
+    while (nBits >= 8) {
+      uint8_t b = (uint8_t)(acc >> (nBits - 8));
+      out.push_back(b);
+      if (b == 0xFF) {
+        out.push_back(0);
+      }
+      nBits -= 8;
+    }
+  }
+
+  void flush() {
+    if (nBits > 0) {
+      put(0x7F, 8 - nBits);                       // Pad with 1s
+    }
+  }
+};
+
+static void buildCodes(const uint8_t *bits, const uint8_t *vals, huffCode_t &codes) {
+  uint16_t code = 0;
+  int k = 0;
+  for (int len = 1; len <= 16; len++) {
+    for (int i = 0; i < bits[len - 1]; i++) {
+      codes.code[vals[k]] = code++;
+      codes.len[vals[k]] = (uint8_t)len;
+      k++;
+    }
+    code <<= 1;
+  }
+}
+
+static void put16(std::vector<uint8_t> &out, uint16_t v) {
+  out.push_back((uint8_t)(v >> 8));
+  out.push_back((uint8_t)v);
+}
+
+static void putHuffTable(std::vector<uint8_t> &out, uint8_t classId, const uint8_t *bits, 
+  const uint8_t *vals, int nVals) {
+  out.push_back(0xFF);
+  out.push_back(0xC4);
+  put16(out, (uint16_t)(2 + 1 + 16 + nVals));
+  out.push_back(classId);
+  out.insert(out.end(), bits, bits + 16);
+  out.insert(out.end(), vals, vals + nVals);
+}
+
+// The number of bits needed for v, and v as JPEG encodes it in that many bits
+static int magnitude(int v, uint32_t &bits) {
+  int a = v < 0 ? -v : v;
+  int n = 0;
+  while (a >> n) {
+    n++;
+  }
+  bits = (uint32_t)(v < 0 ? v - 1 : v);
+  return n;
+}
+
+void simJpegEncodeGray(const uint8_t *pixels, uint16_t width, uint16_t height, uint8_t quality,
+  std::vector<uint8_t> &out) {
+  // Scale the quantization table the way libjpeg does
+  if (quality < 1) {
+    quality = 1;
+  } else if (quality > 100) {
+    quality = 100;
+  }
+  int scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+  uint8_t quant[64];
+  for (int i = 0; i < 64; i++) {
+    int q = (lumQuant[i] * scale + 50) / 100;
+    quant[i] = (uint8_t)(q < 1 ? 1 : q > 255 ? 255 : q);
+  }
+  float cosTable[8][8];
+  for (int x = 0; x < 8; x++) {
+    for (int u = 0; u < 8; u++) {
+      cosTable[x][u] = cosf((2 * x + 1) * u * (float)M_PI / 16) * (u == 0 ? (float)M_SQRT1_2 : 1.0f);
+    }
+  }
+  huffCode_t dcCodes, acCodes;
+  buildCodes(dcBits, dcVals, dcCodes);
+  buildCodes(acBits, acVals, acCodes);
+
+  // Headers: SOI, DQT, SOF0, DHT x 2, SOS
+  out.clear();
+  out.push_back(0xFF);
+  out.push_back(0xD8);
+  out.push_back(0xFF);
+  out.push_back(0xDB);
+  put16(out, 2 + 1 + 64);
+  out.push_back(0);
+  for (int i = 0; i < 64; i++) {
+    out.push_back(quant[zigzag[i]]);
+  }
+  static const uint8_t sof[] = {0xFF, 0xC0, 0, 11, 8};
+  out.insert(out.end(), sof, sof + sizeof(sof));
+  put16(out, height);
+  put16(out, width);
+  static const uint8_t component[] = {1, 1, 0x11, 0};
+  out.insert(out.end(), component, component + sizeof(component));
+  putHuffTable(out, 0x00, dcBits, dcVals, sizeof(dcVals));
+  putHuffTable(out, 0x10, acBits, acVals, sizeof(acVals));
+  static const uint8_t sos[] = {0xFF, 0xDA, 0, 8, 1, 1, 0x00, 0, 63, 0};
+  out.insert(out.end(), sos, sos + sizeof(sos));
+
+  // The image data, one 8x8 block at a time, edge pixels repeated to fill partial blocks
+  bitWriter_t bw(out);
+  int prevDc = 0;
+  for (int by = 0; by < height; by += 8) {
+    for (int bx = 0; bx < width; bx += 8) {
+      float block[8][8];
+      for (int y = 0; y < 8; y++) {
+        int py = by + y < height ? by + y : height - 1;
+        for (int x = 0; x < 8; x++) {
+          int px = bx + x < width ? bx + x : width - 1;
+          block[y][x] = (float)pixels[py * width + px] - 128;
+        }
+      }
+      int coef[64];
+      for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+          float sum = 0;
+          for (int y = 0; y < 8; y++) {
+            for (int x = 0; x < 8; x++) {
+              sum += block[y][x] * cosTable[x][u] * cosTable[y][v];
+            }
+          }
+          coef[v * 8 + u] = (int)lroundf(sum / 4 / quant[v * 8 + u]);
+        }
+      }
+
+      // DC as the difference from the last block's
+      uint32_t bits;
+      int n = magnitude(coef[0] - prevDc, bits);
+      prevDc = coef[0];
+      bw.put(dcCodes.code[n], dcCodes.len[n]);
+      bw.put(bits, n);
+
+      // AC as runs of zeros and values, in zigzag order
+      int run = 0;
+      for (int i = 1; i < 64; i++) {
+        int c = coef[zigzag[i]];
+        if (c == 0) {
+          run++;
+          continue;
+        }
+        while (run > 15) {
+          bw.put(acCodes.code[0xF0], acCodes.len[0xF0]);
+          run -= 16;
+        }
+        n = magnitude(c, bits);
+        uint8_t sym = (uint8_t)(run << 4 | n);
+        bw.put(acCodes.code[sym], acCodes.len[sym]);
+        bw.put(bits, n);
+        run = 0;
+      }
+      if (run > 0) {
+        bw.put(acCodes.code[0x00], acCodes.len[0x00]);
+      }
+    }
+  }
+  bw.flush();
+  out.push_back(0xFF);
+  out.push_back(0xD9);
+}
+
+bool simJpegSize(const std::vector<uint8_t> &jpeg, uint16_t &width, uint16_t &height) {
+  for (size_t i = 2; i + 9 < jpeg.size(); ) {
+    if (jpeg[i] != 0xFF) {
+      return false;
+    }
+    uint8_t marker = jpeg[i + 1];
+    if (marker == 0xDA) {
+      return false;
+    }
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+      height = (uint16_t)(jpeg[i + 5] << 8 | jpeg[i + 6]);
+      width = (uint16_t)(jpeg[i + 7] << 8 | jpeg[i + 8]);
+      return true;
+    }
+    i += 2 + (jpeg[i + 2] << 8 | jpeg[i + 3]);
+  }
+  return false;
+}
@@ -0,0 +1,39 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * SimJpeg.h
+ *
+ * A small baseline JPEG encoder and header reader for the host simulation. The simulated 
+ * camera uses the encoder to make synthetic frames (a flat field, a gradient, noise) of the 
+ * right size and brightness without needing any image files or libraries. Grayscale only; 
+ * that's all the synthetic scenes need.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+/**
+ * @brief Encode an 8-bit grayscale image as a baseline JPEG
+ *
+ * @param pixels  width * height pixels, row by row
+ * @param width   The image width in pixels
+ * @param height  The image height in pixels
+ * @param quality libjpeg-style quality, 1 (worst) to 100 (best)
+ * @param out     Replaced with the JPEG
+ */
+void simJpegEncodeGray(const uint8_t *pixels, uint16_t width, uint16_t height, uint8_t quality,
+  std::vector<uint8_t> &out);
+
+/**
+ * @brief Get the image size from a JPEG's start-of-frame header
+ *
+ * @return true   Found it
+ * @return false  No start-of-frame header before the image data
+ */
+bool simJpegSize(const std::vector<uint8_t> &jpeg, uint16_t &width, uint16_t &height);
@@ -0,0 +1,105 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * SimStorage.cpp
+ *
+ * Implementation of the simulated SD card. See SimStorage.h for the model.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "SimStorage.h"
+
+SimStorage::SimStorage(const char *root, HalClock &clock, const simCardConfig_t &config,
+  SimTrace *trace) : LinuxStorage(root), clock(clock), card(config), trace(trace) {
+  if (card.clusterBytes == 0) {
+    card.clusterBytes = 512;
+  }
+}
+
+int SimStorage::open(const char *path) {
+  spend(card.createMicros);
+  if (failed) {
+    return -1;
+  }
+  int handle = LinuxStorage::open(path);
+  if (handle >= 0) {
+    filePos[handle] = 0;
+  }
+  return handle;
+}
+
+/**
+ * The bus and the card work at the same time, so a transfer goes at the pace of the slower.
+ */
+size_t SimStorage::write(int handle, const uint8_t *buf, size_t len) {
+  if (failed) {
+    spend(card.commandMicros);
+    return 0;
+  }
+  size_t done = LinuxStorage::write(handle, buf, len);
+  uint64_t busBytesPerSec = (uint64_t)card.busHz * card.busWidth / 8;
+  uint64_t bytesPerSec = card.cardBytesPerSec < busBytesPerSec ? card.cardBytesPerSec : busBytesPerSec;
+  uint64_t us = card.commandMicros + (bytesPerSec == 0 ? 0 : (uint64_t)done * 1000000 / bytesPerSec);
+
+  // Clusters the file grew into
+  uint64_t oldClusters = (filePos[handle] + card.clusterBytes - 1) / card.clusterBytes;
+  filePos[handle] += done;
+  uint64_t newClusters = (filePos[handle] + card.clusterBytes - 1) / card.clusterBytes;
+  clustersAllocated += (uint32_t)(newClusters - oldClusters);
+  us += (newClusters - oldClusters) * card.clusterMicros;
+
+  // Garbage collections the card did along the way
+  if (card.gcEveryBytes != 0) {
+    gcBytes += done;
+    while (gcBytes >= card.gcEveryBytes) {
+      gcBytes -= card.gcEveryBytes;
+      gcStalls++;
+      us += card.gcMicros;
+      if (trace != nullptr) {
+        trace->add("card", "gc", "%u us", card.gcMicros);
+      }
+    }
+  }
+  bytesWritten += done;
+  spend(us);
+  return done;
+}
+
+bool SimStorage::close(int handle) {
+  spend(card.closeMicros);
+  return LinuxStorage::close(handle);
+}
+
+bool SimStorage::remount() {
+  spend(card.mountMicros);
+  failed = false;
+  remounts++;
+  if (trace != nullptr) {
+    trace->add("card", "remount", "%u us", card.mountMicros);
+  }
+  return LinuxStorage::remount();
+}
+
+void SimStorage::fail() {
+  failed = true;
+  if (trace != nullptr) {
+    trace->add("card", "fail");
+  }
+}
+
+const simCardConfig_t &SimStorage::config() const {
+  return card;
+}
+
+void SimStorage::spend(uint64_t us) {
+  busyMicros += us;
+  while (us > 0) {
+    uint32_t step = us > 1000000 ? 1000000 : (uint32_t)us;
+    clock.delayMicros(step);
+    us -= step;
+  }
+}
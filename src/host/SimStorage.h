@@ -0,0 +1,91 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * SimStorage.h
+ *
+ * A simulated SD card for the host build. Files go into a directory, just as with 
+ * LinuxStorage, but each operation also takes as long as it would on a card, spent on the 
+ * HalClock it's given:
+ *
+ *    Cost              Charged
+ *    ================  ===========================================================
+ *    transfer          Every byte, at the slower of the bus (1- or 4-bit) and the card
+ *    command           Every write(): commands and FatFs sector buffer handling
+ *    create            Every open(): directory search and a new directory entry
+ *    cluster           Every cluster a file grows into: a FAT read-modify-write
+ *    close             Every close(): directory entry update and FAT sync
+ *    gc                Every gcEveryBytes written to the card: its garbage collection
+ *
+ * The defaults are plausible for a class 10 card in the camera's 1-bit mode. To model a 
+ * particular card, run the SD card benchmark (include/SdBench.h) on it and plug in what it
+ * found: seq gives the card's throughput, create the create plus close cost, fat the cluster
+ * cost and sustained the GC interval and stall.
+ *
+ * After fail(), the card stops answering, as one that has been jostled in its slot does: 
+ * open() and write() fail until remount(), which takes mountMicros.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include "HalLinux.h"
+#include "SimTrace.h"
+
+// How the simulated card behaves
+struct simCardConfig_t {
+  uint8_t busWidth = 1;                           // Data lines: 1 (what the camera uses) or 4
+  uint32_t busHz = 20000000;                      // SDMMC clock
+  uint32_t cardBytesPerSec = 10000000;            // How fast the card can take data
+  uint32_t commandMicros = 150;                   // Per write()
+  uint32_t createMicros = 8000;                   // Per open()
+  uint32_t clusterBytes = 32768;                  // Allocation unit size
+  uint32_t clusterMicros = 400;                   // Per cluster allocated
+  uint32_t closeMicros = 4000;                    // Per close()
+  uint32_t gcEveryBytes = 4194304;                // Bytes between garbage collections; 0 for none
+  uint32_t gcMicros = 120000;                     // How long a garbage collection stalls
+  uint32_t mountMicros = 80000;                   // Per remount(): card init and FAT mount
+};
+
+class SimStorage : public LinuxStorage {
+  public:
+    /**
+     * @brief A simulated card keeping its files in the given (existing) directory, recording 
+     * its garbage collection stalls in trace if there is one
+     */
+    SimStorage(const char *root, HalClock &clock, const simCardConfig_t &config = simCardConfig_t(),
+      SimTrace *trace = nullptr);
+    int open(const char *path) override;
+    size_t write(int handle, const uint8_t *buf, size_t len) override;
+    bool close(int handle) override;
+    bool remount() override;
+
+    /**
+     * @brief Make the card stop answering until remount()
+     */
+    void fail();
+
+    /**
+     * @brief The model in use
+     */
+    const simCardConfig_t &config() const;
+
+    // What's happened so far
+    uint64_t busyMicros = 0;                      // Time spent in open(), write() and close()
+    uint64_t bytesWritten = 0;                    // Bytes written
+    uint32_t clustersAllocated = 0;               // Clusters files have grown into
+    uint32_t gcStalls = 0;                        // Garbage collections sat through
+    uint32_t remounts = 0;                        // Times remount() was called
+
+  private:
+    void spend(uint64_t us);                      // Take us microseconds of the clock's time
+
+    HalClock &clock;
+    simCardConfig_t card;
+    SimTrace *trace;
+    uint64_t filePos[HAL_MAX_FILES] = {0};        // Bytes written to each open file
+    uint64_t gcBytes = 0;                         // Bytes written since the last garbage collection
+    bool failed = false;                          // Whether the card has stopped answering
+};
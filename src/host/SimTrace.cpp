@@ -0,0 +1,64 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * SimTrace.cpp
+ *
+ * Implementation of the simulation trace. See SimTrace.h.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "SimTrace.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+SimTrace::SimTrace(HalClock &clock) : clock(clock) {
+}
+
+void SimTrace::add(const char *source, const char *event) {
+  trace.push_back({clock.micros(), source, event, ""});
+}
+
+void SimTrace::add(const char *source, const char *event, const char *format, ...) {
+  char detail[128];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(detail, sizeof(detail), format, args);
+  va_end(args);
+  trace.push_back({clock.micros(), source, event, detail});
+}
+
+const std::vector<simTraceEntry_t> &SimTrace::entries() const {
+  return trace;
+}
+
+size_t SimTrace::count(const char *source, const char *event) const {
+  size_t n = 0;
+  for (const simTraceEntry_t &entry : trace) {
+    if (entry.source == source && entry.event == event) {
+      n++;
+    }
+  }
+  return n;
+}
+
+/**
+ * Details are quoted if they have commas in them.
+ */
+bool SimTrace::save(const char *path) const {
+  FILE *f = fopen(path, "w");
+  if (f == nullptr) {
+    return false;
+  }
+  fprintf(f, "us,source,event,detail\n");
+  for (const simTraceEntry_t &entry : trace) {
+    const char *quote = strchr(entry.detail.c_str(), ',') != nullptr ? "\"" : "";
+    fprintf(f, "%lld,%s,%s,%s%s%s\n", (long long)entry.atUs, entry.source.c_str(), 
+      entry.event.c_str(), quote, entry.detail.c_str(), quote);
+  }
+  return fclose(f) == 0;
+}
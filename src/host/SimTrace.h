@@ -0,0 +1,68 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * SimTrace.h
+ *
+ * A record of what happened during a host simulation, and when: the shutter going down and 
+ * up, clicks, shots, LED flashes, sleeping and waking. Each entry has the time, what did it,
+ * what happened and any details, and the whole thing can be saved as a CSV file so a script
+ * can check that what should have happened did, or compare one run with another.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include <string>
+#include <vector>
+#include "Hal.h"
+
+// One thing that happened
+struct simTraceEntry_t {
+  int64_t atUs;                                   // When, by the simulation's clock
+  std::string source;                             // What did it: "shutter", "led", "camera", ...
+  std::string event;                              // What happened: "down", "click", "saved", ...
+  std::string detail;                             // Anything else worth knowing
+};
+
+class SimTrace {
+  public:
+    /**
+     * @brief A trace timed by the given clock
+     */
+    SimTrace(HalClock &clock);
+
+    /**
+     * @brief Record that source did event
+     */
+    void add(const char *source, const char *event);
+
+    /**
+     * @brief Record that source did event, with details formatted printf-style
+     */
+    void add(const char *source, const char *event, const char *format, ...)
+      __attribute__((format(printf, 4, 5)));
+
+    /**
+     * @brief Everything recorded so far, in order
+     */
+    const std::vector<simTraceEntry_t> &entries() const;
+
+    /**
+     * @brief The number of times source did event
+     */
+    size_t count(const char *source, const char *event) const;
+
+    /**
+     * @brief Save the trace as CSV: us,source,event,detail
+     *
+     * @return false  Couldn't write the file
+     */
+    bool save(const char *path) const;
+
+  private:
+    HalClock &clock;
+    std::vector<simTraceEntry_t> trace;
+};
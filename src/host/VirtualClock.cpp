@@ -0,0 +1,64 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * VirtualClock.cpp
+ *
+ * Implementation of the virtual clock and scheduler. See VirtualClock.h.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "VirtualClock.h"
+
+uint32_t VirtualClock::millis() {
+  return (uint32_t)(nowUs / 1000);
+}
+
+int64_t VirtualClock::micros() {
+  return nowUs;
+}
+
+void VirtualClock::delay(uint32_t ms) {
+  advanceTo(nowUs + (int64_t)ms * 1000);
+}
+
+void VirtualClock::delayMicros(uint32_t us) {
+  advanceTo(nowUs + us);
+}
+
+void VirtualClock::advanceTo(int64_t atMicros) {
+  while (!events.empty() && events.top().atUs <= atMicros) {
+    vcEvent_t event = events.top();
+    events.pop();
+    if (event.atUs > nowUs) {
+      nowUs = event.atUs;
+    }
+    event.fn();
+  }
+  if (atMicros > nowUs) {
+    nowUs = atMicros;
+  }
+}
+
+void VirtualClock::at(int64_t atMicros, std::function<void()> fn) {
+  events.push({atMicros, nextSeq++, fn});
+}
+
+int64_t VirtualClock::nextEventMicros() const {
+  return events.empty() ? VC_NEVER : events.top().atUs;
+}
+
+VirtualTimer::VirtualTimer(VirtualClock &clock) : clock(clock) {
+}
+
+void VirtualTimer::begin(void (*handler)(void *arg), void *arg) {
+  this->handler = handler;
+  this->arg = arg;
+}
+
+void VirtualTimer::start(uint32_t us) {
+  clock.at(clock.micros() + us, [this]() { handler(arg); });
+}
@@ -0,0 +1,79 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * VirtualClock.h
+ *
+ * A clock for the host simulation that only moves when someone waits on it, plus a scheduler
+ * for things that are to happen at given times. Waiting (delay(), delayMicros() or 
+ * advanceTo()) moves the time forward at once, running the scheduled things that come due 
+ * along the way, in time order, each at its own time. So hours of the camera's life take 
+ * milliseconds to simulate and come out the same every time. VirtualTimer is a HalTimer on 
+ * the scheduler.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include <functional>
+#include <queue>
+#include <vector>
+#include "Hal.h"
+
+#define VC_NEVER          (INT64_MAX)               // nextEventMicros() when nothing is scheduled
+
+class VirtualClock : public HalClock {
+  public:
+    uint32_t millis() override;
+    int64_t micros() override;
+    void delay(uint32_t ms) override;
+    void delayMicros(uint32_t us) override;
+
+    /**
+     * @brief Move the time forward to atMicros, running whatever comes due on the way
+     */
+    void advanceTo(int64_t atMicros);
+
+    /**
+     * @brief Have fn run when the time reaches atMicros. Things scheduled for the same time 
+     * run in the order they were scheduled.
+     */
+    void at(int64_t atMicros, std::function<void()> fn);
+
+    /**
+     * @brief When the next scheduled thing is due, or VC_NEVER
+     */
+    int64_t nextEventMicros() const;
+
+  private:
+    // Something scheduled
+    struct vcEvent_t {
+      int64_t atUs;
+      uint32_t seq;
+      std::function<void()> fn;
+      bool operator>(const vcEvent_t &other) const {
+        return atUs != other.atUs ? atUs > other.atUs : seq > other.seq;
+      }
+    };
+
+    int64_t nowUs = 0;
+    uint32_t nextSeq = 0;
+    std::priority_queue<vcEvent_t, std::vector<vcEvent_t>, std::greater<vcEvent_t>> events;
+};
+
+class VirtualTimer : public HalTimer {
+  public:
+    /**
+     * @brief A timer that goes off in clock's time
+     */
+    VirtualTimer(VirtualClock &clock);
+    void begin(void (*handler)(void *arg), void *arg) override;
+    void start(uint32_t us) override;
+
+  private:
+    VirtualClock &clock;
+    void (*handler)(void *arg) = nullptr;
+    void *arg = nullptr;
+};
@@ -0,0 +1,42 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * AllocCount.cpp
+ *
+ * Heap allocation counting for the host benchmark. See AllocCount.h.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "AllocCount.h"
+#include <stddef.h>
+
+extern "C" {
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t n, size_t size);
+  void *__libc_realloc(void *ptr, size_t size);
+}
+
+static volatile uint64_t allocs = 0;
+
+extern "C" void *malloc(size_t size) {
+  allocs = allocs + 1;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+  allocs = allocs + 1;
+  return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+  allocs = allocs + 1;
+  return __libc_realloc(ptr, size);
+}
+
+uint64_t allocCount() {
+  return allocs;
+}
@@ -0,0 +1,23 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * AllocCount.h
+ *
+ * Counts heap allocations in the host benchmark. Linking AllocCount.cpp replaces malloc(), 
+ * calloc() and realloc() with versions that count calls and then hand off to the C 
+ * library's own (glibc's __libc_malloc() and friends). new and std containers allocate
+ * through malloc(), so they're counted too.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include <stdint.h>
+
+/**
+ * @brief The number of heap allocations since the program started
+ */
+uint64_t allocCount();
@@ -0,0 +1,840 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * bench.cpp
+ *
+ * Benchmarks the capture and save path: PinholeCamera::shoot() with the simulated camera and
+ * SD card (see SimCamera.h and SimStorage.h) in virtual time. For each frame size and JPEG 
+ * quality it takes a run of pictures back to back, and then does the same at UXGA and SVGA
+ * with the sensor sending only the middle of the picture (see HalSensor::setWindow()), as it
+ * does behind a pinhole that vignettes badly. It reports:
+ *
+ *    Result            Meaning
+ *    ================  ===========================================================
+ *    window            The percent of the picture across and down that was sent
+ *    image_bytes       Size of the images (synthetic scene at that size and quality)
+ *    shots_per_s       Pictures per second of simulated time, LED flashes and all
+ *    mb_per_s          Image data saved per second of simulated time
+ *    latency_ms        Percentiles of the time from starting a shot to its being saved
+ *    allocs_per_shot   Heap allocations per shot, by the portable code and the host parts
+ *    host_us_per_shot  Real CPU time per shot on this machine
+ *
+ * It also parses a pinhole.cfg that sets everything (see PinholeConfig.h) over and over and
+ * reports the real CPU time and heap allocations per parse as config_parse. That's done at 
+ * boot, so it has to be quick; the config phase in the camera's boot log (see BootProfile.h) 
+ * says how quick it is on the camera, card and all.
+ *
+ * And it has the pinhole exposure control (see AutoExposure.h) find the exposure for a flat
+ * UXGA scene at a few light levels, from bright enough for the stock lens to dim behind a
+ * pinhole, starting from a whole frame at the full frame rate each time. It does that both
+ * the pinhole way and the way the sensor's own control does, with gain but no clock divider,
+ * and reports, as exposure:
+ *
+ *    Result            Meaning
+ *    ================  ===========================================================
+ *    light             The level 1000 rows of exposure with no gain make (see SimCamera.h)
+ *    clock_div         The most the clock may be slowed: 8 the pinhole way, 1 the sensor's
+ *    converged         Whether the level ended up within AE_TOLERANCE of AE_TARGET
+ *    changes           Exposure changes it took
+ *    settle_ms         Simulated time it took
+ *    rows, div, gain   The exposure it ended up with
+ *    level             The level that made
+ *    snr_db            The signal to noise ratio of the pictures (SimCamera's noise model)
+ *
+ * Finally, it meters a few JPEGs from their DC coefficients (see JpegMeter.h) and judges them
+ * (see FrameQuality.h): the --jpeg picture, the synthetic scene at UXGA and quality 10, and the
+ * same with the lens capped. To see what skipping the
+ * decode saves and costs, it also decodes each one's luminance in full (dequantizing and
+ * inverse transforming every block) and makes the same histogram from the pixels. That's less
+ * than a real decoder does, with no chroma and no color conversion, so the comparison flatters
+ * full decoding. It reports, as jpeg_meter:
+ *
+ *    Result            Meaning
+ *    ================  ===========================================================
+ *    name, bytes       The picture and its size
+ *    meter_us          Real CPU time to meter it on this machine
+ *    decode_us         Real CPU time to decode it in full and histogram the pixels
+ *    mean, p5, p50,    Its average level and percentiles, metered and decoded. The
+ *    p95               percentiles are to the histogram's resolution, four levels.
+ *    verdict           What judging it as if through the stock lens said
+ *    judge_us          Real CPU time to judge it, on top of metering it
+ *    allocs            Heap allocations per metering
+ *
+ * And it photographs a dim scene (light 3, a pinhole indoors) each of the ways a dim picture
+ * can be taken (see JpegStacker.h): a single UXGA frame, or 1, 4 or 8 frames averaged at SVGA
+ * or CIF, which come from the sensor's faster readout modes. It starts from the exposure for
+ * UXGA, switches the frame size, finds the exposure for the mode, and takes and saves the
+ * picture, with the pinhole exposure control and the clock slowed as much as it goes. Whether
+ * the faster modes bin or skip isn't documented (see SimCamera.h), so it's done both ways.
+ * The simulated scene is flat and noiseless, so to see what averaging really does to the
+ * noise once it's been through JPEG, it also makes frames of that level with the noise the
+ * model gives them, stacks them with JpegStacker and decodes the result. It reports, as
+ * dim_modes:
+ *
+ *    Result            Meaning
+ *    ================  ===========================================================
+ *    framesize, frames The frame size and how many frames are averaged
+ *    binned            Whether the mode was taken to bin
+ *    frame_ms          Simulated time between frames, as exposed
+ *    shot_ms           Simulated time from switching the frame size to the picture
+ *                      being saved: settling the exposure, the frames, and the card
+ *    rows, div, gain   The exposure it ended up with, and the level that made
+ *    level
+ *    frame_snr_db      The signal to noise ratio of one frame (SimCamera's model)
+ *    snr_db            That of the average, by the model: 10 log10(frames) more
+ *    measured_snr_db   That of the noisy frames, stacked and decoded
+ *    bytes             The size of the stacked JPEG of the noisy frames
+ *    stack_us          Real CPU time per frame to stack them on this machine
+ *    allocs            Heap allocations per stack
+ *
+ * The simulated numbers depend only on the code and the models, so they come out the same 
+ * every run and can be compared across firmware versions. Saving a picture mustn't touch the 
+ * heap, and neither must parsing the settings, metering or stacking, so if any of them allocates, the bench says so and
+ * exits with status 3 after writing the results. The results go out as JSON:
+ *
+ *    pio run -e native_bench && .pio/build/native_bench/program --json bench.json
+ *
+ * Options:
+ *    --json <file>       Where the JSON goes (default stdout)
+ *    --out <dir>         Scratch directory for the images (default /tmp); must exist
+ *    --shots <n>         Pictures per frame size and quality (default 50)
+ *    --scene <s>         flat, gradient or noise (default noise)
+ *    --bus <n>           SD card data lines, 1 or 4 (default 1)
+ *    --jpeg <file>       A picture to meter (default doc/PtWilsonBoathouse.jpg; left out if
+ *                        it can't be read)
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "HalLinux.h"
+#include "VirtualClock.h"
+#include "SimCamera.h"
+#include "SimStorage.h"
+#include "PinholeCamera.h"
+#include "PinholeConfig.h"
+#include "AutoExposure.h"
+#include "JpegMeter.h"
+#include "FrameQuality.h"
+#include "JpegStacker.h"
+#include "SimJpeg.h"
+#include "AllocCount.h"
+
+#define BENCH_VERSION     "0.5.0"                   // Firmware version the results are for
+#define BENCH_CARD_BYTES  (32000000000ULL)          // The simulated card is an empty 32GB one
+#define BENCH_PARSES      (10000)                   // Times to parse the settings
+#define BENCH_METERS      (20)                      // Times to meter (and decode) each picture
+#define BENCH_JUDGES      (10000)                   // Times to judge each picture
+#define BENCH_JPEG        "doc/PtWilsonBoathouse.jpg" // The default picture to meter
+#define BENCH_DIM_LIGHT   (3)                       // The dim scene's light: a pinhole indoors
+#define BENCH_DIM_QUALITY (85)                      // libjpeg's quality for the sensor's 10, as SimCamera maps it
+#define BENCH_DIM_SEED    (7)                       // Where the noisy frames' noise starts
+
+static const char *usage = 
+  "Usage: %s [--json <file>] [--out <dir>] [--shots <n>] [--scene flat|gradient|noise] [--bus 1|4]\n"
+  "  [--jpeg <file>]\n";
+
+static const char *const sizeNames[] = {"qvga", "cif", "vga", "svga", "xga", "sxga", "uxga"};
+static const char *const sceneNames[] = {"files", "flat", "gradient", "noise"};
+static const uint8_t qualities[] = {10, 20, 40};
+static const uint16_t lights[] = {240, 24, 3};     // Stock lens outdoors, a pinhole outdoors, one indoors
+static const uint8_t clockDivs[] = {AE_MAX_CLOCK_DIV, 1};
+static const uint8_t windows[] = {90, 80, 70, 50};
+
+// The ways to take a dim picture: a frame size and the number of frames averaged
+static const struct {
+  simFramesize_t frameSize;
+  uint8_t frames;
+} dimModes[] = {
+  {SIM_FRAMESIZE_UXGA, 1}, {SIM_FRAMESIZE_SVGA, 1}, {SIM_FRAMESIZE_SVGA, 4}, {SIM_FRAMESIZE_SVGA, 8},
+  {SIM_FRAMESIZE_CIF, 1}, {SIM_FRAMESIZE_CIF, 4}, {SIM_FRAMESIZE_CIF, 8}
+};
+
+// A pinhole.cfg that sets everything, the way someone might write it
+static const char benchConfig[] =
+  "# Pinhole camera settings\n"
+  "framesize = sxga          # a bit smaller than the sensor\n"
+  "jpeg_quality = 12\n"
+  "fb_count = 2\n"
+  "grab_mode = latest\n"
+  "xclk_freq_hz = 20000000\n"
+  "\n"
+  "# Stay up for ten minutes and save the battery in between\n"
+  "awake_millis = 600000\n"
+  "doze = yes\n"
+  "sensor_off = yes\n";
+
+// What one frame size and quality did
+struct benchResult_t {
+  simFramesize_t frameSize;
+  uint8_t quality;
+  uint8_t window;
+  int shots;
+  size_t imageBytes;
+  double shotsPerSec;
+  double mbPerSec;
+  double latencyMs[4];                            // 50th, 90th and 99th percentiles, and the worst
+  double allocsPerShot;
+  double hostUsPerShot;
+};
+
+// What parsing the settings did
+struct configResult_t {
+  size_t bytes;                                   // Size of the settings file
+  double hostUsPerParse;
+  double allocsPerParse;
+};
+
+// How finding the exposure went
+struct exposureResult_t {
+  uint16_t light;
+  uint8_t maxClockDiv;
+  aeResult_t ae;
+  double snrDb;
+};
+
+// What metering a picture did
+struct meterResult_t {
+  const char *name;
+  size_t bytes;
+  double meterUs;
+  double decodeUs;
+  jmStats_t metered;                              // From the DC coefficients
+  jmStats_t decoded;                              // From the pixels; "blocks" are pixels
+  fqVerdict_t verdict;
+  double judgeUs;
+  double allocsPerMeter;
+};
+
+// How a way of taking a dim picture did
+struct dimResult_t {
+  simFramesize_t frameSize;
+  uint8_t frames;
+  bool binned;
+  double frameMs;
+  double shotMs;
+  aeResult_t ae;
+  double frameSnrDb;                              // One frame's, by the model
+  double snrDb;                                   // The average's, by the model
+  double measuredSnrDb;                           // The noisy frames', stacked and decoded
+  size_t bytes;
+  double stackUs;
+  double allocsPerStack;
+};
+
+// Where decoding a picture in full is up to
+struct decodeState_t {
+  const uint16_t *quant;                          // Its luminance quantization table
+  uint16_t width;
+  uint16_t height;
+  jmStats_t *stats;                               // Where the pixels' histogram goes
+  uint64_t total;                                 // Sum of the pixels
+  uint64_t squares;                               // And of their squares
+};
+
+static float idctCos[8][8];                       // C(u) / 2 * cos((2x + 1) * u * pi / 16), by [x][u]
+
+static int64_t cpuMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Take shots pictures at the given frame size and quality and say how it went
+ *
+ * @return false  Something didn't work; says what on stderr
+ */
+static bool runOne(const char *outDir, const simCameraConfig_t &config, const simCardConfig_t &card,
+  uint8_t window, int shots, benchResult_t &result) {
+  VirtualClock clock;
+  LinuxLed led;
+  VirtualTimer ledTimer {clock};
+  LedPatterns leds {led, ledTimer};
+  SimCamera camera {clock};
+  SimStorage storage {outDir, clock, card};
+  LinuxCounter counter {outDir};
+  CardSpace space;
+  PinholeCamera pinhole {clock, camera, storage, counter, leds, space};
+  JpegMeter meter;
+  pinhole.setMeter(&meter);                       // As the camera does
+  leds.begin();
+  if (!camera.begin(config) || !camera.setWindow(window)) {
+    fprintf(stderr, "The camera didn't start.\n");
+    return false;
+  }
+  space.begin(BENCH_CARD_BYTES, BENCH_CARD_BYTES, card.clusterBytes, 0);
+  pinhole.begin();
+  std::vector<int64_t> latencies;
+  latencies.reserve(shots);
+
+  // One to get everything warmed up, then the real thing
+  if (pinhole.shoot() != PC_SAVED) {
+    fprintf(stderr, "The first shot failed.\n");
+    return false;
+  }
+  uint16_t firstImage = pinhole.imageCount();
+  uint64_t startAllocs = allocCount();
+  int64_t startCpuUs = cpuMicros();
+  int64_t startUs = clock.micros();
+  bool ok = true;
+  for (int i = 0; i < shots && ok; i++) {
+    int64_t shotUs = clock.micros();
+    ok = pinhole.shoot() == PC_SAVED;
+    latencies.push_back(pinhole.lastSavedMicros() - shotUs);
+  }
+  int64_t elapsedUs = clock.micros() - startUs;
+  int64_t cpuUs = cpuMicros() - startCpuUs;
+  uint64_t allocs = allocCount() - startAllocs;
+  if (!ok) {
+    fprintf(stderr, "A shot failed.\n");
+    return false;
+  }
+
+  // Clean up the images
+  halFrame_t frame;
+  camera.grab(frame);
+  result.imageBytes = frame.len;
+  camera.release(frame);
+  for (uint16_t i = firstImage; i <= pinhole.imageCount(); i++) {
+    char path[PC_PATH_LEN];
+    snprintf(path, sizeof(path), "/Image%u.jpg", (unsigned)i);
+    unlink(storage.localPath(path));
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  static const double percentiles[] = {0.50, 0.90, 0.99, 1.0};
+  for (int i = 0; i < 4; i++) {
+    size_t at = (size_t)(percentiles[i] * (shots - 1) + 0.5);
+    result.latencyMs[i] = latencies[at] / 1000.0;
+  }
+  result.frameSize = config.frameSize;
+  result.quality = config.jpegQuality;
+  result.window = window;
+  result.shots = shots;
+  result.shotsPerSec = shots * 1000000.0 / elapsedUs;
+  result.mbPerSec = result.shotsPerSec * result.imageBytes / 1000000.0;
+  result.allocsPerShot = (double)allocs / shots;
+  result.hostUsPerShot = (double)cpuUs / shots;
+  return true;
+}
+
+/**
+ * @brief Parse benchConfig BENCH_PARSES times
+ *
+ * @return false  It didn't parse cleanly; says so on stderr
+ */
+static bool runConfig(configResult_t &result) {
+  cfSettings_t settings;
+  cfDefaults(settings);
+  uint64_t startAllocs = allocCount();
+  int64_t startCpuUs = cpuMicros();
+  int errors = 0;
+  for (int i = 0; i < BENCH_PARSES; i++) {
+    errors += cfParse(benchConfig, sizeof(benchConfig) - 1, settings);
+  }
+  int64_t cpuUs = cpuMicros() - startCpuUs;
+  uint64_t allocs = allocCount() - startAllocs;
+  if (errors != 0 || settings.frameSize != CF_FRAMESIZE_SXGA || !settings.sensorOff) {
+    fprintf(stderr, "The settings didn't parse.\n");
+    return false;
+  }
+  result.bytes = sizeof(benchConfig) - 1;
+  result.hostUsPerParse = (double)cpuUs / BENCH_PARSES;
+  result.allocsPerParse = (double)allocs / BENCH_PARSES;
+  return true;
+}
+
+/**
+ * @brief Find the exposure for a flat UXGA scene with the given light, slowing the clock no more
+ * than maxClockDiv
+ *
+ * @return false  The camera didn't deliver
+ */
+static bool runExposure(uint16_t light, uint8_t maxClockDiv, exposureResult_t &result) {
+  VirtualClock clock;
+  SimCamera camera {clock};
+  simCameraConfig_t config;
+  config.scene = SIM_SCENE_FLAT;
+  config.light = light;
+  AutoExposure exposure {clock, camera, camera};
+  exposure.setMaxClockDiv(maxClockDiv);
+  clock.delayMicros(SIM_INIT_MICROS);             // As if the camera had just been started
+  if (!camera.begin(config) || !exposure.converge(result.ae)) {
+    fprintf(stderr, "Finding the exposure failed.\n");
+    return false;
+  }
+  result.light = light;
+  result.maxClockDiv = maxClockDiv;
+  result.snrDb = camera.snrDb();
+  return true;
+}
+
+/**
+ * @brief Decode a luminance block in full, the straightforward way: dequantize it, inverse
+ * transform it (rows, then columns) and add its pixels to the histogram
+ */
+static void decodeBlock(void *context, const int16_t *coef, uint8_t component, uint16_t blockX,
+  uint16_t blockY) {
+  decodeState_t &state = *(decodeState_t *)context;
+  if (component != 0) {
+    return;
+  }
+  float rows[64];
+  for (int v = 0; v < 8; v++) {
+    for (int x = 0; x < 8; x++) {
+      float sum = 0.0f;
+      for (int u = 0; u < 8; u++) {
+        sum += idctCos[x][u] * coef[v * 8 + u] * state.quant[v * 8 + u];
+      }
+      rows[v * 8 + x] = sum;
+    }
+  }
+  for (int y = 0; y < 8 && blockY * 8 + y < state.height; y++) {
+    for (int x = 0; x < 8 && blockX * 8 + x < state.width; x++) {
+      float sum = 0.0f;
+      for (int v = 0; v < 8; v++) {
+        sum += idctCos[y][v] * rows[v * 8 + x];
+      }
+      int level = (int)lroundf(sum) + 128;
+      level = level < 0 ? 0 : level > 255 ? 255 : level;
+      state.stats->histogram[level / (256 / JM_BINS)]++;
+      state.stats->blocks++;
+      state.total += level;
+      state.squares += (uint64_t)(level * level);
+    }
+  }
+}
+
+/**
+ * @brief Meter the given JPEG BENCH_METERS times, and decode it in full as often, and say how
+ * it went
+ *
+ * @return false  The meter couldn't read it; says so on stderr
+ */
+static bool runMeter(const char *name, const std::vector<uint8_t> &jpeg, meterResult_t &result) {
+  for (int x = 0; x < 8; x++) {
+    for (int u = 0; u < 8; u++) {
+      idctCos[x][u] = (u == 0 ? sqrtf(0.5f) : 1.0f) / 2.0f * cosf((2 * x + 1) * u * (float)M_PI / 16.0f);
+    }
+  }
+  JpegMeter meter;
+  uint64_t startAllocs = allocCount();
+  int64_t startCpuUs = cpuMicros();
+  bool ok = true;
+  for (int i = 0; i < BENCH_METERS && ok; i++) {
+    ok = meter.meter(jpeg.data(), jpeg.size(), result.metered);
+  }
+  int64_t cpuUs = cpuMicros() - startCpuUs;
+  uint64_t allocs = allocCount() - startAllocs;
+  if (!ok) {
+    fprintf(stderr, "Unable to meter '%s'.\n", name);
+    return false;
+  }
+  decodeState_t state;
+  jmStats_t ignored;
+  startCpuUs = cpuMicros();
+  for (int i = 0; i < BENCH_METERS && ok; i++) {
+    state.quant = meter.lumaQuant();
+    state.width = result.metered.width;
+    state.height = result.metered.height;
+    state.stats = &result.decoded;
+    state.total = state.squares = 0;
+    result.decoded = jmStats_t {};
+    ok = meter.meter(jpeg.data(), jpeg.size(), ignored, decodeBlock, &state);
+  }
+  result.decodeUs = (double)(cpuMicros() - startCpuUs) / BENCH_METERS;
+  result.decoded.mean = (uint8_t)(state.total / (result.decoded.blocks == 0 ? 1 : result.decoded.blocks));
+  startCpuUs = cpuMicros();
+  for (int i = 0; i < BENCH_JUDGES; i++) {
+    result.verdict = fqJudge(result.metered, FQ_MIN_FINE);
+  }
+  result.judgeUs = (double)(cpuMicros() - startCpuUs) / BENCH_JUDGES;
+  result.name = name;
+  result.bytes = jpeg.size();
+  result.meterUs = (double)cpuUs / BENCH_METERS;
+  result.allocsPerMeter = (double)allocs / BENCH_METERS;
+  return ok;
+}
+
+/**
+ * @brief A normally distributed random number with mean 0 and standard deviation 1, from
+ * rand() by the Box-Muller transform
+ */
+static double gaussian() {
+  double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+  double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+  return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+/**
+ * @brief Make frames of the given size, all at level with the given noise, stack them and
+ * decode the average, finding its signal to noise ratio
+ *
+ * @return false  They didn't stack; says so on stderr
+ */
+static bool measureStack(uint16_t width, uint16_t height, uint8_t level, double noise, dimResult_t &result) {
+  std::vector<std::vector<uint8_t>> jpegs(result.frames);
+  std::vector<uint8_t> pixels((size_t)width * height);
+  srand(BENCH_DIM_SEED);
+  for (std::vector<uint8_t> &jpeg : jpegs) {
+    for (uint8_t &pixel : pixels) {
+      long v = lround(level + noise * gaussian());
+      pixel = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+    simJpegEncodeGray(pixels.data(), width, height, BENCH_DIM_QUALITY, jpeg);
+  }
+  uint32_t blocks = JpegStacker::blocksFor(width, height);
+  std::vector<int16_t> sums((size_t)blocks * 64);
+  std::vector<uint8_t> out((size_t)width * height);
+  JpegStacker stacker;
+  stacker.setBuffers(sums.data(), blocks, out.data(), out.size());
+  uint64_t startAllocs = allocCount();
+  int64_t startCpuUs = cpuMicros();
+  bool ok = true;
+  for (const std::vector<uint8_t> &jpeg : jpegs) {
+    ok = ok && stacker.add(jpeg.data(), jpeg.size());
+  }
+  size_t len = 0;
+  ok = ok && stacker.finish(len);
+  result.stackUs = (double)(cpuMicros() - startCpuUs) / result.frames;
+  result.allocsPerStack = (double)(allocCount() - startAllocs);
+  JpegMeter meter;
+  jmStats_t metered;
+  jmStats_t decoded {};
+  decodeState_t state {nullptr, width, height, &decoded, 0, 0};
+  if (!ok || !meter.meter(stacker.jpeg(), len, metered)) {
+    fprintf(stderr, "Stacking %u frames didn't work.\n", result.frames);
+    return false;
+  }
+  state.quant = meter.lumaQuant();
+  meter.meter(stacker.jpeg(), len, metered, decodeBlock, &state);
+  double mean = (double)state.total / decoded.blocks;
+  double variance = (double)state.squares / decoded.blocks - mean * mean;
+  result.measuredSnrDb = variance > 0 ? 20 * log10(mean / sqrt(variance)) : INFINITY;
+  result.bytes = len;
+  return true;
+}
+
+/**
+ * @brief Take a picture of the dim scene the given way: from the exposure for UXGA, switch to
+ * the mode's frame size, find the exposure for it, and take and save the picture
+ *
+ * @return false  Something didn't work; says what on stderr
+ */
+static bool runDim(const char *outDir, const simCardConfig_t &card, simFramesize_t frameSize,
+  uint8_t frames, bool binned, dimResult_t &result) {
+  VirtualClock clock;
+  LinuxLed led;
+  VirtualTimer ledTimer {clock};
+  LedPatterns leds {led, ledTimer};
+  SimCamera camera {clock};
+  SimStorage storage {outDir, clock, card};
+  LinuxCounter counter {outDir};
+  CardSpace space;
+  PinholeCamera pinhole {clock, camera, storage, counter, leds, space};
+  JpegMeter meter;
+  pinhole.setMeter(&meter);
+  uint32_t blocks = JpegStacker::blocksFor(800, 600); // As the camera does for SVGA
+  std::vector<int16_t> sums((size_t)blocks * 64);
+  std::vector<uint8_t> out(800 * 600 / 5);
+  JpegStacker stacker;
+  stacker.setBuffers(sums.data(), blocks, out.data(), out.size());
+  pinhole.setStacker(&stacker);
+  AutoExposure exposure {clock, camera, camera};
+  simCameraConfig_t config;
+  config.scene = SIM_SCENE_FLAT;
+  config.light = BENCH_DIM_LIGHT;
+  config.binned = binned;
+  leds.begin();
+  clock.delayMicros(SIM_INIT_MICROS);
+  if (!camera.begin(config) || !exposure.converge(result.ae)) {
+    fprintf(stderr, "The camera didn't start.\n");
+    return false;
+  }
+  space.begin(BENCH_CARD_BYTES, BENCH_CARD_BYTES, card.clusterBytes, 0);
+  pinhole.begin();
+  int64_t startUs = clock.micros();
+  if (!camera.setFrameSize((halFramesize_t)frameSize)) {
+    fprintf(stderr, "Switching to %s didn't work.\n", sizeNames[frameSize]);
+    return false;
+  }
+  exposure.setFrameSize((halFramesize_t)frameSize);
+  if (!exposure.converge(result.ae) || pinhole.shoot(clock.micros(), frames) != PC_SAVED ||
+    pinhole.lastFrames() != frames) {
+    fprintf(stderr, "Taking %u %s frames didn't work.\n", frames, sizeNames[frameSize]);
+    return false;
+  }
+  result.shotMs = (pinhole.lastSavedMicros() - startUs) / 1000.0;
+  unlink(storage.localPath(pinhole.lastPath()));
+  result.frameSize = frameSize;
+  result.frames = frames;
+  result.binned = binned;
+  result.frameMs = camera.frameMicros() / 1000.0;
+  result.frameSnrDb = camera.snrDb();
+  result.snrDb = result.frameSnrDb + 10 * log10((double)frames);
+  halFrame_t frame;
+  if (!camera.grab(frame)) {
+    return false;
+  }
+  uint16_t width = frame.width;
+  uint16_t height = frame.height;
+  camera.release(frame);
+  double noise = result.ae.level / pow(10.0, result.frameSnrDb / 20);
+  return measureStack(width, height, result.ae.level, noise, result);
+}
+
+static void writeJson(FILE *f, const std::vector<benchResult_t> &results, const configResult_t &configResult,
+  const std::vector<exposureResult_t> &exposures, const std::vector<meterResult_t> &meters,
+  const std::vector<dimResult_t> &dims, const simCameraConfig_t &config, const simCardConfig_t &card) {
+  fprintf(f, "{\n  \"version\": \"%s\",\n  \"scene\": \"%s\",\n  \"fb_count\": %u,\n  \"bus_width\": %u,\n"
+    "  \"config_parse\": {\"bytes\": %zu, \"host_us\": %.3f, \"allocs\": %.2f},\n"
+    "  \"exposure\": [\n", BENCH_VERSION, sceneNames[config.scene], config.fbCount, card.busWidth, 
+    configResult.bytes, configResult.hostUsPerParse, configResult.allocsPerParse);
+  for (size_t i = 0; i < exposures.size(); i++) {
+    const exposureResult_t &e = exposures[i];
+    fprintf(f, "    {\"light\": %u, \"clock_div\": %u, \"converged\": %s, \"changes\": %u, "
+      "\"settle_ms\": %.1f, \"rows\": %u, \"div\": %u, \"gain\": %u, \"level\": %u, \"snr_db\": %.1f}%s\n",
+      e.light, e.maxClockDiv, e.ae.converged ? "true" : "false", e.ae.steps, e.ae.micros / 1000.0, 
+      e.ae.exposure.lines, e.ae.exposure.clockDiv, e.ae.exposure.gain, e.ae.level, e.snrDb,
+      i + 1 < exposures.size() ? "," : "");
+  }
+  fprintf(f, "  ],\n  \"jpeg_meter\": [\n");
+  for (size_t i = 0; i < meters.size(); i++) {
+    const meterResult_t &m = meters[i];
+    fprintf(f, "    {\"name\": \"%s\", \"bytes\": %zu, \"meter_us\": %.1f, \"decode_us\": %.1f, "
+      "\"metered\": {\"mean\": %u, \"p5\": %u, \"p50\": %u, \"p95\": %u}, "
+      "\"decoded\": {\"mean\": %u, \"p5\": %u, \"p50\": %u, \"p95\": %u}, \"verdict\": \"%s\", "
+      "\"judge_us\": %.3f, \"allocs\": %.2f}%s\n",
+      m.name, m.bytes, m.meterUs, m.decodeUs, m.metered.mean, JpegMeter::percentile(m.metered, 5),
+      JpegMeter::percentile(m.metered, 50), JpegMeter::percentile(m.metered, 95), m.decoded.mean,
+      JpegMeter::percentile(m.decoded, 5), JpegMeter::percentile(m.decoded, 50),
+      JpegMeter::percentile(m.decoded, 95), fqName(m.verdict), m.judgeUs, m.allocsPerMeter,
+      i + 1 < meters.size() ? "," : "");
+  }
+  fprintf(f, "  ],\n  \"dim_modes\": [\n");
+  for (size_t i = 0; i < dims.size(); i++) {
+    const dimResult_t &d = dims[i];
+    fprintf(f, "    {\"framesize\": \"%s\", \"frames\": %u, \"binned\": %s, \"frame_ms\": %.1f, "
+      "\"shot_ms\": %.1f, \"rows\": %u, \"div\": %u, \"gain\": %u, \"level\": %u, \"frame_snr_db\": %.1f, "
+      "\"snr_db\": %.1f, \"measured_snr_db\": %.1f, \"bytes\": %zu, \"stack_us\": %.0f, \"allocs\": %.2f}%s\n",
+      sizeNames[d.frameSize], d.frames, d.binned ? "true" : "false", d.frameMs, d.shotMs,
+      d.ae.exposure.lines, d.ae.exposure.clockDiv, d.ae.exposure.gain, d.ae.level, d.frameSnrDb,
+      d.snrDb, d.measuredSnrDb, d.bytes, d.stackUs, d.allocsPerStack, i + 1 < dims.size() ? "," : "");
+  }
+  fprintf(f, "  ],\n  \"results\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const benchResult_t &r = results[i];
+    fprintf(f, "    {\"framesize\": \"%s\", \"quality\": %u, \"window\": %u, \"shots\": %d, \"image_bytes\": %zu, "
+      "\"shots_per_s\": %.3f, \"mb_per_s\": %.3f, \"latency_ms\": {\"p50\": %.3f, \"p90\": %.3f, "
+      "\"p99\": %.3f, \"max\": %.3f}, \"allocs_per_shot\": %.2f, \"host_us_per_shot\": %.1f}%s\n",
+      sizeNames[r.frameSize], r.quality, r.window, r.shots, r.imageBytes, r.shotsPerSec, r.mbPerSec, 
+      r.latencyMs[0], r.latencyMs[1], r.latencyMs[2], r.latencyMs[3], r.allocsPerShot, 
+      r.hostUsPerShot, i + 1 < results.size() ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+}
+
+int main(int argc, char **argv) {
+  const char *jsonPath = nullptr;
+  const char *outDir = "/tmp";
+  const char *jpegPath = BENCH_JPEG;
+  int shots = 50;
+  simCameraConfig_t config;
+  simCardConfig_t card;
+  config.scene = SIM_SCENE_NOISE;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[++i] : nullptr;
+    if (value == nullptr) {
+      fprintf(stderr, usage, argv[0]);
+      return 2;
+    }
+    if (strcmp(arg, "--json") == 0) {
+      jsonPath = value;
+    } else if (strcmp(arg, "--out") == 0) {
+      outDir = value;
+    } else if (strcmp(arg, "--shots") == 0 && atoi(value) > 0) {
+      shots = atoi(value);
+    } else if (strcmp(arg, "--scene") == 0 && strcmp(value, "flat") == 0) {
+      config.scene = SIM_SCENE_FLAT;
+    } else if (strcmp(arg, "--scene") == 0 && strcmp(value, "gradient") == 0) {
+      config.scene = SIM_SCENE_GRADIENT;
+    } else if (strcmp(arg, "--scene") == 0 && strcmp(value, "noise") == 0) {
+      config.scene = SIM_SCENE_NOISE;
+    } else if (strcmp(arg, "--bus") == 0 && (atoi(value) == 1 || atoi(value) == 4)) {
+      card.busWidth = (uint8_t)atoi(value);
+    } else if (strcmp(arg, "--jpeg") == 0) {
+      jpegPath = value;
+    } else {
+      fprintf(stderr, usage, argv[0]);
+      return 2;
+    }
+  }
+
+  halLogTo(nullptr);
+  configResult_t configResult;
+  if (!runConfig(configResult)) {
+    return 1;
+  }
+  fprintf(stderr, "config %zu bytes %.3f us/parse %.1f allocs/parse\n", configResult.bytes, 
+    configResult.hostUsPerParse, configResult.allocsPerParse);
+  std::vector<exposureResult_t> exposures;
+  for (uint16_t light : lights) {
+    for (uint8_t maxClockDiv : clockDivs) {
+      exposureResult_t result;
+      if (!runExposure(light, maxClockDiv, result)) {
+        return 1;
+      }
+      exposures.push_back(result);
+      fprintf(stderr, "light %-4u div <= %u  %u changes %7.1f ms  %4u rows / %u gain %2u  level %3u %5.1f dB%s\n",
+        light, maxClockDiv, result.ae.steps, result.ae.micros / 1000.0, result.ae.exposure.lines, 
+        result.ae.exposure.clockDiv, result.ae.exposure.gain, result.ae.level, result.snrDb,
+        result.ae.converged ? "" : "  (not converged)");
+    }
+  }
+  std::vector<meterResult_t> meters;
+  std::vector<uint8_t> jpeg;
+  FILE *jpegFile = fopen(jpegPath, "rb");
+  if (jpegFile != nullptr) {
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), jpegFile)) > 0) {
+      jpeg.insert(jpeg.end(), chunk, chunk + n);
+    }
+    fclose(jpegFile);
+  }
+  std::vector<uint8_t> synthetic;
+  VirtualClock meterClock;
+  SimCamera meterCamera {meterClock};
+  simCameraConfig_t meterConfig = config;
+  meterConfig.frameSize = SIM_FRAMESIZE_UXGA;
+  meterConfig.jpegQuality = 10;
+  halFrame_t frame;
+  if (!meterCamera.begin(meterConfig) || !meterCamera.grab(frame)) {
+    fprintf(stderr, "The camera didn't start.\n");
+    return 1;
+  }
+  synthetic.assign(frame.buf, frame.buf + frame.len);
+  meterCamera.release(frame);
+  std::vector<uint8_t> capped;
+  meterCamera.cover(true);
+  if (!meterCamera.restart() || !meterCamera.grab(frame)) {
+    fprintf(stderr, "The camera didn't restart.\n");
+    return 1;
+  }
+  capped.assign(frame.buf, frame.buf + frame.len);
+  meterCamera.release(frame);
+  static const char *const syntheticNames[] = {"files", "uxga flat", "uxga gradient", "uxga noise"};
+  const char *names[] = {jpegPath, syntheticNames[config.scene], "uxga capped"};
+  const std::vector<uint8_t> *pictures[] = {&jpeg, &synthetic, &capped};
+  for (int i = 0; i < 3; i++) {
+    if (pictures[i]->empty()) {
+      fprintf(stderr, "Unable to read '%s'; not metering it.\n", names[i]);
+      continue;
+    }
+    meterResult_t result;
+    if (!runMeter(names[i], *pictures[i], result)) {
+      return 1;
+    }
+    meters.push_back(result);
+    fprintf(stderr, "meter %s %zu bytes: %.0f us vs %.0f us decoded (%.1fx); mean %u vs %u, "
+      "p5 %u vs %u, p95 %u vs %u; %s, judged in %.3f us\n", result.name, result.bytes, result.meterUs,
+      result.decodeUs, result.decodeUs / result.meterUs, result.metered.mean, result.decoded.mean,
+      JpegMeter::percentile(result.metered, 5), JpegMeter::percentile(result.decoded, 5),
+      JpegMeter::percentile(result.metered, 95), JpegMeter::percentile(result.decoded, 95),
+      fqName(result.verdict), result.judgeUs);
+  }
+  std::vector<dimResult_t> dims;
+  for (bool binned : {false, true}) {
+    for (const auto &mode : dimModes) {
+      dimResult_t result;
+      if (!runDim(outDir, card, mode.frameSize, mode.frames, binned, result)) {
+        return 1;
+      }
+      dims.push_back(result);
+      fprintf(stderr, "dim %-4s x%u %-7s %6.1f ms/frame %7.1f ms/shot  %3u rows / %u gain %2u  level %3u  "
+        "%5.1f dB/frame %5.1f dB, %5.1f dB measured  %6zu bytes\n", sizeNames[mode.frameSize], mode.frames,
+        binned ? "binned" : "skipped", result.frameMs, result.shotMs, result.ae.exposure.lines,
+        result.ae.exposure.clockDiv, result.ae.exposure.gain, result.ae.level, result.frameSnrDb,
+        result.snrDb, result.measuredSnrDb, result.bytes);
+    }
+  }
+  std::vector<benchResult_t> results;
+  for (int size = SIM_FRAMESIZE_QVGA; size <= SIM_FRAMESIZE_UXGA; size++) {
+    for (uint8_t quality : qualities) {
+      config.frameSize = (simFramesize_t)size;
+      config.jpegQuality = quality;
+      benchResult_t result;
+      if (!runOne(outDir, config, card, 100, shots, result)) {
+        return 1;
+      }
+      results.push_back(result);
+      fprintf(stderr, "%-5s q%-3u %8zu bytes %6.2f shots/s  p50 %7.1f ms  p99 %7.1f ms  %5.1f allocs/shot\n",
+        sizeNames[size], quality, result.imageBytes, result.shotsPerSec, result.latencyMs[0], 
+        result.latencyMs[2], result.allocsPerShot);
+    }
+  }
+  for (simFramesize_t size : {SIM_FRAMESIZE_UXGA, SIM_FRAMESIZE_SVGA}) {
+    for (uint8_t window : windows) {
+      config.frameSize = size;
+      config.jpegQuality = qualities[0];
+      benchResult_t result;
+      if (!runOne(outDir, config, card, window, shots, result)) {
+        return 1;
+      }
+      results.push_back(result);
+      fprintf(stderr, "%-5s q%-3u %3u%% %8zu bytes %6.2f shots/s  p50 %7.1f ms  p99 %7.1f ms  %5.1f allocs/shot\n",
+        sizeNames[size], qualities[0], window, result.imageBytes, result.shotsPerSec, result.latencyMs[0], 
+        result.latencyMs[2], result.allocsPerShot);
+    }
+  }
+
+  FILE *f = jsonPath == nullptr ? stdout : fopen(jsonPath, "w");
+  if (f == nullptr) {
+    fprintf(stderr, "Unable to write '%s'.\n", jsonPath);
+    return 1;
+  }
+  writeJson(f, results, configResult, exposures, meters, dims, config, card);
+  if (f != stdout && fclose(f) != 0) {
+    return 1;
+  }
+  int allocating = 0;
+  if (configResult.allocsPerParse > 0) {
+    fprintf(stderr, "Parsing the settings allocates %.2f times; it should never allocate.\n",
+      configResult.allocsPerParse);
+    allocating++;
+  }
+  for (const meterResult_t &m : meters) {
+    if (m.allocsPerMeter > 0) {
+      fprintf(stderr, "Metering %s allocates %.2f times; it should never allocate.\n", m.name,
+        m.allocsPerMeter);
+      allocating++;
+    }
+  }
+  for (const dimResult_t &d : dims) {
+    if (d.allocsPerStack > 0) {
+      fprintf(stderr, "Stacking %u %s frames allocates %.2f times; it should never allocate.\n", d.frames,
+        sizeNames[d.frameSize], d.allocsPerStack);
+      allocating++;
+    }
+  }
+  for (const benchResult_t &r : results) {
+    if (r.allocsPerShot > 0) {
+      fprintf(stderr, "%s q%u at %u%% allocates %.2f times per shot; the save path should never allocate.\n",
+        sizeNames[r.frameSize], r.quality, r.window, r.allocsPerShot);
+      allocating++;
+    }
+  }
+  return allocating == 0 ? 0 : 3;
+}
@@ -0,0 +1,142 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * FaultStorage.cpp
+ *
+ * Implementation of storage and a counter whose power can be cut. See FaultStorage.h.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include "FaultStorage.h"
+
+void PowerRail::cutAfter(int64_t steps) {
+  stepsLeft = steps;
+}
+
+bool PowerRail::step() {
+  if (stepsLeft == 0) {
+    return false;
+  }
+  if (stepsLeft > 0) {
+    stepsLeft--;
+  }
+  stepCount++;
+  return true;
+}
+
+bool PowerRail::on() const {
+  return stepsLeft != 0;
+}
+
+uint32_t PowerRail::steps() const {
+  return stepCount;
+}
+
+FaultStorage::FaultStorage(PowerRail &rail, uint32_t clusterBytes) : 
+  rail(rail), clusterBytes(clusterBytes) {
+}
+
+/**
+ * With the power off, open() still hands out a handle; the code doing the saving can't tell
+ * the power is off, and it doesn't matter what it does from then on.
+ */
+int FaultStorage::open(const char *path) {
+  if (opensToFail != 0) {
+    opensToFail--;
+    return -1;
+  }
+  for (int i = 0; i < FS_MAX_FILES; i++) {
+    if (!handles[i].isOpen) {
+      if (rail.step()) {
+        card[path] = fsFile_t {{}, 0};
+      }
+      handles[i].isOpen = true;
+      handles[i].path = path;
+      handles[i].written = 0;
+      return i;
+    }
+  }
+  return -1;
+}
+
+size_t FaultStorage::write(int handle, const uint8_t *buf, size_t len) {
+  fsHandle_t &h = handles[handle];
+  size_t done = 0;
+  while (done < len) {
+    size_t chunk = clusterBytes - (h.written + done) % clusterBytes;
+    chunk = chunk < len - done ? chunk : len - done;
+    if (rail.step()) {
+      std::vector<uint8_t> &data = card[h.path].data;
+      data.resize(h.written + done);
+      data.insert(data.end(), buf + done, buf + done + chunk);
+    }
+    done += chunk;
+  }
+  h.written += len;
+  return len;
+}
+
+bool FaultStorage::close(int handle) {
+  fsHandle_t &h = handles[handle];
+  if (rail.step()) {
+    card[h.path].size = h.written;
+  }
+  h.isOpen = false;
+  return true;
+}
+
+bool FaultStorage::exists(const char *path) {
+  return card.count(path) != 0;
+}
+
+/**
+ * Mounting is a step: with the power off, the card doesn't come back.
+ */
+bool FaultStorage::remount() {
+  if (!rail.step()) {
+    return false;
+  }
+  reboot();
+  return true;
+}
+
+void FaultStorage::failOpens(uint8_t n) {
+  opensToFail = n;
+}
+
+void FaultStorage::reboot() {
+  for (int i = 0; i < FS_MAX_FILES; i++) {
+    handles[i].isOpen = false;
+  }
+}
+
+const std::map<std::string, fsFile_t> &FaultStorage::files() const {
+  return card;
+}
+
+FaultCounter::FaultCounter(PowerRail &rail, uint16_t initial) : 
+  rail(rail), durable(initial), value(initial) {
+}
+
+uint16_t FaultCounter::read() {
+  return value;
+}
+
+void FaultCounter::write(uint16_t value) {
+  this->value = value;
+}
+
+bool FaultCounter::commit() {
+  if (rail.step()) {
+    durable = value;
+  }
+  return true;
+}
+
+void FaultCounter::reboot() {
+  value = durable;
+}
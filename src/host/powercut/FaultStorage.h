@@ -0,0 +1,130 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * FaultStorage.h
+ *
+ * Storage and an image counter whose power can be cut, for the power cut harness. Both keep 
+ * their contents in memory and split them into what has actually made it onto the card or 
+ * into flash (durable) and what hasn't yet. Every operation that changes durable state is a
+ * step on the PowerRail they share; the rail can be set to cut the power after any number of
+ * steps, after which nothing more becomes durable. reboot() then throws away everything that
+ * wasn't durable, as a power cycle would.
+ *
+ * The storage works the way FatFs does on an SD card:
+ *
+ *    Operation   Becomes durable
+ *    ==========  ===========================================================
+ *    open()      The directory entry, with size 0 (an existing file is truncated)
+ *    write()     The data, one cluster at a time, but not the file's size
+ *    close()     The file's size in the directory entry
+ *
+ * So a file the power went out on before close() is there, but empty. The counter works the
+ * way the ESP32's "EEPROM" (really NVS) does: commit() is all or nothing.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include "Hal.h"
+
+#define FS_MAX_FILES      (2)                       // Max files open at once
+
+// The power, and the count of durable steps taken on it
+class PowerRail {
+  public:
+    /**
+     * @brief Cut the power after the given number of steps from now; -1 means never
+     */
+    void cutAfter(int64_t steps);
+
+    /**
+     * @brief Take a step: something is about to become durable
+     *
+     * @return true   The power's on; it does
+     * @return false  The power's off; it doesn't
+     */
+    bool step();
+
+    /**
+     * @brief Whether the power is on
+     */
+    bool on() const;
+
+    /**
+     * @brief The number of steps taken with the power on
+     */
+    uint32_t steps() const;
+
+  private:
+    int64_t stepsLeft = -1;
+    uint32_t stepCount = 0;
+};
+
+// A file as it is on the card
+struct fsFile_t {
+  std::vector<uint8_t> data;                      // What's been written to its clusters
+  size_t size;                                    // The size in its directory entry
+};
+
+class FaultStorage : public HalStorage {
+  public:
+    FaultStorage(PowerRail &rail, uint32_t clusterBytes);
+    int open(const char *path) override;
+    size_t write(int handle, const uint8_t *buf, size_t len) override;
+    bool close(int handle) override;
+    bool exists(const char *path) override;
+    bool remount() override;
+
+    /**
+     * @brief Have the next n calls to open() fail, as a card that's gone bad would
+     */
+    void failOpens(uint8_t n);
+
+    /**
+     * @brief Forget everything that isn't durable (i.e., the open files)
+     */
+    void reboot();
+
+    /**
+     * @brief The files on the card. Reading one back gets the first size bytes of its data.
+     */
+    const std::map<std::string, fsFile_t> &files() const;
+
+  private:
+    // An open file
+    struct fsHandle_t {
+      bool isOpen = false;
+      std::string path;
+      size_t written = 0;
+    };
+
+    PowerRail &rail;
+    uint32_t clusterBytes;
+    std::map<std::string, fsFile_t> card;
+    fsHandle_t handles[FS_MAX_FILES];
+    uint8_t opensToFail = 0;
+};
+
+class FaultCounter : public HalCounter {
+  public:
+    FaultCounter(PowerRail &rail, uint16_t initial = 0);
+    uint16_t read() override;
+    void write(uint16_t value) override;
+    bool commit() override;
+
+    /**
+     * @brief Forget the value if it wasn't committed
+     */
+    void reboot();
+
+  private:
+    PowerRail &rail;
+    uint16_t durable;
+    uint16_t value;
+};
@@ -0,0 +1,315 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * powercut.cpp
+ *
+ * Power cut harness for saving pictures. Takes a few pictures with PinholeCamera on storage
+ * and an image counter whose power can be cut (see FaultStorage.h), cutting the power after 
+ * each step in turn: every directory entry, cluster, file size, counter commit and LED 
+ * flash. After 
+ * each cut it "reboots", takes two more pictures and checks that:
+ *
+ *    - every picture whose LED flash said it was saved is on the card, whole, and
+ *    - every picture that was whole on the card when the power went out still is, i.e., 
+ *      its number wasn't used again.
+ *
+ * Pictures the power went out on before the LED said they were saved may be lost; the person
+ * holding the camera knows to take those again. Each run uses different image sizes and a 
+ * different number of pictures already on the card, and is done twice: once as is and once
+ * with the card refusing to create the first picture's file, so that saving it fails.
+ *
+ *    pio run -e native_powercut && .pio/build/native_powercut/program --runs 1000
+ *
+ * Options:
+ *    --runs <n>      Number of runs, each cutting the power at every step (default 100)
+ *    --shots <n>     Pictures per run before the reboot (default 3)
+ *    --seed <n>      Where the sizes start (default 1)
+ *
+ * Exits with 0 if nothing went wrong and 1, after describing the first few, if anything did.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "FaultStorage.h"
+#include "HalLinux.h"
+#include "VirtualClock.h"
+#include "PinholeCamera.h"
+
+#define PC_CLUSTER_BYTES  (4096)                    // Small clusters, so more places to cut
+#define PC_CARD_BYTES     (1000000000ULL)           // Card size; it never fills
+#define PC_MAX_REPORTS    (10)                      // Most problems to describe
+#define PC_HEADER_BYTES   (8)                       // Frame length and sequence number
+
+static const char *usage = "Usage: %s [--runs <n>] [--shots <n>] [--seed <n>]\n";
+
+/**
+ * A camera whose frames say which frame they are: each starts with its length and a sequence
+ * number and is filled with a pattern that depends on the sequence number.
+ */
+class SeqCamera : public HalCamera {
+  public:
+    uint32_t nextSeq = 1;                         // The next frame's sequence number
+    size_t nextLen = 1000;                        // The next frame's length
+
+    bool grab(halFrame_t &frame) override {
+      buf.resize(nextLen);
+      for (size_t i = 0; i < nextLen; i++) {
+        buf[i] = (uint8_t)(nextSeq * 7 + i);
+      }
+      for (int i = 0; i < 4; i++) {
+        buf[i] = (uint8_t)(nextLen >> (8 * i));
+        buf[4 + i] = (uint8_t)(nextSeq >> (8 * i));
+      }
+      frame.buf = buf.data();
+      frame.len = nextLen;
+      frame.width = frame.height = 0;
+      frame.timestampUs = 0;
+      frame.handle = nullptr;
+      nextSeq++;
+      return true;
+    }
+
+    void release(halFrame_t &frame) override {
+      frame.buf = nullptr;
+    }
+
+    bool restart() override {
+      return true;
+    }
+
+  private:
+    std::vector<uint8_t> buf;
+};
+
+/**
+ * An LED that notices whether it came on while the power was on; that's the "saved" signal.
+ * Coming on is a step, so the power can go out just after the LED says a picture is saved.
+ */
+class ProbeLed : public HalLed {
+  public:
+    ProbeLed(PowerRail &rail) : rail(rail) {}
+    bool seen = false;
+
+    void set(bool on) override {
+      if (on && rail.step()) {
+        seen = true;
+      }
+    }
+
+  private:
+    PowerRail &rail;
+};
+
+/**
+ * @brief The sequence number of the frame in the given file if it's whole, or 0 if it isn't
+ */
+static uint32_t wholeSeq(const fsFile_t &file) {
+  if (file.size < PC_HEADER_BYTES || file.data.size() < file.size) {
+    return 0;
+  }
+  size_t len = 0;
+  uint32_t seq = 0;
+  for (int i = 0; i < 4; i++) {
+    len |= (size_t)file.data[i] << (8 * i);
+    seq |= (uint32_t)file.data[4 + i] << (8 * i);
+  }
+  if (len != file.size) {
+    return 0;
+  }
+  for (size_t i = PC_HEADER_BYTES; i < len; i++) {
+    if (file.data[i] != (uint8_t)(seq * 7 + i)) {
+      return 0;
+    }
+  }
+  return seq;
+}
+
+/**
+ * @brief The whole pictures on the card: path -> sequence number
+ */
+static std::map<std::string, uint32_t> wholeFiles(const FaultStorage &storage) {
+  std::map<std::string, uint32_t> whole;
+  for (const auto &entry : storage.files()) {
+    uint32_t seq = wholeSeq(entry.second);
+    if (seq != 0) {
+      whole[entry.first] = seq;
+    }
+  }
+  return whole;
+}
+
+/**
+ * @brief The length for a frame: anything from a few bytes to a few clusters
+ */
+static size_t frameLen(uint32_t &rng) {
+  rng = rng * 1103515245 + 12345;
+  return PC_HEADER_BYTES + (rng >> 8) % (PC_CLUSTER_BYTES * 3);
+}
+
+/**
+ * @brief Take shots pictures, cutting the power after cutAfter steps (-1 for never), then 
+ * reboot, take two more and check the card
+ *
+ * @param seed      Decides the frame sizes and how many pictures are on the card to start
+ * @param failFirst Whether the card refuses to create the first picture's file
+ * @param steps     Set to the number of steps taken before the reboot
+ * @param problem   Set to what went wrong, if anything did
+ * @return true     Everything's as it should be
+ */
+static bool runOne(uint32_t seed, bool failFirst, int shots, int64_t cutAfter, uint32_t &steps, 
+  std::string &problem) {
+  PowerRail rail;
+  FaultStorage storage {rail, PC_CLUSTER_BYTES};
+  SeqCamera camera;
+  uint32_t rng = seed;
+
+  // Some pictures already on the card
+  uint16_t already = (uint16_t)(seed % 4);
+  for (uint16_t i = 1; i <= already; i++) {
+    char path[PC_PATH_LEN];
+    snprintf(path, sizeof(path), "/Image%u.jpg", (unsigned)i);
+    halFrame_t frame;
+    camera.nextLen = frameLen(rng);
+    camera.grab(frame);
+    int h = storage.open(path);
+    storage.write(h, frame.buf, frame.len);
+    storage.close(h);
+  }
+  FaultCounter counter {rail, already};
+  rail.cutAfter(cutAfter);
+  uint32_t stepsBefore = rail.steps();
+
+  // Take pictures until done or the power goes out
+  std::map<std::string, uint32_t> acked;
+  {
+    VirtualClock clock;
+    ProbeLed led {rail};
+    VirtualTimer ledTimer {clock};
+    LedPatterns leds {led, ledTimer};
+    CardSpace space;
+    space.begin(PC_CARD_BYTES, PC_CARD_BYTES, PC_CLUSTER_BYTES, 0);
+    PinholeCamera pinhole {clock, camera, storage, counter, leds, space};
+    leds.begin();
+    pinhole.begin();
+    if (failFirst) {
+      storage.failOpens(PC_SAVE_TRIES);
+    }
+    for (int i = 0; i < shots && rail.on(); i++) {
+      led.seen = false;
+      camera.nextLen = frameLen(rng);
+      uint32_t seq = camera.nextSeq;
+      pcResult_t result = pinhole.shoot();
+      leds.wait(clock);
+      if (result == PC_SAVED && led.seen) {
+        acked[pinhole.lastPath()] = seq;
+      }
+    }
+  }
+  steps = rail.steps() - stepsBefore;
+  std::map<std::string, uint32_t> wholeAtCut = wholeFiles(storage);
+
+  // Power back on; take two more pictures. The second is the one that would land on a picture
+  // saved under a number past the counter if the first didn't.
+  rail.cutAfter(-1);
+  storage.failOpens(0);
+  storage.reboot();
+  counter.reboot();
+  VirtualClock clock;
+  ProbeLed led {rail};
+  VirtualTimer ledTimer {clock};
+  LedPatterns leds {led, ledTimer};
+  CardSpace space;
+  space.begin(PC_CARD_BYTES, PC_CARD_BYTES, PC_CLUSTER_BYTES, 0);
+  PinholeCamera pinhole {clock, camera, storage, counter, leds, space};
+  leds.begin();
+  pinhole.begin();
+  for (int i = 0; i < 2; i++) {
+    led.seen = false;
+    camera.nextLen = frameLen(rng);
+    uint32_t seq = camera.nextSeq;
+    pcResult_t result = pinhole.shoot();
+    leds.wait(clock);
+    if (result != PC_SAVED || !led.seen) {
+      problem = "a shot after the reboot failed";
+      return false;
+    }
+    acked[pinhole.lastPath()] = seq;
+  }
+
+  // Check
+  std::map<std::string, uint32_t> whole = wholeFiles(storage);
+  for (const auto &entry : acked) {
+    auto it = whole.find(entry.first);
+    if (it == whole.end() || it->second != entry.second) {
+      problem = "saved picture " + entry.first + " was lost";
+      return false;
+    }
+  }
+  for (const auto &entry : wholeAtCut) {
+    auto it = whole.find(entry.first);
+    if (it == whole.end() || it->second != entry.second) {
+      problem = "picture " + entry.first + " was overwritten after the reboot";
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  int runs = 100;
+  int shots = 3;
+  uint32_t seed = 1;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[++i] : nullptr;
+    if (value != nullptr && strcmp(arg, "--runs") == 0 && atoi(value) > 0) {
+      runs = atoi(value);
+    } else if (value != nullptr && strcmp(arg, "--shots") == 0 && atoi(value) > 0) {
+      shots = atoi(value);
+    } else if (value != nullptr && strcmp(arg, "--seed") == 0) {
+      seed = (uint32_t)atol(value);
+    } else {
+      fprintf(stderr, usage, argv[0]);
+      return 2;
+    }
+  }
+
+  halLogTo(nullptr);
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  uint64_t cuts = 0;
+  uint64_t failures = 0;
+  for (int run = 0; run < runs * 2; run++) {
+    uint32_t runSeed = seed + run / 2;
+    bool failFirst = run % 2 != 0;
+    const char *how = failFirst ? " after a failed save" : "";
+    uint32_t steps;
+    std::string problem;
+    if (!runOne(runSeed, failFirst, shots, -1, steps, problem)) {
+      printf("Seed %u, no power cut%s: %s.\n", runSeed, how, problem.c_str());
+      return 1;
+    }
+    for (uint32_t cut = 0; cut <= steps; cut++) {
+      uint32_t stepsTaken;
+      cuts++;
+      if (!runOne(runSeed, failFirst, shots, cut, stepsTaken, problem)) {
+        if (failures++ < PC_MAX_REPORTS) {
+          printf("Seed %u, power cut after step %u of %u%s: %s.\n", runSeed, cut, steps, how, 
+            problem.c_str());
+        }
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%llu power cuts in %.2f s (%.0f per second); %llu went wrong.\n", (unsigned long long)cuts, 
+    secs, cuts / secs, (unsigned long long)failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,605 @@
+/****
+ * ESP32 Pinhole Camera v0.5.0
+ *
+ * main.cpp (host)
+ *
+ * Runs the camera's capture and save logic on Linux the way loop() runs it on the camera, 
+ * with the camera, SD card and shutter simulated (see SimCamera.h, SimStorage.h and 
+ * SimButton.h). Time is virtual (see VirtualClock.h), so hours go by in moments. The shutter
+ * is clicked every so often or as a script says:
+ *
+ *    .pio/build/native/program --out /tmp/card --shots 10 --interval-ms 2000
+ *    .pio/build/native/program --out /tmp/card --script timelapse.txt --trace trace.csv
+ *
+ * A script has one thing to do per line, at a time in milliseconds from power-on:
+ *
+ *    <ms> click [<count> [<gap ms>]]   Click the shutter, count times gap apart (default 1)
+ *    <ms> press                        Press the shutter and hold it down; held long
+ *                                      enough, letting it go takes a dim picture
+ *    <ms> release                      Let it go
+ *    <ms> camera-hang                  Make the sensor stop sending frames until restarted
+ *    <ms> cap                          Put the cap on the lens
+ *    <ms> uncap                        Take it off
+ *    <ms> card-fail                    Make the card stop answering until remounted
+ *
+ * Blank lines and lines starting with # are ignored. As on the camera, after 
+ * PC_AWAKE_MILLIS (or awake_millis) without a click the camera goes to sleep, and the next press wakes it and
+ * takes a picture. The simulation ends when the camera goes to sleep with nothing left to do.
+ *
+ * Options:
+ *    --out <dir>         Where the images go (default the current directory); made if it isn't there
+ *    --shots <n>         With no script, how many times to click the shutter (default 1)
+ *    --interval-ms <n>   With no script, time from one click to the next (default 1000)
+ *    --script <file>     Click the shutter as the file says
+ *    --trace <file>      Save what happened, and when, as CSV (see SimTrace.h)
+ *    --config <file>     Settings, as in pinhole.cfg (see PinholeConfig.h); the options after
+ *                        it override them. xclk_freq_hz and sensor_off have no effect.
+ *    --profile <s>       The optical profile whose EXIF and window go in the pictures (see 
+ *                        OpticalProfiles.h; default lens). A long press moves on to the next.
+ *                        The files scene can't be cropped, so its pictures are always whole.
+ *    --gate <s>          What to do with pictures that are no good: off, flag, skip or
+ *                        retake (default flag; see PinholeCamera.h)
+ *    --doze              Doze between shots, as with LIGHT_SLEEP_IDLE, so frames from before
+ *                        the shutter goes down are stale
+ *    --jpeg <file>       An image for the camera to serve; may be repeated (default 
+ *                        doc/PtWilsonBoathouse.jpg)
+ *    --scene <s>         files (the --jpeg ones), flat, gradient or noise (default files)
+ *    --level <n>         Brightness of a synthetic scene, 0 - 255 (default 128)
+ *    --light <n>         How much light gets to the sensor: the level 1000 rows of exposure
+ *                        with no gain make (see SimCamera.h). With it, a pinhole profile's
+ *                        exposure is controlled as on the camera (see AutoExposure.h).
+ *    --framesize <s>     qvga, cif, vga, svga, xga, sxga or uxga (default uxga)
+ *    --dim-framesize <s> The frame size for a dim picture (see JpegStacker.h): qvga, cif, 
+ *                        vga or svga (default svga)
+ *    --dim-frames <n>    How many frames a dim picture averages, 1 - 8 (default 4)
+ *    --binned            Take the sensor's faster modes to bin rather than skip (see 
+ *                        SimCamera.h)
+ *    --quality <n>       JPEG quality, 0 (best) - 63 (default 10)
+ *    --fb-count <n>      Number of frame buffers (default 2)
+ *    --grab <s>          latest or when-empty (default latest)
+ *    --frame-us <n>      Frame interval (default the sensor's nominal one for the frame size)
+ *    --bus <n>           SD card data lines, 1 or 4 (default 1)
+ *    --card-kbps <n>     How fast the card takes data in KB/s (default 10000)
+ *    --create-us <n>     Time to create a file (default 8000)
+ *    --close-us <n>      Time to close a file (default 4000)
+ *    --cluster-kib <n>   Cluster size (default 32)
+ *    --cluster-us <n>    Time to allocate a cluster (default 400)
+ *    --gc-every-kib <n>  KiB between card garbage collections, 0 for none (default 4096)
+ *    --gc-us <n>         How long a garbage collection takes (default 120000)
+ *    --instant-card      Make the card take no time at all
+ *
+ * At the end it says how the shots went: how long from the shutter going down to the frame,
+ * how many frames were older than that, what the camera did meanwhile and how long the card
+ * took, and, if anything went wrong, how long the camera took to recover. Each picture saved is
+ * metered from its JPEG (see JpegMeter.h), and the trace says how it came out.
+ *
+ ****
+ *
+ * Copyright 2023 by D.L. Ehnebuske
+ * License: GNU Lesser General Public License v2.1
+ *
+ ****/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "HalLinux.h"
+#include "VirtualClock.h"
+#include "SimTrace.h"
+#include "SimButton.h"
+#include "SimCamera.h"
+#include "SimStorage.h"
+#include "PinholeCamera.h"
+#include "PinholeConfig.h"
+#include "OpticalProfiles.h"
+#include "AutoExposure.h"
+#include "JpegStacker.h"
+
+#define DEFAULT_JPEG      "doc/PtWilsonBoathouse.jpg"
+#define SCRIPT_LINE_LEN   (128)                     // Longest script line
+#define SHUTTER_POLL_US   (10000)                   // How often to look at the shutter while it's down
+
+static const char *usage = 
+  "Usage: %s [--out <dir>] [--shots <n>] [--interval-ms <n>] [--script <file>] [--trace <file>]\n"
+  "  [--config <file>] [--profile <s>] [--gate <s>] [--doze] [--jpeg <file>]...\n"
+  "  [--scene files|flat|gradient|noise] [--level <n>] [--light <n>] [--framesize qvga|cif|vga|svga|xga|sxga|uxga]\n"
+  "  [--dim-framesize qvga|cif|vga|svga] [--dim-frames <n>] [--binned]\n"
+  "  [--quality <n>] [--fb-count <n>] [--grab latest|when-empty] [--frame-us <n>]\n"
+  "  [--bus 1|4] [--card-kbps <n>] [--create-us <n>] [--close-us <n>] [--cluster-kib <n>]\n"
+  "  [--cluster-us <n>] [--gc-every-kib <n>] [--gc-us <n>] [--instant-card]\n";
+
+/**
+ * @brief Bring the exposure up to date, as the camera does before each shot behind a pinhole,
+ * noting any change in the trace
+ *
+ * @return int64_t  When it last changed; 0 if it didn't
+ */
+static int64_t updateExposure(AutoExposure &exposure, SimCamera &camera, SimTrace &trace, aeResult_t &result) {
+  if (!exposure.converge(result)) {
+    trace.add("camera", "exposure failed");
+    return 0;
+  }
+  if (result.steps != 0) {
+    trace.add("camera", "exposure", "%u rows, clock / %u, gain %u: level %u, %.1f dB after %u changes in %u us",
+      result.exposure.lines, result.exposure.clockDiv, result.exposure.gain, result.level, camera.snrDb(),
+      result.steps, result.micros);
+  }
+  return result.changedUs;
+}
+
+/**
+ * @brief Have the camera send the given profile's window, as the camera does when it switches
+ * profiles, noting in the trace if it can't (the files scene can't be cropped)
+ */
+static void applyWindow(SimCamera &camera, SimTrace &trace, uint8_t profile) {
+  uint8_t percent = OpticalProfiles::profile(profile).windowPercent;
+  if (!camera.setWindow(percent)) {
+    trace.add("camera", "window failed", "%u%%", percent);
+  }
+}
+
+/**
+ * @brief The index of name in names, or -1 if it isn't there
+ */
+static int lookup(const char *name, const char *const names[], int nNames) {
+  for (int i = 0; i < nNames; i++) {
+    if (strcmp(name, names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Schedule the shutter presses and releases, and the faults, in the given script
+ *
+ * @return false  Couldn't read it or it didn't make sense; says why on stderr
+ */
+static bool loadScript(const char *path, VirtualClock &clock, SimButton &shutter, SimCamera &camera,
+  SimStorage &storage) {
+  FILE *f = fopen(path, "r");
+  if (f == nullptr) {
+    fprintf(stderr, "Unable to read '%s'.\n", path);
+    return false;
+  }
+  char line[SCRIPT_LINE_LEN];
+  int lineNo = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), f) != nullptr) {
+    lineNo++;
+    char what[16];
+    unsigned long atMillis, count = 1, gapMillis = SIM_CLICK_MILLIS * 2;
+    int n = sscanf(line, "%lu %15s %lu %lu", &atMillis, what, &count, &gapMillis);
+    if (n <= 0 || line[0] == '#') {
+      continue;
+    }
+    int64_t atUs = (int64_t)atMillis * 1000;
+    if (n >= 2 && strcmp(what, "click") == 0 && gapMillis > SIM_CLICK_MILLIS) {
+      for (unsigned long i = 0; i < count; i++) {
+        shutter.click(atUs + (int64_t)(i * gapMillis) * 1000);
+      }
+    } else if (n == 2 && strcmp(what, "press") == 0) {
+      shutter.press(atUs);
+    } else if (n == 2 && strcmp(what, "release") == 0) {
+      shutter.release(atUs);
+    } else if (n == 2 && strcmp(what, "camera-hang") == 0) {
+      clock.at(atUs, [&camera]() {camera.hang();});
+    } else if (n == 2 && strcmp(what, "cap") == 0) {
+      clock.at(atUs, [&camera]() {camera.cover(true);});
+    } else if (n == 2 && strcmp(what, "uncap") == 0) {
+      clock.at(atUs, [&camera]() {camera.cover(false);});
+    } else if (n == 2 && strcmp(what, "card-fail") == 0) {
+      clock.at(atUs, [&storage]() {storage.fail();});
+    } else {
+      fprintf(stderr, "%s:%d: don't understand '%s'.\n", path, lineNo, line);
+      ok = false;
+    }
+  }
+  fclose(f);
+  return ok;
+}
+
+/**
+ * @brief Read the settings in the given file, as the camera reads pinhole.cfg
+ *
+ * @return false  Couldn't read it; says so on stderr
+ */
+static bool loadConfig(const char *path, cfSettings_t &settings) {
+  static char text[CF_FILE_MAX];
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr) {
+    fprintf(stderr, "Unable to read '%s'.\n", path);
+    return false;
+  }
+  size_t len = fread(text, 1, sizeof(text), f);
+  bool tooBig = fgetc(f) != EOF;
+  fclose(f);
+  if (tooBig) {
+    fprintf(stderr, "'%s' is over %u bytes.\n", path, CF_FILE_MAX);
+    return false;
+  }
+  cfDefaults(settings);
+  cfParse(text, len, settings);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  static const char *const sceneNames[] = {"files", "flat", "gradient", "noise"};
+  static const char *const sizeNames[] = {"qvga", "cif", "vga", "svga", "xga", "sxga", "uxga"};
+  static const char *const grabNames[] = {"when-empty", "latest"};
+  static const char *const gateNames[] = {"off", "flag", "skip", "retake"};
+  const char *outDir = ".";
+  int shots = 1;
+  uint32_t intervalMillis = 1000;
+  const char *scriptPath = nullptr;
+  const char *tracePath = nullptr;
+  bool doze = false;
+  uint32_t awakeMillis = PC_AWAKE_MILLIS;
+  uint8_t profile = 0;
+  pcGate_t gate = PC_GATE_FLAG;
+  simFramesize_t dimFrameSize = SIM_FRAMESIZE_SVGA;
+  uint8_t dimFrames = 4;
+  std::vector<const char *> jpegPaths;
+  simCameraConfig_t config;
+  simCardConfig_t card;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    int n = -1;
+    if (strcmp(arg, "--doze") == 0) {
+      doze = true;
+      continue;
+    }
+    if (strcmp(arg, "--binned") == 0) {
+      config.binned = true;
+      continue;
+    }
+    if (strcmp(arg, "--instant-card") == 0) {
+      card.cardBytesPerSec = 0;
+      card.commandMicros = card.createMicros = card.clusterMicros = card.closeMicros = 0;
+      card.gcEveryBytes = 0;
+      continue;
+    }
+    if (value == nullptr) {
+      fprintf(stderr, usage, argv[0]);
+      return 2;
+    }
+    i++;
+    if (strcmp(arg, "--out") == 0) {
+      outDir = value;
+    } else if (strcmp(arg, "--shots") == 0) {
+      shots = atoi(value);
+    } else if (strcmp(arg, "--interval-ms") == 0) {
+      intervalMillis = (uint32_t)atol(value);
+    } else if (strcmp(arg, "--script") == 0) {
+      scriptPath = value;
+    } else if (strcmp(arg, "--trace") == 0) {
+      tracePath = value;
+    } else if (strcmp(arg, "--config") == 0) {
+      cfSettings_t settings;
+      if (!loadConfig(value, settings)) {
+        return 1;
+      }
+      config.frameSize = (simFramesize_t)settings.frameSize;
+      config.jpegQuality = settings.jpegQuality;
+      config.fbCount = settings.fbCount;
+      config.grabMode = (simGrabMode_t)settings.grabMode;
+      awakeMillis = settings.awakeMillis;
+      doze = settings.doze;
+      profile = settings.profile;
+      gate = (pcGate_t)settings.gate;
+      dimFrameSize = (simFramesize_t)settings.dimFrameSize;
+      dimFrames = settings.dimFrames;
+    } else if (strcmp(arg, "--profile") == 0 && (n = OpticalProfiles::find(value)) >= 0) {
+      profile = (uint8_t)n;
+    } else if (strcmp(arg, "--gate") == 0 && (n = lookup(value, gateNames, 4)) >= 0) {
+      gate = (pcGate_t)n;
+    } else if (strcmp(arg, "--jpeg") == 0) {
+      jpegPaths.push_back(value);
+    } else if (strcmp(arg, "--scene") == 0 && (n = lookup(value, sceneNames, 4)) >= 0) {
+      config.scene = (simScene_t)n;
+    } else if (strcmp(arg, "--level") == 0) {
+      config.level = (uint8_t)atoi(value);
+    } else if (strcmp(arg, "--light") == 0) {
+      config.light = (uint16_t)atoi(value);
+    } else if (strcmp(arg, "--framesize") == 0 && (n = lookup(value, sizeNames, 7)) >= 0) {
+      config.frameSize = (simFramesize_t)n;
+    } else if (strcmp(arg, "--dim-framesize") == 0 && (n = lookup(value, sizeNames, 4)) >= 0) {
+      dimFrameSize = (simFramesize_t)n;
+    } else if (strcmp(arg, "--dim-frames") == 0 && atoi(value) >= 1 && atoi(value) <= JS_MAX_FRAMES) {
+      dimFrames = (uint8_t)atoi(value);
+    } else if (strcmp(arg, "--quality") == 0) {
+      config.jpegQuality = (uint8_t)atoi(value);
+    } else if (strcmp(arg, "--fb-count") == 0) {
+      config.fbCount = (uint8_t)atoi(value);
+    } else if (strcmp(arg, "--grab") == 0 && (n = lookup(value, grabNames, 2)) >= 0) {
+      config.grabMode = (simGrabMode_t)n;
+    } else if (strcmp(arg, "--frame-us") == 0) {
+      config.frameMicros = (uint32_t)atol(value);
+    } else if (strcmp(arg, "--bus") == 0 && (atoi(value) == 1 || atoi(value) == 4)) {
+      card.busWidth = (uint8_t)atoi(value);
+    } else if (strcmp(arg, "--card-kbps") == 0) {
+      card.cardBytesPerSec = (uint32_t)atol(value) * 1000;
+    } else if (strcmp(arg, "--create-us") == 0) {
+      card.createMicros = (uint32_t)atol(value);
+    } else if (strcmp(arg, "--close-us") == 0) {
+      card.closeMicros = (uint32_t)atol(value);
+    } else if (strcmp(arg, "--cluster-kib") == 0) {
+      card.clusterBytes = (uint32_t)atol(value) * 1024;
+    } else if (strcmp(arg, "--cluster-us") == 0) {
+      card.clusterMicros = (uint32_t)atol(value);
+    } else if (strcmp(arg, "--gc-every-kib") == 0) {
+      card.gcEveryBytes = (uint32_t)atol(value) * 1024;
+    } else if (strcmp(arg, "--gc-us") == 0) {
+      card.gcMicros = (uint32_t)atol(value);
+    } else {
+      fprintf(stderr, usage, argv[0]);
+      return 2;
+    }
+  }
+  if (jpegPaths.empty()) {
+    jpegPaths.push_back(DEFAULT_JPEG);
+  }
+  if (mkdir(outDir, 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Unable to make '%s': %s.\n", outDir, strerror(errno));
+    return 1;
+  }
+
+  VirtualClock clock;
+  SimTrace trace {clock};
+  LinuxLed led {&trace};
+  VirtualTimer ledTimer {clock};
+  LedPatterns leds {led, ledTimer};
+  SimButton shutter {clock, &trace};
+  SimCamera camera {clock, &trace};
+  SimStorage storage {outDir, clock, card, &trace};
+  LinuxCounter counter {outDir};
+  CardSpace space;
+  PinholeCamera pinhole {clock, camera, storage, counter, leds, space};
+  pinhole.setAwakeMillis(awakeMillis);
+  JpegMeter meter;
+  pinhole.setMeter(&meter);
+  pinhole.setGate(gate);
+  OpticalProfiles profiles;
+  profiles.begin();
+  pinhole.setHeader(profiles.tables(profile).exif, profiles.tables(profile).exifLen);
+  pinhole.setMinFine(OpticalProfiles::profile(profile).pinholeUm == 0 ? FQ_MIN_FINE : 0);
+  if (dimFrameSize > config.frameSize) {
+    dimFrameSize = config.frameSize;
+  }
+  uint32_t stackBlocks = JpegStacker::blocksFor(800, 600); // Room for SVGA, as the camera has
+  std::vector<int16_t> stackSums((size_t)stackBlocks * 64);
+  std::vector<uint8_t> stackOut(800 * 600 / 5);
+  JpegStacker stacker;
+  stacker.setBuffers(stackSums.data(), stackBlocks, stackOut.data(), stackOut.size());
+  if (dimFrames > 1) {
+    pinhole.setStacker(&stacker);
+  }
+  AutoExposure exposure {clock, camera, camera};
+  exposure.setTarget((uint8_t)(AE_TARGET + OpticalProfiles::profile(profile).aeLevel * AE_LEVEL_STEP));
+
+  trace.add("camera", "boot");
+  leds.begin();
+  if (config.scene == SIM_SCENE_FILES) {
+    for (const char *path : jpegPaths) {
+      if (!camera.addFile(path)) {
+        fprintf(stderr, "Unable to read '%s' as a JPEG.\n", path);
+        return 1;
+      }
+    }
+  }
+  if (!camera.begin(config)) {
+    fprintf(stderr, "The camera configuration doesn't make sense.\n");
+    return 1;
+  }
+  applyWindow(camera, trace, profile);
+  uint64_t totalBytes, freeBytes;
+  uint32_t blockBytes;                            // Not used; the card has its own cluster size
+  if (!storage.capacity(totalBytes, freeBytes, blockBytes)) {
+    fprintf(stderr, "Unable to get at '%s'.\n", outDir);
+    return 1;
+  }
+  halFrame_t frame;
+  camera.get(frame);
+  space.begin(totalBytes, freeBytes, storage.config().clusterBytes, (uint32_t)frame.len);
+  camera.release(frame);
+
+  if (scriptPath != nullptr) {
+    if (!loadScript(scriptPath, clock, shutter, camera, storage)) {
+      return 1;
+    }
+  } else {
+    for (int i = 0; i < shots; i++) {
+      shutter.click((int64_t)(i + 1) * intervalMillis * 1000);
+    }
+  }
+
+  // Do what loop() does until the camera goes to sleep with nothing left to do
+  shutter.begin();
+  pinhole.begin();
+  leds.play(LP_WAVE);
+  int clicks = 0;
+  int saved = 0;
+  int rejected = 0;                               // Shots the quality gate dropped
+  int staleShots = 0;
+  int64_t staleUs = 0;                            // Frames from before this are stale
+  int64_t totalLatencyUs = 0;
+  int64_t maxLatencyUs = 0;
+  int troubledShots = 0;                          // Shots where something went wrong
+  int64_t maxRecoveryUs = 0;
+  bool wakeShot = false;
+  int64_t downUs = 0;                             // When the shutter went down for the shot
+  aeResult_t aeResult {};                         // How the latest exposure update went
+  int aeChanges = 0;
+  int64_t maxAeUs = 0;
+  bool dimPending = false;                        // Whether a hold asked for a dim picture
+  int dimShots = 0;
+  while (true) {
+    halButtonEvent_t event;
+    bool clicked = false;
+    while (!clicked && shutter.event(clock, event)) {
+      static const char *const gestureNames[] = {"click", "double-click", "long press", "hold"};
+      trace.add("shutter", gestureNames[event.gesture]);
+      if (event.gesture == HAL_CLICK || event.gesture == HAL_DOUBLE_CLICK) {
+        clicked = true;
+        downUs = event.downUs;
+      } else if (event.gesture == HAL_LONG_PRESS) {
+        profile = (uint8_t)((profile + 1) % OpticalProfiles::count());
+        pinhole.setHeader(profiles.tables(profile).exif, profiles.tables(profile).exifLen);
+        trace.add("camera", "profile", "%s", OpticalProfiles::profile(profile).name);
+        exposure.setTarget((uint8_t)(AE_TARGET + OpticalProfiles::profile(profile).aeLevel * AE_LEVEL_STEP));
+        exposure.invalidate();
+        pinhole.setMinFine(OpticalProfiles::profile(profile).pinholeUm == 0 ? FQ_MIN_FINE : 0);
+        applyWindow(camera, trace, profile);
+        if (OpticalProfiles::profile(profile).pinholeUm == 0) {
+          camera.setAutomatic();
+        }
+        for (uint8_t i = 0; i <= profile; i++) {
+          leds.play(LP_PROFILE);
+        }
+      } else if (event.gesture == HAL_HOLD) {
+        dimPending = true;
+      }
+    }
+    bool dim = !clicked && dimPending && !shutter.isDown();
+    if (clicked || wakeShot || dim) {
+      clicks++;
+      simFramesize_t shotSize = config.frameSize;
+      if (dim) {
+        dimPending = false;
+        if (dimFrameSize != config.frameSize && camera.setFrameSize((halFramesize_t)dimFrameSize)) {
+          exposure.setFrameSize((halFramesize_t)dimFrameSize);
+          shotSize = dimFrameSize;
+          staleUs = clock.micros();
+        }
+      }
+      if (config.light != 0 && OpticalProfiles::profile(profile).pinholeUm != 0) {
+        int64_t changedUs = updateExposure(exposure, camera, trace, aeResult);
+        staleUs = changedUs > staleUs ? changedUs : staleUs;
+        aeChanges += aeResult.steps;
+        maxAeUs = aeResult.micros > maxAeUs ? aeResult.micros : maxAeUs;
+      }
+      pcResult_t result = pinhole.shoot(staleUs, dim ? dimFrames : 1);
+      staleUs = 0;
+      if (shotSize != config.frameSize) {
+        camera.setFrameSize((halFramesize_t)config.frameSize);
+        exposure.setFrameSize((halFramesize_t)config.frameSize);
+      }
+      wakeShot = false;
+      if (pinhole.lastRecoveryMicros() != 0) {
+        troubledShots++;
+        maxRecoveryUs = pinhole.lastRecoveryMicros() > maxRecoveryUs ? pinhole.lastRecoveryMicros() : maxRecoveryUs;
+        trace.add("camera", result == PC_SAVED ? "recovered" : "gave up", "%lld us", 
+          (long long)pinhole.lastRecoveryMicros());
+      }
+      if (result == PC_REJECTED) {
+        trace.add("camera", "rejected", "%s", fqName(pinhole.lastVerdict()));
+        rejected++;
+        continue;
+      }
+      if (result != PC_SAVED) {
+        trace.add("camera", "failed", "result %d", result);
+        continue;
+      }
+      saved++;
+      int64_t latencyUs = pinhole.lastCaptureMicros() - downUs;
+      if (dim) {
+        trace.add("camera", "saved", "%s, %u frames averaged", pinhole.lastPath(), pinhole.lastFrames());
+      } else {
+        trace.add("camera", "saved", "%s, %lld us after the shutter went down", pinhole.lastPath(), 
+          (long long)latencyUs);
+      }
+      const jmStats_t *stats = pinhole.lastStats();
+      if (stats != nullptr && stats->blocks != 0) {
+        trace.add("camera", "metered", "level %u, %u%% black, %u%% blown out; %s", stats->mean,
+          (unsigned)(stats->dark * 100 / stats->blocks), (unsigned)(stats->clipped * 100 / stats->blocks),
+          fqName(pinhole.lastVerdict()));
+      }
+      if (dim) {
+        dimShots++;
+        continue;                                 // The shutter went down seconds ago, on purpose
+      }
+      totalLatencyUs += latencyUs;
+      maxLatencyUs = latencyUs > maxLatencyUs ? latencyUs : maxLatencyUs;
+      if (pinhole.lastFrameMicros() < downUs) {
+        staleShots++;
+      }
+      continue;
+    }
+
+    // Time for deep sleep. The next press wakes the camera up, which starts over and takes a 
+    // picture once the shutter is back up.
+    if (pinhole.sleepDue()) {
+      leds.play(LP_WAVE);
+      leds.wait(clock);
+      trace.add("camera", "sleep");
+      while (!shutter.isDown() && clock.nextEventMicros() != VC_NEVER) {
+        clock.advanceTo(clock.nextEventMicros());
+      }
+      if (!shutter.isDown()) {
+        break;
+      }
+      trace.add("camera", "wake");
+      downUs = clock.micros();
+      shutter.begin();
+      int64_t upUs = 0;                           // When the shutter was last seen to come up
+      while (clock.nextEventMicros() != VC_NEVER) {
+        upUs = shutter.isDown() ? 0 : upUs == 0 ? clock.micros() : upUs;
+        if (upUs != 0 && clock.micros() - upUs >= BUTTON_DEBOUNCE_US) {
+          break;
+        }
+        clock.advanceTo(clock.nextEventMicros());
+      }
+      pinhole.begin();
+      exposure.invalidate();
+      wakeShot = true;
+      continue;
+    }
+
+    // Nothing going on; wait for something to happen or for it to be time for deep sleep
+    bool wasDown = shutter.isDown();
+    int64_t sleepUs = clock.micros() + (int64_t)pinhole.awakeMillisLeft() * 1000 + 1000;
+    int64_t nextUs = clock.nextEventMicros();
+    if (wasDown && nextUs > clock.micros() + SHUTTER_POLL_US) {
+      nextUs = clock.micros() + SHUTTER_POLL_US;  // Keep looking, so a hold is noticed
+    }
+    clock.advanceTo(nextUs < sleepUs ? nextUs : sleepUs);
+    if (doze && !wasDown) {
+      staleUs = clock.micros();
+    }
+  }
+
+  if (tracePath != nullptr && !trace.save(tracePath)) {
+    fprintf(stderr, "Unable to write '%s'.\n", tracePath);
+  }
+  halLog("Simulated %.1f s. Saved %d of %d images; the last was %s. The LED flashed %u times.\n", 
+    clock.micros() / 1000000.0, saved, clicks, pinhole.lastPath(), (unsigned)led.flashes());
+  if (saved > dimShots) {
+    halLog("Shutter down to frame: %.1f ms average, %.1f ms worst. %d of the frames were older.\n",
+      totalLatencyUs / 1000.0 / (saved - dimShots), maxLatencyUs / 1000.0, staleShots);
+  }
+  halLog("Camera: %u frames captured, %u dropped, %u delivered, %u timeouts; %u us per frame.\n",
+    camera.framesCaptured, camera.framesDropped, camera.framesDelivered, camera.timeouts, 
+    camera.frameMicros());
+  if (saved > 0) {
+    halLog("Card: %.1f ms per image, %u clusters allocated, %u garbage collection stalls.\n",
+      storage.busyMicros / 1000.0 / saved, storage.clustersAllocated, storage.gcStalls);
+  }
+  if (aeChanges > 0) {
+    halLog("Exposure: %u rows, clock / %u, gain %u; level %u, %.1f dB. %d changes, %.1f ms worst to settle.\n",
+      aeResult.exposure.lines, aeResult.exposure.clockDiv, aeResult.exposure.gain, aeResult.level,
+      camera.snrDb(), aeChanges, maxAeUs / 1000.0);
+  }
+  if (troubledShots > 0) {
+    halLog("Trouble: %d shots, %u camera restarts, %u card remounts; %.1f ms worst recovery.\n",
+      troubledShots, camera.restarts, storage.remounts, maxRecoveryUs / 1000.0);
+  }
+  if (dimShots > 0) {
+    halLog("Dim pictures: %d saved, %u frames each at %s.\n", dimShots, dimFrames, sizeNames[dimFrameSize]);
+  }
+  if (rejected > 0) {
+    halLog("Quality gate: %d not saved.\n", rejected);
+  }
+  return saved + rejected == clicks ? 0 : 1;
+}
@@ -24,15 +24,27 @@
  *          4  No SD Card found in the card reader
  * 
  * To use the camera, click its shutter. The red LED will flash once to indicate that the image 
- * was captured and saved. If there's no flash, something went wrong. Maybe I'll add more error 
- * indicator LED flashing if this turns out to be a problem.
+ * was captured and saved. Two flashes means it was saved but the SD card is nearly full; three 
+ * means the card is full and the image wasn't saved. A long flash and a short one means the 
+ * camera didn't deliver a picture even after being restarted; a long flash and two short ones 
+ * means the card didn't take it even after being remounted.
+ * 
+ * Holding the shutter down for a second or so and letting it go (a long press) tells the camera
+ * the next pinhole assembly is on. It gives one long flash for the stock lens, two for the 
+ * first pinhole profile, and so on; see OpticalProfiles.h and "profile" in PinholeConfig.h.
+ * 
+ * Holding the shutter down for three seconds or more and then letting it go takes a picture of
+ * a dim scene: several frames at a smaller size, averaged into one to cut the noise. Keep the
+ * camera still until the LED flashes. See "dim_frames" in PinholeConfig.h.
  * 
  * Activity on the SD card occurs at two only points. First, during initialization. And, second, 
  * after the shutter is pressed and before the red LED flashes to indicate the image was captured. 
  * So, it should be okay to pull the power on the camera at other times.
  * 
  * If the shutter isn't clicked for five minutes the camera will flash the red LED five times 
- * and go into deep sleep mode. To get it going again, press the reset button on the board.
+ * and go into deep sleep mode. To get it going again, click the shutter. The camera wakes up and
+ * takes a picture with that click, so there's no need to click twice. (The reset button works 
+ * too, but doesn't take a picture.)
  * 
  * A few technical notes
  * =====================
@@ -65,11 +77,32 @@
 #include "esp_camera.h"                           // Camera support
 #include "FS.h"                                   // File system
 #include "SD_MMC.h"                               // SD Card support
+#include "ff.h"                                   // FatFs, for the card's free space
+#include "diskio.h"                               // FatFs's sector reads, for the card's boot sector
 #include "soc/soc.h"                              // Disable brownout checking
 #include "soc/rtc_cntl_reg.h"                     // Disable brownout checking
 #include "driver/rtc_io.h"                        // RTC GPIO hold functions
 #include <EEPROM.h>                               // EEPROM access
-#include <PushButton.h>                           // Simple push button
+#include "CardSpace.h"                            // SD card free space tracking
+#include "PinholeCamera.h"                        // Taking and saving pictures
+#include "LedPatterns.h"                          // Flashing the LED in the background
+#include "HalEsp32.h"                             // ESP32 hardware abstraction layer
+#include "BootProfile.h"                          // Boot time profiler
+#include "DeepSleep.h"                            // Deep sleep and waking on the shutter
+#include "LightSleep.h"                           // Light sleep between shots
+#include "SensorPower.h"                          // Camera sensor power-down between shots
+#include "EnergyMeter.h"                          // Energy accounting
+#include "PinholeConfig.h"                        // The settings in /pinhole.cfg
+#include "OpticalProfiles.h"                      // What's in front of the sensor
+#include "AutoExposure.h"                         // Exposure control for pinholes
+#include "JpegMeter.h"                            // Metering pictures from their JPEGs
+#include "JpegStacker.h"                          // Averaging frames for dim scenes
+#include <fcntl.h>                                // Reading /pinhole.cfg
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef SD_BENCH
+#include "SdBench.h"                              // SD card benchmark
+#endif
 
 // Uncomment to enable rather verbose debug printing
 //#define DEBUG
@@ -95,35 +128,327 @@
 // Misc compile-time definitions
 #define BANNER            "\nESP32 CAM Pinhole camera v0.5.0\n"
 #define IC_ADDR           (0)                       // Image counter address in "EEPROM"
+#define SD_MOUNT_POINT    "/sdcard"                 // Where SD_MMC mounts the card
+#define SERIAL_BAUD       (115200)                  // Serial speed; slow speeds make the boot messages block
 #define SERIAL_MILLIS     (3000)                    // Maximum millis to wait for Serial to become ready
-#define FLASH_MILLIS      (200)                     // LED_BUILTIN default flash length (millis())
-#define FAIL_MILLIS       (1000)                    // millis() between flash groups for init failures
-#define WAVE_FLASH_COUNT  (5)                       // Number of flashes to say hello/goodbye
-#define SNAP_FLASH_COUNT  (1)                       // Number of times to flash on shutter release
-#define CAMI_FLASH_COUNT  (2)                       // Number of times to flash if camera init fails
-#define SDMI_FLASH_COUNT  (3)                       // Number of times to flash if SD card mount fails
-#define SDCI_FLASH_COUNT  (4)                       // Number of times to flash if no SD card found
+#define CAM_TASK_STACK    (4096)                    // Stack size for the camera initialization task
+#define CAM_TASK_CORE     (0)                       // Core the camera is initialized on (setup() runs on 1)
+#define LOG_TASK_STACK    (4096)                    // Stack size for the boot log writing task
 #define LED_BUILTIN       (GPIO_NUM_33)             // The GPIO for the little red LED (active LOW)
-#define AWAKE_MILLIS      (300000UL)                // millis() to stay awake waiting for shutter press
+#define SHUTTER_GPIO      (GPIO_NUM_12)             // The GPIO for the shutter switch (active LOW, RTC capable)
+#define RELEASE_MILLIS    (1000)                    // Max millis() to wait for the shutter to be released after a wake
+#define IDLE_CPU_MHZ      (80)                      // CPU clock between shots
+#define BUSY_CPU_MHZ      (240)                     // CPU clock while taking a picture
+#define DOZE_MILLIS       (500)                     // millis() of nothing happening before we idle
+#define UXGA_EST_BYTES    (163840UL)                // Rough size of a UXGA image until we've taken some
+#define SVGA_EST_BYTES    (49152UL)                 // Rough size of an SVGA image until we've taken some
+#define WARN_PERCENT      (5)                       // Warn when this much of a picture is black or blown out
+#define METER_LIMIT_MICROS (150000)                 // Most time metering (and so judging) a picture may take
+#define STACK_JPEG_DIVISOR (5)                      // Room for a stacked JPEG is its pixels over this, as for the driver's frame buffers
 
 // Global variables
-PushButton shutter {GPIO_NUM_12};                   // The "shutter" switch
-uint16_t imageCtr;                                  // The image counter for numbering image files
+camera_config_t cameraConfig;                       // How the camera is set up
+cfSettings_t &settings = rtcState.settings;         // The settings (see PinholeConfig.h), kept through deep sleep
+bool wakeShot;                                      // Take a picture right away; the shutter click woke us
+CardSpace cardSpace;                                // Free space on the SD card
+TaskHandle_t setupTask;                             // The task running setup(), for the camera task to notify
+volatile esp_err_t cameraErr;                       // The result of esp_camera_init() from the camera task
+BootProfile bootProfile;                            // How long the phases of setup() took
+EnergyMeter energy;                                 // Where the battery's charge goes
+OpticalProfiles opticalProfiles;                    // The pinhole assemblies (and the lens)
+Esp32Clock sysClock;                                // The hardware abstraction layer's parts...
+Esp32Led redLed {LED_BUILTIN, &energy};             // The little red LED
+Esp32Timer ledTimer {"leds"};                       // What times its flashes
+Esp32Button shutter {SHUTTER_GPIO};                 // The "shutter" switch
+Esp32Camera halCamera {cameraConfig};               // The camera
+Esp32Storage sdStorage {SD_MOUNT_POINT, true};      // The SD card, in one-bit mode
+Esp32Counter imageCounter {IC_ADDR};                // The image counter in "EEPROM"
+LedPatterns ledPatterns {redLed, ledTimer};         // The LED's flash patterns
+PinholeCamera pinhole {sysClock, halCamera, sdStorage, imageCounter, ledPatterns, cardSpace};
+AutoExposure autoExposure {sysClock, halCamera, halCamera}; // Exposure control behind a pinhole
+bool pinholeExposure = false;                       // Whether autoExposure is in charge, not the sensor
+JpegMeter jpegMeter;                                // Meters each picture from its JPEG
+JpegStacker jpegStacker;                            // Averages frames for dim scenes
+static const framesize_t cameraFrameSizes[] = {     // The driver's framesize_t for each cfFramesize_t
+  FRAMESIZE_QVGA, FRAMESIZE_CIF, FRAMESIZE_VGA, FRAMESIZE_SVGA, FRAMESIZE_XGA, FRAMESIZE_SXGA, FRAMESIZE_UXGA
+};
+
+/**
+ * @brief Say what went wrong by flashing the little red LED over and over. Never returns.
+ * 
+ * @param pattern The failure's flash pattern
+ */
+void signalFailure(lpPattern_t pattern) {
+  while (true) {
+    ledPatterns.play(pattern);
+    ledPatterns.wait(sysClock);
+  }
+}
+
+/**
+ * @brief Switch to the given optical profile: its exposure bias, lens correction and window on
+ * the sensor, and its EXIF in the pictures. Its tables were worked out at boot, so this is quick.
+ * Behind a pinhole, autoExposure takes over the exposure, aiming higher or lower by the 
+ * exposure bias; the stock lens leaves it to the sensor. Only pictures through the lens are
+ * sharp enough to be judged blurred.
+ */
+void applyProfile(uint8_t index) {
+  const opTables_t &tables = opticalProfiles.tables(index);
+  const opProfile_t &profile = OpticalProfiles::profile(index);
+  pinhole.setHeader(tables.exif, tables.exifLen);
+  if (!halCamera.setProfile(profile.aeLevel, profile.lenc)) {
+    Serial.print("Unable to set the sensor up for the profile.\n");
+  }
+  if (!halCamera.setWindow(profile.windowPercent)) {
+    Serial.print("Unable to set the window for the profile.\n");
+  }
+  pinholeExposure = profile.pinholeUm != 0;
+  pinhole.setMinFine(pinholeExposure ? 0 : FQ_MIN_FINE);
+  if (pinholeExposure) {
+    autoExposure.setTarget((uint8_t)(AE_TARGET + profile.aeLevel * AE_LEVEL_STEP));
+    autoExposure.invalidate();
+  } else if (!halCamera.setAutomatic()) {
+    Serial.print("Unable to hand the exposure back to the sensor.\n");
+  }
+  Serial.printf("Optical profile is '%s'.\n", profile.name);
+}
+
+/**
+ * @brief Say how the last picture metered, warning if too much of it is black or blown out
+ */
+void reportMeter() {
+  const jmStats_t *stats = pinhole.lastStats();
+  if (stats == nullptr || stats->blocks == 0) {
+    return;
+  }
+  uint32_t darkPercent = stats->dark * 100 / stats->blocks;
+  uint32_t clippedPercent = stats->clipped * 100 / stats->blocks;
+  Serial.printf("Metered %u in %u us: %u%% black, %u%% blown out.\n", stats->mean,
+    pinhole.lastMeterMicros(), darkPercent, clippedPercent);
+  if (clippedPercent >= WARN_PERCENT) {
+    Serial.print("Warning: the picture is overexposed.\n");
+  }
+  if (darkPercent >= WARN_PERCENT) {
+    Serial.print("Warning: the picture is underexposed.\n");
+  }
+}
 
 /**
- * @brief Flash the little red LED
+ * @brief Behind a pinhole, bring the exposure up to date, saying so if it changed
  * 
- * @param flashCount Number of times to flash
+ * @return int64_t  esp_timer_get_time() of the last change, before which frames are exposed 
+ *                  the old way; 0 if nothing changed
+ */
+int64_t updateExposure() {
+  aeResult_t result;
+  if (!pinholeExposure) {
+    return 0;
+  }
+  if (!autoExposure.converge(result)) {
+    Serial.print("Unable to set the exposure.\n");
+    return 0;
+  }
+  if (result.steps != 0) {
+    Serial.printf("Exposure is %u rows, clock / %u, gain %u: level %u after %u changes in %u ms%s.\n",
+      result.exposure.lines, result.exposure.clockDiv, result.exposure.gain, result.level, result.steps,
+      result.micros / 1000, result.converged ? "" : " (as close as it gets)");
+  }
+  return result.changedUs;
+}
+
+/**
+ * @brief Make room in PSRAM for stacking frames at the dim frame size. Without PSRAM there's
+ * no room, so pictures of dim scenes are single frames.
+ */
+void setupStacker() {
+  if (!psramFound() || settings.dimFrames < 2) {
+    return;
+  }
+  const resolution_info_t &size = resolution[cameraFrameSizes[settings.dimFrameSize]];
+  uint32_t blocks = JpegStacker::blocksFor(size.width, size.height);
+  size_t outBytes = (size_t)size.width * size.height / STACK_JPEG_DIVISOR;
+  int16_t *sums = (int16_t *)ps_malloc((size_t)blocks * 64 * sizeof(int16_t));
+  uint8_t *out = (uint8_t *)ps_malloc(outBytes);
+  if (sums == nullptr || out == nullptr) {
+    free(sums);
+    free(out);
+    Serial.print("No room to stack frames; pictures of dim scenes will be single frames.\n");
+    return;
+  }
+  jpegStacker.setBuffers(sums, blocks, out, outBytes);
+  pinhole.setStacker(&jpegStacker);
+}
+
+/**
+ * @brief Take a picture of a dim scene: switch the sensor to the faster readout mode of the dim
+ * frame size (no bigger than the usual one), bring the exposure up to date for it, average
+ * settings.dimFrames frames into one, and switch back.
+ *
+ * @param staleMicros esp_timer_get_time() before which frames are stale; 0 if none are
+ */
+pcResult_t shootDim(int64_t staleMicros) {
+  halFramesize_t full = (halFramesize_t)settings.frameSize;
+  halFramesize_t dim = settings.dimFrameSize < settings.frameSize ? (halFramesize_t)settings.dimFrameSize : full;
+  if (halCamera.setFrameSize(dim)) {
+    autoExposure.setFrameSize(dim);
+    staleMicros = esp_timer_get_time();
+  } else {
+    Serial.print("Unable to change the frame size; taking the picture at the usual size.\n");
+    dim = full;
+  }
+  int64_t exposedMicros = updateExposure();
+  staleMicros = exposedMicros > staleMicros ? exposedMicros : staleMicros;
+  pcResult_t result = pinhole.shoot(staleMicros, settings.dimFrames);
+  if (dim != full) {
+    if (!halCamera.setFrameSize(full)) {
+      Serial.print("Unable to change the frame size back.\n");
+    }
+    autoExposure.setFrameSize(full);
+  }
+  return result;
+}
+
+/**
+ * @brief Read what tells this card's file system apart from any other and says whether it has
+ * been written to: the volume serial number in its boot sector and the free cluster count in
+ * its FSInfo sector, which FatFs and computers alike keep up to date as they write. Only FAT32
+ * keeps that count; for FAT12/16 and exFAT this says it can't tell.
+ *
+ * @param serial    Set to the volume serial number
+ * @param freeHint  Set to the FSInfo free cluster count
+ * @return false    Couldn't read them, or the file system doesn't keep them
+ */
+bool readCardKey(uint32_t &serial, uint32_t &freeHint) {
+  static uint8_t sector[512];
+  auto le32 = [](const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+  };
+  uint32_t base = 0;
+  if (disk_read(0, sector, 0, 1) != RES_OK) {
+    return false;
+  }
+  if (memcmp(sector + 82, "FAT32   ", 8) != 0) {
+    base = le32(sector + 454);                    // Not a boot sector; the MBR's first partition
+    if (disk_read(0, sector, base, 1) != RES_OK || memcmp(sector + 82, "FAT32   ", 8) != 0) {
+      return false;
+    }
+  }
+  serial = le32(sector + 67);
+  uint32_t fsInfo = base + (sector[48] | sector[49] << 8);
+  if (disk_read(0, sector, fsInfo, 1) != RES_OK || le32(sector) != 0x41615252UL) {
+    return false;
+  }
+  freeHint = le32(sector + 488);
+  return freeHint != UINT32_MAX;                  // All ones means the count isn't known
+}
+
+/**
+ * @brief Set the given settings to the defaults for this board. Without PSRAM, the frame 
+ * buffer has to fit in ordinary RAM, so it's one SVGA buffer.
  */
-void flashBuiltinLed(uint8_t flashCount = WAVE_FLASH_COUNT, uint8_t flashLen = FLASH_MILLIS) {
-    for (uint8_t i = 0; i < flashCount; i++) {
-    digitalWrite(LED_BUILTIN, LOW);
-    delay(flashLen);
-    digitalWrite(LED_BUILTIN, HIGH);
-    if (i + 1 < flashCount) {
-      delay(flashLen);
-    }  
+void defaultSettings(cfSettings_t &s) {
+  cfDefaults(s);
+  if (!psramFound()) {
+    s.frameSize = CF_FRAMESIZE_SVGA;
+    s.jpegQuality = 12;
+    s.fbCount = 1;
+  }
+}
+
+/**
+ * @brief Bring settings up to date with CF_PATH on the card, which must be mounted. If we're 
+ * waking from deep sleep and the file's size and modification time are what they were when 
+ * we last read it, the settings kept in rtcState are already right and there's nothing to 
+ * do. Otherwise, read the file, with POSIX read() into a static buffer so the heap isn't 
+ * touched, and apply it on top of the defaults.
+ *
+ * @param cached  Whether settings are from before a deep sleep
+ */
+void loadSettings(bool cached) {
+  static char text[CF_FILE_MAX];
+  struct stat st;
+  bool exists = stat(SD_MOUNT_POINT CF_PATH, &st) == 0;
+  uint32_t cfgBytes = exists ? (uint32_t)st.st_size : RTC_NO_CFG;
+  int64_t cfgMtime = exists ? (int64_t)st.st_mtime : 0;
+  if (cached && cfgBytes == rtcState.cfgBytes && cfgMtime == rtcState.cfgMtime) {
+    return;
+  }
+  defaultSettings(settings);
+  rtcState.cfgBytes = cfgBytes;
+  rtcState.cfgMtime = cfgMtime;
+  if (!exists) {
+    return;
   }
+  if (st.st_size > CF_FILE_MAX) {
+    Serial.printf(CF_PATH " is over %u bytes; using the defaults.\n", CF_FILE_MAX);
+    return;
+  }
+  int fd = open(SD_MOUNT_POINT CF_PATH, O_RDONLY);
+  ssize_t len = fd < 0 ? -1 : read(fd, text, sizeof(text));
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (len < 0) {
+    Serial.print("Unable to read " CF_PATH "; using the defaults.\n");
+    return;
+  }
+  int errors = cfParse(text, (size_t)len, settings);
+  if (!psramFound() && (settings.frameSize > CF_FRAMESIZE_SVGA || settings.fbCount > 1)) {
+    Serial.print("Without PSRAM, the camera can only do one SVGA frame buffer.\n");
+    settings.frameSize = settings.frameSize > CF_FRAMESIZE_SVGA ? CF_FRAMESIZE_SVGA : settings.frameSize;
+    settings.fbCount = 1;
+  }
+  Serial.printf("Read the settings in " CF_PATH "%s.\n", errors == 0 ? "" : ", skipping what didn't make sense");
+}
+
+/**
+ * @brief Set the parts of cameraConfig the settings say
+ */
+void configureCamera(const cfSettings_t &s) {
+  cameraConfig.frame_size = cameraFrameSizes[s.frameSize];
+  cameraConfig.jpeg_quality = s.jpegQuality;
+  cameraConfig.fb_count = s.fbCount;
+  cameraConfig.grab_mode = s.grabMode == CF_GRAB_LATEST ? CAMERA_GRAB_LATEST : CAMERA_GRAB_WHEN_EMPTY;
+  cameraConfig.xclk_freq_hz = (int)s.xclkHz;
+}
+
+/**
+ * @brief Keep the energy meter up to date as pinhole.shoot() goes about its business
+ * 
+ * @param phase What shoot() is doing now
+ */
+void shootPhase(pcPhase_t phase) {
+  static const emState_t states[] = {EM_CAPTURE, EM_SD_WRITE, EM_IDLE};
+  energy.enter(states[phase]);
+}
+
+/**
+ * @brief FreeRTOS task that initializes the camera on the other core while setup() gets the SD
+ * card and everything else going. Notifies setupTask when done; the result is in cameraErr.
+ * 
+ * @param config  The camera_config_t to use
+ */
+void cameraInitTask(void *config) {
+  bootProfile.start(BP_CAMERA);
+  cameraErr = esp_camera_init((camera_config_t *)config);
+  bootProfile.end(BP_CAMERA);
+  xTaskNotifyGive(setupTask);
+  vTaskDelete(nullptr);
+}
+
+/**
+ * @brief FreeRTOS task that appends the boot profile to the log on the SD card. Done in the 
+ * background because it's not something anyone should have to wait for.
+ * 
+ * @param unused
+ */
+void bootLogTask(void *unused) {
+  sensor_t *sensor = esp_camera_sensor_get();
+  if (!bootProfile.save(SD_MMC, SD_MMC.cardType(), (uint32_t)(SD_MMC.cardSize() / 1048576ULL), 
+    sensor == nullptr ? 0 : sensor->id.PID)) {
+    Serial.print("Unable to write the boot log.\n");
+  }
+  vTaskDelete(nullptr);
 }
 
 /**
@@ -131,74 +456,75 @@ void flashBuiltinLed(uint8_t flashCount = WAVE_FLASH_COUNT, uint8_t flashLen = F
  * 
  */
 void setup() {
+  bootProfile.begin();
+  energy.begin();
+
   // Get Serial going
-  Serial.begin(9600);
+  bootProfile.start(BP_SERIAL);
+  Serial.begin(SERIAL_BAUD);
   Serial.print(BANNER);
+  bootProfile.end(BP_SERIAL);
   #ifdef DEBUG
   Serial.setDebugOutput(true);
   #endif
 
+  // If a shutter click woke us from deep sleep, we can skip some things and we owe a picture
+  wakeShot = wokeByShutter();
+  releaseShutterPin(SHUTTER_GPIO);
+
+  // If the sensor was off, its PWDN was held high through deep sleep; let the camera driver 
+  // have it back
+  rtc_gpio_hold_dis((gpio_num_t)PWDN_GPIO_NUM);
+
   // Initialize the builtin little red LED
-  pinMode(LED_BUILTIN, OUTPUT);
-  digitalWrite(LED_BUILTIN, HIGH);  // It's active low
-
-  // Set up the camera configuration we'll use
-  camera_config_t config;
-  config.ledc_channel = LEDC_CHANNEL_0;
-  config.ledc_timer = LEDC_TIMER_0;
-  config.pin_d0 = Y2_GPIO_NUM;
-  config.pin_d1 = Y3_GPIO_NUM;
-  config.pin_d2 = Y4_GPIO_NUM;
-  config.pin_d3 = Y5_GPIO_NUM;
-  config.pin_d4 = Y6_GPIO_NUM;
-  config.pin_d5 = Y7_GPIO_NUM;
-  config.pin_d6 = Y8_GPIO_NUM;
-  config.pin_d7 = Y9_GPIO_NUM;
-  config.pin_xclk = XCLK_GPIO_NUM;
-  config.pin_pclk = PCLK_GPIO_NUM;
-  config.pin_vsync = VSYNC_GPIO_NUM;
-  config.pin_href = HREF_GPIO_NUM;
-  config.pin_sccb_sda = SIOD_GPIO_NUM;
-  config.pin_sccb_scl = SIOC_GPIO_NUM;
-  config.pin_pwdn = PWDN_GPIO_NUM;
-  config.pin_reset = RESET_GPIO_NUM;
-  config.xclk_freq_hz = 20000000;
-  config.pixel_format = PIXFORMAT_JPEG;
-  config.grab_mode = CAMERA_GRAB_LATEST;
-  
-  if(psramFound()){
-    #ifdef DEBUG
-    Serial.print("Using UXGA resolution.\n");
-    #endif
-    config.frame_size = FRAMESIZE_UXGA;
-    config.jpeg_quality = 10;
-    config.fb_count = 2;
-  } else {
-    #ifdef DEBUG
-    Serial.print("Using SVGA resolution because PSRAM not present.\n");
-    #endif
-    config.frame_size = FRAMESIZE_SVGA;
-    config.jpeg_quality = 12;
-    config.fb_count = 1;
+  redLed.begin();
+  ledPatterns.begin();
+
+  // Set up the camera configuration we'll use. It's what the settings were when we went to 
+  // sleep or, if we didn't, the defaults. Reading /pinhole.cfg has to wait for the card, and
+  // the camera shouldn't; if the file says otherwise, the camera gets restarted once it's up.
+  bool cachedSettings = rtcState.magic == RTC_STATE_MAGIC;
+  if (!cachedSettings) {
+    defaultSettings(settings);
   }
+  cfSettings_t cameraSettings = settings;           // What the camera is started with
+  cameraConfig.ledc_channel = LEDC_CHANNEL_0;
+  cameraConfig.ledc_timer = LEDC_TIMER_0;
+  cameraConfig.pin_d0 = Y2_GPIO_NUM;
+  cameraConfig.pin_d1 = Y3_GPIO_NUM;
+  cameraConfig.pin_d2 = Y4_GPIO_NUM;
+  cameraConfig.pin_d3 = Y5_GPIO_NUM;
+  cameraConfig.pin_d4 = Y6_GPIO_NUM;
+  cameraConfig.pin_d5 = Y7_GPIO_NUM;
+  cameraConfig.pin_d6 = Y8_GPIO_NUM;
+  cameraConfig.pin_d7 = Y9_GPIO_NUM;
+  cameraConfig.pin_xclk = XCLK_GPIO_NUM;
+  cameraConfig.pin_pclk = PCLK_GPIO_NUM;
+  cameraConfig.pin_vsync = VSYNC_GPIO_NUM;
+  cameraConfig.pin_href = HREF_GPIO_NUM;
+  cameraConfig.pin_sccb_sda = SIOD_GPIO_NUM;
+  cameraConfig.pin_sccb_scl = SIOC_GPIO_NUM;
+  cameraConfig.pin_pwdn = PWDN_GPIO_NUM;
+  cameraConfig.pin_reset = RESET_GPIO_NUM;
+  cameraConfig.pixel_format = PIXFORMAT_JPEG;
+  configureCamera(cameraSettings);
   
-  // Initialize the camera with the configuration we just set up
-  esp_err_t err = esp_camera_init(&config);
-  if (err != ESP_OK) {
-    Serial.printf("Camera init failed with error 0x%x.\n", err);
-    while (true) {
-      flashBuiltinLed(CAMI_FLASH_COUNT);
-      delay(FAIL_MILLIS);
-    }
-  }
+  // Start initializing the camera with the configuration we just set up. It takes a while (it 
+  // probes the sensor over SCCB and loads its registers), so we do it on the other core while 
+  // we get everything else going on this one. (Not when benchmarking the card; the camera 
+  // streaming into PSRAM would skew the results.)
+  #ifndef SD_BENCH
+  setupTask = xTaskGetCurrentTaskHandle();
+  xTaskCreatePinnedToCore(cameraInitTask, "cameraInit", CAM_TASK_STACK, &cameraConfig, 1, nullptr, CAM_TASK_CORE);
+  #endif
   
   // Mount SD card
-  if(!SD_MMC.begin("/sdcard", true)){
+  bootProfile.start(BP_SD_MOUNT);
+  bool mounted = SD_MMC.begin(SD_MOUNT_POINT, true);
+  bootProfile.end(BP_SD_MOUNT);
+  if(!mounted){
     Serial.print("SD Card Mount failed.\n");
-    while (true) {
-      flashBuiltinLed(SDMI_FLASH_COUNT);
-      delay(FAIL_MILLIS);
-    }
+    signalFailure(LP_MOUNT_FAIL);
   }
   
   #ifdef DEBUG
@@ -206,36 +532,120 @@ void setup() {
   #endif
   
   // Verify there's a card in it
+  bootProfile.start(BP_CARD_DETECT);
   uint8_t cardType = SD_MMC.cardType();
+  bootProfile.end(BP_CARD_DETECT);
   if(cardType == CARD_NONE){
     Serial.print("No SD Card inserted.\n");
-    while (true) {
-      flashBuiltinLed(SDCI_FLASH_COUNT);
-      delay(FAIL_MILLIS);
-    }
+    signalFailure(LP_NO_CARD);
   }
   #ifdef DEBUG
   Serial.print("The SD card reader seems to have a card in it.\n");
   #endif
+
+  // Catch up with /pinhole.cfg
+  bootProfile.start(BP_CONFIG);
+  loadSettings(cachedSettings);
+  bootProfile.end(BP_CONFIG);
+  pinhole.setAwakeMillis(settings.awakeMillis);
+  pinhole.setGate((pcGate_t)settings.gate);
+  uint32_t estImageBytes = settings.frameSize > CF_FRAMESIZE_SVGA ? UXGA_EST_BYTES : SVGA_EST_BYTES;
+
+  // Find out how much room there is on the card. This is the only time we ask; from here on
+  // cardSpace keeps track as images are written. (FatFs may have to scan the whole FAT to
+  // answer, which is why we don't want to do it for every shot.) If we're waking from deep sleep
+  // with the same card in the slot, not written to anywhere else, we don't even have to ask once.
+  bootProfile.start(BP_FREE_SPACE);
+  FATFS *fs;
+  DWORD freeClusters;
+  uint32_t cardSerial, cardFreeHint;
+  if (rtcState.magic == RTC_STATE_MAGIC && rtcState.cardBytes == SD_MMC.cardSize() &&
+    readCardKey(cardSerial, cardFreeHint) && cardSerial == rtcState.cardSerial &&
+    cardFreeHint == rtcState.cardFreeHint) {
+    cardSpace.begin(rtcState.totalBytes, rtcState.freeBytes, rtcState.clusterBytes, rtcState.avgImageBytes);
+  } else if (f_getfree("0:", &freeClusters, &fs) == FR_OK) {
+    #if FF_MAX_SS != 512
+    uint32_t clusterBytes = (uint32_t)fs->csize * fs->ssize;
+    #else
+    uint32_t clusterBytes = (uint32_t)fs->csize * 512;
+    #endif
+    cardSpace.begin((uint64_t)(fs->n_fatent - 2) * clusterBytes, (uint64_t)freeClusters * clusterBytes,
+      clusterBytes, estImageBytes);
+  } else {
+    // Can't tell. Assume the card is empty and let the writes fail if it isn't.
+    Serial.print("Unable to determine the free space on the SD card.\n");
+    cardSpace.begin(SD_MMC.cardSize(), SD_MMC.cardSize(), 32768, estImageBytes);
+  }
+  bootProfile.end(BP_FREE_SPACE);
+  Serial.printf("SD card has room for about %u images.\n", cardSpace.shotsRemaining());
+
+  #ifdef SD_BENCH
+  // Benchmark the card, say how it went and go to sleep
+  if (!runSdBench()) {
+    Serial.print("SD benchmark failed.\n");
+    signalFailure(LP_BENCH_FAIL);
+  }
+  Serial.print("SD benchmark complete. Results are in " SD_BENCH_CSV ".\n");
+  ledPatterns.play(LP_WAVE);
+  ledPatterns.wait(sysClock);
+  esp_deep_sleep_start();
+  #endif
   
   // Get "EEPROM" going (it's really flash memory)
+  bootProfile.start(BP_EEPROM);
   EEPROM.begin(sizeof((uint16_t)0));
 
   // Uncomment to reset image counter in EEPROM to 0
   //EEPROM.writeUShort(IC_ADDR, (uint16_t)0);
   //EEPROM.commit();
 
-  // Initialize the image counter
-  imageCtr = EEPROM.readUShort(IC_ADDR);
-  #ifdef DEBUG
-  Serial.printf("Last stored image was Image%d.jpg.\n", imageCtr);
-  #endif
+  // Get the picture taking going; this picks up the image counter
+  pinhole.begin();
+  pinhole.onPhase(shootPhase);
+  jpegMeter.setLimit(&sysClock, METER_LIMIT_MICROS);
+  pinhole.setMeter(&jpegMeter);
+  setupStacker();
+  bootProfile.end(BP_EEPROM);
 
   // Start the shutter switch
+  bootProfile.start(BP_SHUTTER);
   shutter.begin();
+  bootProfile.end(BP_SHUTTER);
+
+  // Wait for the camera to be ready
+  bootProfile.start(BP_CAMERA_WAIT);
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  bootProfile.end(BP_CAMERA_WAIT);
+  if (cameraErr != ESP_OK) {
+    Serial.printf("Camera init failed with error 0x%x.\n", cameraErr);
+    signalFailure(LP_CAMERA_FAIL);
+  }
+  if (!cfSameCamera(settings, cameraSettings)) {
+    Serial.print("The camera settings in " CF_PATH " have changed; restarting the camera.\n");
+    configureCamera(settings);
+    if (!halCamera.restart()) {
+      signalFailure(LP_CAMERA_FAIL);
+    }
+  }
+  opticalProfiles.begin();
+  applyProfile(settings.profile);
 
-  // Show we're ready
-  flashBuiltinLed();
+  // Show we're ready, without making loop() wait for the show to be over. Same for logging how 
+  // long it took to get here. If the shutter woke us, the picture we're about to take says it 
+  // all; just make sure the click that woke us is over so it doesn't count as a second one.
+  bootProfile.ready();
+  energy.enter(EM_IDLE);
+  if (wakeShot) {
+    unsigned long startMillis = millis();
+    while (shutter.isDown() && millis() - startMillis < RELEASE_MILLIS) {
+      delay(1);
+    }
+  } else {
+    ledPatterns.play(LP_WAVE);
+  }
+  xTaskCreatePinnedToCore(bootLogTask, "bootLog", LOG_TASK_STACK, nullptr, 0, nullptr, CAM_TASK_CORE);
+  Serial.printf("Ready %u ms after %s.\n", (unsigned)(bootProfile.readyMicros() / 1000),
+    bootProfile.woke() ? "waking (not counting the bootloader)" : "power-on");
   #ifdef DEBUG
   Serial.print("Initialization complete.\n");
   #endif
@@ -246,57 +656,166 @@ void setup() {
  * 
  */
 void loop() {
-  static unsigned long clickedMillis = millis();                  // When the shutter was last clicked
-
-  // Take a picture if the shutter was depressed
-  if (shutter.clicked()) {
-    clickedMillis = millis();
+  static bool firstShot = true;                                   // Whether we've saved an image yet
+  static unsigned long activeMillis = millis();                   // When something last happened
+  static int64_t pressMicros = 0;                                 // When the shutter was seen going down
+  static int64_t staleMicros = 0;                                 // Frames from before this are stale
+  static bool sensorDown = false;                                 // Whether the sensor is powered down
+  static uint32_t sensorUpMillis = 0;                             // How long powering it up took
+  static bool dimPending = false;                                 // Whether a hold asked for a dim picture
 
-    // Capture image
-    camera_fb_t * fb = esp_camera_fb_get();  
-    if(!fb) {
-      Serial.print("Camera capture failed.\n");
-      return;
+  // Notice the shutter going down as early as we can. That's when the click-to-capture clock 
+  // starts, and it's time to speed back up.
+  if (shutter.isDown()) {
+    if (pressMicros == 0) {
+      pressMicros = esp_timer_get_time();
+      setCpuFrequencyMhz(BUSY_CPU_MHZ);
     }
-    #ifdef DEBUG
-    Serial.print("Got the framebuffer.\n");
-    #endif
-
-    // Figure out what to call the image file
-    String path = "/Image" + String(++imageCtr) + ".jpg";
-    #ifdef DEBUG
-    Serial.printf("The file name for the image is '%s'.\n", path.c_str());
-    #endif
+    activeMillis = millis();
+  }
 
-    // Save the image
-    File file = SD_MMC.open(path.c_str(), FILE_WRITE);
-    if(!file){
-      Serial.print("Unable to create the file for the image.\n");
-      return;
+  // Power the sensor back up as soon as the shutter goes down, giving it a head start while the
+  // click finishes. If the register restore doesn't take, do it the slow way.
+  if (sensorDown && pressMicros != 0) {
+    int64_t upMicros = esp_timer_get_time();
+    if (!sensorPowerUp((gpio_num_t)PWDN_GPIO_NUM)) {
+      Serial.print("Sensor register restore failed; reinitializing the camera.\n");
+      sensorForgetSnapshot();
+      halCamera.restart();
     }
-    size_t sz = file.write(fb->buf, fb->len);
-    Serial.printf("Saved image to: '%s' (%d bytes)\n", path.c_str(), fb->len);
-    EEPROM.writeUShort(IC_ADDR, imageCtr);
-    EEPROM.commit();
-
-    flashBuiltinLed(SNAP_FLASH_COUNT);
-    #ifdef DEBUG
-    Serial.printf("Committed imageCtr (%d) to 'eeprom'.\n", imageCtr);
-    #endif
+    autoExposure.invalidate();                    // The snapshot may be from another exposure
+    sensorUpMillis = (uint32_t)((esp_timer_get_time() - upMicros) / 1000);
+    staleMicros = esp_timer_get_time();
+    sensorDown = false;
+  }
 
-    // Clean up
-    file.close();
-    esp_camera_fb_return(fb); 
+  // Take a picture if the shutter was clicked or if its click woke us. A double-click is two 
+  // pictures, as it always was. A long press moves on to the next optical profile, and says
+  // which it is with that many long flashes, one for the first. Holding the shutter down takes a
+  // picture of a dim scene once it's let go, so pressing it doesn't shake the camera. If we've
+  // been dozing, the frames waiting for us are old; skip them.
+  halButtonEvent_t event;
+  bool clicked = false;
+  while (!clicked && shutter.event(sysClock, event)) {
+    if (event.gesture == HAL_CLICK || event.gesture == HAL_DOUBLE_CLICK) {
+      clicked = true;
+      pressMicros = event.downUs;
+    } else if (event.gesture == HAL_LONG_PRESS) {
+      settings.profile = (uint8_t)((settings.profile + 1) % OpticalProfiles::count());
+      applyProfile(settings.profile);
+      for (uint8_t i = 0; i <= settings.profile; i++) {
+        ledPatterns.play(LP_PROFILE);
+      }
+      updateExposure();
+      activeMillis = millis();
+    } else {
+      Serial.print("Shutter held down; taking a picture of a dim scene when it's let go.\n");
+      dimPending = true;
+      activeMillis = millis();
+    }
+  }
+  bool dim = !clicked && dimPending && !shutter.isDown();
+  if (clicked || wakeShot || dim) {
+    pcResult_t result;
+    if (dim) {
+      dimPending = false;
+      pressMicros = 0;                            // It went down seconds ago, on purpose
+      result = shootDim(staleMicros);
+    } else {
+      int64_t exposedMicros = updateExposure();
+      staleMicros = exposedMicros > staleMicros ? exposedMicros : staleMicros;
+      result = pinhole.shoot(staleMicros);
+    }
+    staleMicros = 0;
+    if (result == PC_SAVED) {
+      energy.shot();
+      if (pinhole.lastFrames() > 1) {
+        Serial.printf("Averaged %u frames.\n", pinhole.lastFrames());
+      }
+      reportMeter();
+      if (pressMicros != 0) {
+        Serial.printf("Captured %u ms after the shutter went down.\n", 
+          (uint32_t)((pinhole.lastCaptureMicros() - pressMicros) / 1000));
+      }
+      if (sensorUpMillis != 0) {
+        Serial.printf("Powering up the sensor took %u ms of that.\n", sensorUpMillis);
+        sensorUpMillis = 0;
+      }
+      if (wakeShot) {
+        uint32_t sinceSavedMicros = (uint32_t)(esp_timer_get_time() - pinhole.lastSavedMicros());
+        Serial.printf("Image saved %u ms after the click that woke the camera.\n", 
+          (wakeMicros() - sinceSavedMicros) / 1000);
+      } else if (firstShot) {
+        // esp_timer starts when the app does, so this leaves out the ROM bootloader's ~0.3 s
+        Serial.printf("First image saved %u ms after boot.\n", (uint32_t)(pinhole.lastSavedMicros() / 1000));
+      }
+      firstShot = false;
+    }
+    wakeShot = false;
+    pressMicros = 0;
+    activeMillis = millis();
   }
 
-  // If it's been a long time since the shutter was clicked, go to sleep. (Press reset button to wake up.)
-  if (millis() - clickedMillis > AWAKE_MILLIS) {
+  // If it's been a long time since the shutter was clicked, go to sleep. (Click the shutter to wake up.)
+  if (pinhole.sleepDue()) {
     // Shutdown "eeprom"
     EEPROM.end();
 
+    // Remember what we know about the card so we don't have to ask it again when we wake. The
+    // settings are in rtcState already.
+    rtcState.magic = RTC_STATE_MAGIC;
+    rtcState.cardBytes = SD_MMC.cardSize();
+    rtcState.totalBytes = cardSpace.totalBytes();
+    rtcState.freeBytes = cardSpace.freeBytes();
+    rtcState.clusterBytes = cardSpace.clusterBytes();
+    rtcState.avgImageBytes = cardSpace.avgImageBytes();
+
     // Sleepy-byes.
-    Serial.print("Going to sleep.\n");
-    flashBuiltinLed();
-    esp_deep_sleep_start();
+    Serial.printf("Going to sleep. About %.1f mAh used since power-on.\n", energy.totalMah());
+    ledPatterns.play(LP_WAVE);
+    ledPatterns.wait(sysClock);
+    if (!energy.sleep(SD_MMC)) {
+      Serial.print("Unable to write the energy log.\n");
+    }
+
+    // Last of all, after the energy log's been written, note which card this is and how full
+    // it says it is, so we can tell on waking if it's been swapped or written to elsewhere.
+    // If it can't tell us, the free space is asked for again when we wake.
+    if (!readCardKey(rtcState.cardSerial, rtcState.cardFreeHint)) {
+      rtcState.cardBytes = 0;
+    }
+    if (settings.sensorOff) {
+      digitalWrite(PWDN_GPIO_NUM, HIGH);
+      rtc_gpio_hold_en((gpio_num_t)PWDN_GPIO_NUM);
+    }
+    sleepUntilShutter(SHUTTER_GPIO);
+  }
+
+  // If nothing's going on, slow down and, unless we're polling, doze until the shutter is 
+  // pressed or it's time for deep sleep. Not while the LED is flashing, though; esp_timer
+  // doesn't wake us from light sleep, so it would stay on until the next click.
+  if (!wakeShot && millis() - activeMillis > DOZE_MILLIS && !ledPatterns.busy()) {
+    pressMicros = 0;
+    if (getCpuFrequencyMhz() != IDLE_CPU_MHZ) {
+      setCpuFrequencyMhz(IDLE_CPU_MHZ);
+    }
+    if (settings.sensorOff && !sensorDown) {
+      sensorDown = sensorPowerDown((gpio_num_t)PWDN_GPIO_NUM);
+    }
+    if (settings.doze) {
+      Serial.flush();
+      uint32_t awakeMillisLeft = pinhole.awakeMillisLeft();
+      energy.enter(EM_DOZE);
+      bool shutterWoke = awakeMillisLeft > 0 && lightSleepUntilShutter(SHUTTER_GPIO, awakeMillisLeft);
+      int64_t wokeMicros = esp_timer_get_time();
+      shutter.resume(wokeMicros);
+      if (shutterWoke) {
+        pressMicros = wokeMicros;
+        setCpuFrequencyMhz(BUSY_CPU_MHZ);
+      }
+      energy.enter(EM_IDLE);
+      staleMicros = esp_timer_get_time();
+      activeMillis = millis();
+    }
   }
 }
\ No newline at end of file
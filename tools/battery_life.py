@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""
+ESP32 Pinhole Camera battery_life.py
+
+Project how long a battery will last from the energy.csv logs the camera writes to its SD card
+(see include/EnergyMeter.h). The logs say how long the camera spends booting, idling, dozing,
+capturing and writing; this script turns the averages into the charge used by one cycle of a
+time-lapse schedule (wake, take some pictures, stay awake for a while, deep sleep until the
+next one) and divides that into the battery.
+
+    python3 tools/battery_life.py energy.csv --battery-mah 2500 --interval-min 15
+
+The current drawn in each state defaults to the same table the firmware uses. Measure your
+board and pass your own with --current, e.g. --current idle=95 deep_sleep=4.5.
+
+Copyright 2023 by D.L. Ehnebuske
+License: GNU Lesser General Public License v2.1
+"""
+import argparse
+import csv
+import sys
+
+# mA from a 5V supply in each state; keep in step with emCurrentMa in src/EnergyMeter.cpp
+CURRENT_MA = {
+    "boot": 130.0,
+    "idle": 110.0,
+    "doze": 35.0,
+    "capture": 170.0,
+    "sd_write": 190.0,
+    "deep_sleep": 6.0,
+    "led": 5.0,
+}
+
+
+def read_sessions(paths):
+    """All the session records in the given files, with the numbers as floats."""
+    sessions = []
+    for path in paths:
+        with open(path, newline="") as f:
+            for row in csv.DictReader(f):
+                sessions.append({k: float(v) for k, v in row.items()})
+    return sessions
+
+
+def parse_currents(overrides):
+    """The current table with any name=mA overrides applied."""
+    currents = dict(CURRENT_MA)
+    for item in overrides:
+        name, _, value = item.partition("=")
+        if name not in currents or not value:
+            sys.exit(f"Bad --current '{item}'; expected one of {', '.join(currents)} as name=mA.")
+        currents[name] = float(value)
+    return currents
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Battery life projection from camera energy.csv logs")
+    parser.add_argument("logs", nargs="+", help="energy.csv files")
+    parser.add_argument("--battery-mah", type=float, required=True, help="battery capacity")
+    parser.add_argument("--usable", type=float, default=0.8,
+                        help="fraction of the capacity that's really usable (default 0.8)")
+    parser.add_argument("--interval-min", type=float, required=True,
+                        help="minutes from one wake to the next")
+    parser.add_argument("--shots-per-wake", type=int, default=1, help="images per wake (default 1)")
+    parser.add_argument("--awake-s", type=float, default=300.0,
+                        help="seconds awake after the last shot before deep sleep (default 300)")
+    parser.add_argument("--current", nargs="+", default=[], metavar="STATE=MA",
+                        help="override the current drawn in a state")
+    args = parser.parse_args()
+
+    sessions = read_sessions(args.logs)
+    if not sessions:
+        sys.exit("No sessions to work from.")
+    currents = parse_currents(args.current)
+    shots = sum(s["shots"] for s in sessions)
+    if shots == 0:
+        sys.exit("The logs don't have any shots in them.")
+
+    # Per-session and per-shot averages from the logs
+    boot_s = sum(s["boot_s"] for s in sessions) / len(sessions)
+    led_s = sum(s["led_s"] for s in sessions) / len(sessions)
+    capture_s = sum(s["capture_s"] for s in sessions) / shots
+    write_s = sum(s["sd_write_s"] for s in sessions) / shots
+    waiting_s = sum(s["idle_s"] + s["doze_s"] for s in sessions)
+    doze_fraction = sum(s["doze_s"] for s in sessions) / waiting_s if waiting_s else 0.0
+
+    # One cycle of the schedule
+    cycle_s = args.interval_min * 60
+    times = {
+        "boot": boot_s,
+        "capture": capture_s * args.shots_per_wake,
+        "sd_write": write_s * args.shots_per_wake,
+        "idle": args.awake_s * (1 - doze_fraction),
+        "doze": args.awake_s * doze_fraction,
+        "led": led_s,
+    }
+    awake_s = sum(t for name, t in times.items() if name != "led")
+    if awake_s > cycle_s:
+        sys.exit(f"The camera is awake {awake_s:.0f} s per cycle; that doesn't fit in {cycle_s:.0f} s.")
+    times["deep_sleep"] = cycle_s - awake_s
+
+    cycle_mah = sum(times[name] * currents[name] for name in times) / 3600
+    life_h = args.battery_mah * args.usable / (cycle_mah * 3600 / cycle_s)
+
+    print(f"From {len(sessions)} sessions and {int(shots)} shots:")
+    print(f"  {'state':<12}{'s/cycle':>10}{'mA':>8}{'mAh/cycle':>11}")
+    for name, t in times.items():
+        print(f"  {name:<12}{t:10.2f}{currents[name]:8.1f}{t * currents[name] / 3600:11.4f}")
+    print(f"  {'total':<12}{cycle_s:10.2f}{'':>8}{cycle_mah:11.4f}")
+    print(f"Average current {cycle_mah * 3600 / cycle_s:.2f} mA; "
+          f"battery lasts about {life_h:.0f} h ({life_h / 24:.1f} days, "
+          f"{int(life_h * 3600 / cycle_s * args.shots_per_wake)} images).")
+
+
+if __name__ == "__main__":
+    main()
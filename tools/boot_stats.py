@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+"""
+ESP32 Pinhole Camera boot_stats.py
+
+Summarize the boot.csv logs the camera writes to its SD card (see include/BootProfile.h).
+Give it one or more boot.csv files, from as many cameras and cards as you like, and it prints
+the median, 90th and 99th percentile and worst time for each boot phase, in milliseconds.
+With --by, the boots are grouped by one or more of the log's identifying columns first.
+
+    python3 tools/boot_stats.py card1/boot.csv card2/boot.csv --by card_type sensor_pid
+
+Boots after a wake from deep sleep (reset reason 8) are left out unless --all is given; the
+rom phase can't be told for them, so the camera logs it as 0.
+
+Copyright 2023 by D.L. Ehnebuske
+License: GNU Lesser General Public License v2.1
+"""
+import argparse
+import csv
+import math
+import sys
+
+ID_COLUMNS = ("reset", "card_type", "card_mib", "sensor_pid")
+DEEPSLEEP_RESET = "8"
+
+
+def percentile(values, pct):
+    """Nearest-rank percentile of an already sorted list."""
+    rank = max(1, math.ceil(pct / 100 * len(values)))
+    return values[rank - 1]
+
+
+def read_boots(paths, keep_wakes):
+    """All the boot records in the given files, as dicts."""
+    boots = []
+    for path in paths:
+        with open(path, newline="") as f:
+            for row in csv.DictReader(f):
+                if keep_wakes or row["reset"] != DEEPSLEEP_RESET:
+                    boots.append(row)
+    return boots
+
+
+def summarize(boots, out):
+    """Print the percentile table for one group of boots."""
+    phases = [c for c in boots[0] if c.endswith("_us")]
+    out.write(f"  {'phase':<14}{'p50':>9}{'p90':>9}{'p99':>9}{'max':>9}   (ms, {len(boots)} boots)\n")
+    for phase in phases:
+        values = sorted(int(b[phase]) / 1000 for b in boots if b.get(phase))
+        if not values:
+            continue
+        out.write(f"  {phase[:-3]:<14}" + "".join(
+            f"{v:9.1f}" for v in (percentile(values, 50), percentile(values, 90),
+                                  percentile(values, 99), values[-1])) + "\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Boot phase percentiles from camera boot.csv logs")
+    parser.add_argument("logs", nargs="+", help="boot.csv files")
+    parser.add_argument("--by", nargs="+", choices=ID_COLUMNS, default=[],
+                        help="group boots by these columns")
+    parser.add_argument("--all", action="store_true", help="include wakes from deep sleep")
+    args = parser.parse_args()
+
+    boots = read_boots(args.logs, args.all)
+    if not boots:
+        sys.exit("No boots to summarize.")
+    groups = {}
+    for boot in boots:
+        groups.setdefault(tuple(boot[c] for c in args.by), []).append(boot)
+    for key in sorted(groups):
+        if args.by:
+            print(", ".join(f"{c}={v}" for c, v in zip(args.by, key)))
+        summarize(groups[key], sys.stdout)
+
+
+if __name__ == "__main__":
+    main()